@@ -0,0 +1,98 @@
+/*
+Copyright (C) 2013  simplex
+
+This program is free software; you can redistribute it and/or
+modify it under the terms of the GNU General Public License
+as published by the Free Software Foundation; either version 2
+of the License, or (at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+
+
+
+/*
+ * Times a chain of three per pixel stages (premultiply, demultiply and
+ * premultiply again) over a 2048x2048 native image, run as three separate
+ * passes and as a single fused one, and checks both give the same pixels.
+ *
+ * With any argument, the alpha is made opaque, which takes the kernels'
+ * fast paths.
+ */
+
+#include "image_operations.hpp"
+
+#include <cstdio>
+#include <cstring>
+#include <algorithm>
+
+
+using namespace KTools;
+
+
+static const size_t SIDE = 2048;
+static const int ROUNDS = 10;
+
+static void fill(RGBAImage& img, bool opaque) {
+	uint32_t state = 1;
+	for(size_t y = 0; y < img.rows(); y++) {
+		RGBAImage::byte_t* p = img.row(y);
+		for(size_t x = 0; x < 4*img.columns(); x++) {
+			state = state*1103515245u + 12345u;
+			p[x] = RGBAImage::byte_t(state >> 16);
+		}
+		if(opaque) {
+			for(size_t x = 0; x < img.columns(); x++) {
+				p[4*x + 3] = 255;
+			}
+		}
+	}
+}
+
+int main(int argc, char* argv[]) {
+	(void)argv;
+	const bool opaque = (argc > 1);
+
+	RGBAImage separate(SIDE, SIDE), fused(SIDE, SIDE);
+	fill(separate, opaque);
+	fill(fused, opaque);
+
+	ImOp::rgba_image_operation_chain chain;
+	chain.push_back( ImOp::premultiplyAlphaRows() );
+	chain.push_back( ImOp::demultiplyAlphaRows() );
+	chain.push_back( ImOp::premultiplyAlphaRows() );
+
+	double best_separate = 1e9, best_fused = 1e9;
+	for(int r = 0; r < ROUNDS; r++) {
+		const double t0 = getWallTime();
+		ImOp::premultiplyAlpha()(separate);
+		ImOp::demultiplyAlpha()(separate);
+		ImOp::premultiplyAlpha()(separate);
+		const double t1 = getWallTime();
+		chain(fused);
+		const double t2 = getWallTime();
+
+		best_separate = std::min(best_separate, t1 - t0);
+		best_fused = std::min(best_fused, t2 - t1);
+	}
+
+	for(size_t y = 0; y < SIDE; y++) {
+		if(std::memcmp(separate.row(y), fused.row(y), 4*SIDE) != 0) {
+			std::printf("The fused chain gave different pixels.\n");
+			return 1;
+		}
+	}
+
+	std::printf("%s %lux%lu image, best of %d rounds\n", opaque ? "Opaque" : "Random", (unsigned long)SIDE, (unsigned long)SIDE, ROUNDS);
+	std::printf("separate (%lu passes): %.1f ms\n", (unsigned long)chain.size(), 1e3*best_separate);
+	std::printf("fused (%lu pass): %.1f ms\n", (unsigned long)chain.passes(), 1e3*best_fused);
+
+	return 0;
+}
@@ -24,8 +24,13 @@
    -------------------------------------------------------------------------- */
    
 #include "alpha.h"
+#include "config.h"
 #include <algorithm>
 
+#if SQUISH_USE_SSE >= 2
+#include <emmintrin.h>
+#endif
+
 namespace squish {
 
 static int FloatToInt( float a, int limit )
@@ -97,48 +102,6 @@ static void FixRange( int& min, int& max, int steps )
 		min = std::max( 0, max - steps );
 }
 
-static int FitCodes( u8 const* rgba, int mask, u8 const* codes, u8* indices )
-{
-	// fit each alpha value to the codebook
-	int err = 0;
-	for( int i = 0; i < 16; ++i )
-	{
-		// check this pixel is valid
-		int bit = 1 << i;
-		if( ( mask & bit ) == 0 )
-		{
-			// use the first code
-			indices[i] = 0;
-			continue;
-		}
-		
-		// find the least error and corresponding index
-		int value = rgba[4*i + 3];
-		int least = INT_MAX;
-		int index = 0;
-		for( int j = 0; j < 8; ++j )
-		{
-			// get the squared error from this code
-			int dist = ( int )value - ( int )codes[j];
-			dist *= dist;
-			
-			// compare with the best so far
-			if( dist < least )
-			{
-				least = dist;
-				index = j;
-			}
-		}
-		
-		// save this index and accumulate the error
-		indices[i] = ( u8 )index;
-		err += least;
-	}
-	
-	// return the total error
-	return err;
-}
-
 static void WriteAlphaBlock( int alpha0, int alpha1, u8 const* indices, void* block )
 {
 	u8* bytes = reinterpret_cast< u8* >( block );
@@ -227,13 +190,108 @@ static void WriteAlphaBlock7( int alpha0, int alpha1, u8 const* indices, void* b
 	}	
 }
 
-void CompressAlphaDxt5( u8 const* rgba, int mask, void* block )
+#if SQUISH_USE_SSE >= 2
+
+//! Gathers the 16 alpha values of the block into the bytes of a register.
+static __m128i LoadAlphas( u8 const* rgba )
 {
-	// get the range for 5-alpha and 7-alpha interpolation
-	int min5 = 255;
-	int max5 = 0;
-	int min7 = 255;
-	int max7 = 0;
+	__m128i const* pixels = reinterpret_cast< __m128i const* >( rgba );
+	__m128i a0 = _mm_srli_epi32( _mm_loadu_si128( pixels ), 24 );
+	__m128i a1 = _mm_srli_epi32( _mm_loadu_si128( pixels + 1 ), 24 );
+	__m128i a2 = _mm_srli_epi32( _mm_loadu_si128( pixels + 2 ), 24 );
+	__m128i a3 = _mm_srli_epi32( _mm_loadu_si128( pixels + 3 ), 24 );
+	return _mm_packus_epi16( _mm_packs_epi32( a0, a1 ), _mm_packs_epi32( a2, a3 ) );
+}
+
+//! Expands the pixel mask to a byte of all ones per valid pixel.
+static __m128i ExpandMask( int mask )
+{
+	__m128i const bits = _mm_setr_epi8( 1, 2, 4, 8, 16, 32, 64, -128, 1, 2, 4, 8, 16, 32, 64, -128 );
+	__m128i const lo = _mm_set1_epi8( ( char )( mask & 0xff ) );
+	__m128i const hi = _mm_set1_epi8( ( char )( ( mask >> 8 ) & 0xff ) );
+	__m128i const bytes = _mm_unpacklo_epi64( lo, hi );
+	return _mm_cmpeq_epi8( _mm_and_si128( bytes, bits ), bits );
+}
+
+static int HorizontalMin( __m128i v )
+{
+	v = _mm_min_epu8( v, _mm_srli_si128( v, 8 ) );
+	v = _mm_min_epu8( v, _mm_srli_si128( v, 4 ) );
+	v = _mm_min_epu8( v, _mm_srli_si128( v, 2 ) );
+	v = _mm_min_epu8( v, _mm_srli_si128( v, 1 ) );
+	return _mm_cvtsi128_si32( v ) & 0xff;
+}
+
+static int HorizontalMax( __m128i v )
+{
+	v = _mm_max_epu8( v, _mm_srli_si128( v, 8 ) );
+	v = _mm_max_epu8( v, _mm_srli_si128( v, 4 ) );
+	v = _mm_max_epu8( v, _mm_srli_si128( v, 2 ) );
+	v = _mm_max_epu8( v, _mm_srli_si128( v, 1 ) );
+	return _mm_cvtsi128_si32( v ) & 0xff;
+}
+
+static void GetAlphaRanges( __m128i alpha, __m128i valid, int& min5, int& max5, int& min7, int& max7 )
+{
+	// the invalid pixels (and, for 5-alpha, the explicit 0 and 255) are 
+	// replaced by values that cannot change the result
+	__m128i const zero = _mm_setzero_si128();
+	__m128i const full = _mm_set1_epi8( -1 );
+	__m128i const inner = _mm_andnot_si128( 
+		_mm_or_si128( _mm_cmpeq_epi8( alpha, zero ), _mm_cmpeq_epi8( alpha, full ) ), valid );
+	
+	min7 = HorizontalMin( _mm_or_si128( alpha, _mm_andnot_si128( valid, full ) ) );
+	max7 = HorizontalMax( _mm_and_si128( alpha, valid ) );
+	min5 = HorizontalMin( _mm_or_si128( alpha, _mm_andnot_si128( inner, full ) ) );
+	max5 = HorizontalMax( _mm_and_si128( alpha, inner ) );
+}
+
+static __m128i AbsoluteDifference( __m128i a, __m128i b )
+{
+	return _mm_or_si128( _mm_subs_epu8( a, b ), _mm_subs_epu8( b, a ) );
+}
+
+static int FitCodes( __m128i alpha, __m128i valid, u8 const* codes, u8* indices )
+{
+	// find the closest code to each value, keeping the first on ties (the 
+	// absolute distances order the same as the squared ones)
+	__m128i least = AbsoluteDifference( alpha, _mm_set1_epi8( ( char )codes[0] ) );
+	__m128i index = _mm_setzero_si128();
+	for( int j = 1; j < 8; ++j )
+	{
+		// get the distance from this code
+		__m128i const dist = AbsoluteDifference( alpha, _mm_set1_epi8( ( char )codes[j] ) );
+		
+		// compare with the best so far
+		__m128i const smaller = _mm_min_epu8( dist, least );
+		__m128i const keep = _mm_cmpeq_epi8( smaller, least );
+		least = smaller;
+		index = _mm_or_si128( _mm_and_si128( keep, index ), _mm_andnot_si128( keep, _mm_set1_epi8( ( char )j ) ) );
+	}
+	
+	// use the first code for the invalid pixels, which add no error
+	least = _mm_and_si128( least, valid );
+	index = _mm_and_si128( index, valid );
+	_mm_storeu_si128( reinterpret_cast< __m128i* >( indices ), index );
+	
+	// sum the squared errors
+	__m128i const zero = _mm_setzero_si128();
+	__m128i const lo = _mm_unpacklo_epi8( least, zero );
+	__m128i const hi = _mm_unpackhi_epi8( least, zero );
+	__m128i sum = _mm_add_epi32( _mm_madd_epi16( lo, lo ), _mm_madd_epi16( hi, hi ) );
+	sum = _mm_add_epi32( sum, _mm_srli_si128( sum, 8 ) );
+	sum = _mm_add_epi32( sum, _mm_srli_si128( sum, 4 ) );
+	return _mm_cvtsi128_si32( sum );
+}
+
+#else
+
+static void GetAlphaRanges( u8 const* rgba, int mask, int& min5, int& max5, int& min7, int& max7 )
+{
+	min5 = 255;
+	max5 = 0;
+	min7 = 255;
+	max7 = 0;
 	for( int i = 0; i < 16; ++i )
 	{
 		// check this pixel is valid
@@ -252,6 +310,63 @@ void CompressAlphaDxt5( u8 const* rgba, int mask, void* block )
 		if( value != 255 && value > max5 )
 			max5 = value;
 	}
+}
+
+static int FitCodes( u8 const* rgba, int mask, u8 const* codes, u8* indices )
+{
+	// fit each alpha value to the codebook
+	int err = 0;
+	for( int i = 0; i < 16; ++i )
+	{
+		// check this pixel is valid
+		int bit = 1 << i;
+		if( ( mask & bit ) == 0 )
+		{
+			// use the first code
+			indices[i] = 0;
+			continue;
+		}
+		
+		// find the least error and corresponding index
+		int value = rgba[4*i + 3];
+		int least = INT_MAX;
+		int index = 0;
+		for( int j = 0; j < 8; ++j )
+		{
+			// get the squared error from this code
+			int dist = ( int )value - ( int )codes[j];
+			dist *= dist;
+			
+			// compare with the best so far
+			if( dist < least )
+			{
+				least = dist;
+				index = j;
+			}
+		}
+		
+		// save this index and accumulate the error
+		indices[i] = ( u8 )index;
+		err += least;
+	}
+	
+	// return the total error
+	return err;
+}
+
+#endif
+
+void CompressAlphaDxt5( u8 const* rgba, int mask, void* block )
+{
+	// get the range for 5-alpha and 7-alpha interpolation
+	int min5, max5, min7, max7;
+#if SQUISH_USE_SSE >= 2
+	__m128i const alpha = LoadAlphas( rgba );
+	__m128i const valid = ExpandMask( mask );
+	GetAlphaRanges( alpha, valid, min5, max5, min7, max7 );
+#else
+	GetAlphaRanges( rgba, mask, min5, max5, min7, max7 );
+#endif
 	
 	// handle the case that no valid range was found
 	if( min5 > max5 )
@@ -282,8 +397,13 @@ void CompressAlphaDxt5( u8 const* rgba, int mask, void* block )
 	// fit the data to both code books
 	u8 indices5[16];
 	u8 indices7[16];
+#if SQUISH_USE_SSE >= 2
+	int err5 = FitCodes( alpha, valid, codes5, indices5 );
+	int err7 = FitCodes( alpha, valid, codes7, indices7 );
+#else
 	int err5 = FitCodes( rgba, mask, codes5, indices5 );
 	int err7 = FitCodes( rgba, mask, codes7, indices7 );
+#endif
 	
 	// save the block with least error
 	if( err5 <= err7 )
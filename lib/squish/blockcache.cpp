@@ -0,0 +1,249 @@
+/* -----------------------------------------------------------------------------
+
+	Copyright (c) 2006 Simon Brown                          si@sjbrown.co.uk
+
+	Permission is hereby granted, free of charge, to any person obtaining
+	a copy of this software and associated documentation files (the 
+	"Software"), to	deal in the Software without restriction, including
+	without limitation the rights to use, copy, modify, merge, publish,
+	distribute, sublicense, and/or sell copies of the Software, and to 
+	permit persons to whom the Software is furnished to do so, subject to 
+	the following conditions:
+
+	The above copyright notice and this permission notice shall be included
+	in all copies or substantial portions of the Software.
+
+	THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS
+	OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF 
+	MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+	IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY 
+	CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, 
+	TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE 
+	SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+	
+   -------------------------------------------------------------------------- */
+
+#include "blockcache.h"
+#include <cstring>
+
+#ifdef _OPENMP
+#	include <omp.h>
+#endif
+
+namespace squish {
+
+/*! @brief A set associative cache of compressed blocks, shared by all threads.
+
+	The sets are spread over a fixed number of shards, each with its own 
+	lock and counters, so that threads compressing different blocks rarely
+	wait on each other.
+*/
+class BlockCache
+{
+public:
+	//! The ways of each set.
+	enum { kWays = 4 };
+
+	//! The memory taken by each cached block.
+	enum { kEntrySize = 64 + 16 + sizeof( int ) };
+
+	BlockCache( std::size_t sets )
+	  : m_sets( sets ), 
+		m_entries( new Entry[sets*kWays] ), 
+		m_victims( new u8[sets] )
+	{
+		// the fixed flags are never 0, so zeroed entries are empty
+		std::memset( m_entries, 0, sets*kWays*sizeof( Entry ) );
+		std::memset( m_victims, 0, sets );
+		for( int i = 0; i < kShards; ++i )
+		{
+			m_shards[i].hits = 0;
+			m_shards[i].misses = 0;
+#ifdef _OPENMP
+			omp_init_lock( &m_shards[i].lock );
+#endif
+		}
+	}
+
+	~BlockCache()
+	{
+#ifdef _OPENMP
+		for( int i = 0; i < kShards; ++i )
+			omp_destroy_lock( &m_shards[i].lock );
+#endif
+		delete[] m_entries;
+		delete[] m_victims;
+	}
+
+	bool Find( u8 const* rgba, int flags, void* block )
+	{
+		std::size_t set = Hash( rgba, flags ) % m_sets;
+		Shard& shard = Lock( set );
+
+		Entry const* entry = Lookup( set, rgba, flags );
+		if( entry )
+		{
+			std::memcpy( block, entry->block, BlockSize( flags ) );
+			++shard.hits;
+		}
+		else
+			++shard.misses;
+
+		Unlock( shard );
+		return entry != 0;
+	}
+
+	void Insert( u8 const* rgba, int flags, void const* block )
+	{
+		std::size_t set = Hash( rgba, flags ) % m_sets;
+		Shard& shard = Lock( set );
+
+		// another thread may have got there first
+		if( !Lookup( set, rgba, flags ) )
+		{
+			// replace the ways of the set in turn
+			Entry& entry = m_entries[set*kWays + m_victims[set]];
+			m_victims[set] = u8( ( m_victims[set] + 1 ) % kWays );
+
+			std::memcpy( entry.rgba, rgba, sizeof( entry.rgba ) );
+			std::memcpy( entry.block, block, BlockSize( flags ) );
+			entry.flags = flags;
+		}
+
+		Unlock( shard );
+	}
+
+	BlockCacheStats GetStats()
+	{
+		BlockCacheStats stats;
+		stats.hits = 0;
+		stats.misses = 0;
+		for( int i = 0; i < kShards; ++i )
+		{
+			Shard& shard = Lock( i );
+			stats.hits += shard.hits;
+			stats.misses += shard.misses;
+			Unlock( shard );
+		}
+		return stats;
+	}
+
+private:
+	BlockCache( BlockCache const& );
+	BlockCache& operator=( BlockCache const& );
+
+	enum { kShards = 64 };
+
+	struct Entry
+	{
+		u8 rgba[64];
+		u8 block[16];
+		int flags;
+	};
+
+	struct Shard
+	{
+		unsigned long hits;
+		unsigned long misses;
+#ifdef _OPENMP
+		omp_lock_t lock;
+#endif
+	};
+
+	static int BlockSize( int flags )
+	{
+		return ( ( flags & kDxt1 ) != 0 ) ? 8 : 16;
+	}
+
+	static std::size_t Hash( u8 const* rgba, int flags )
+	{
+		// FNV-1a over the pixels, then a final mix of the bits
+		unsigned int hash = 2166136261u ^ ( unsigned int )flags;
+		for( int i = 0; i < 64; i += 4 )
+		{
+			unsigned int pixel = ( unsigned int )rgba[i] 
+				| ( ( unsigned int )rgba[i + 1] << 8 ) 
+				| ( ( unsigned int )rgba[i + 2] << 16 ) 
+				| ( ( unsigned int )rgba[i + 3] << 24 );
+			hash = ( hash ^ pixel )*16777619u;
+		}
+		hash ^= hash >> 16;
+		hash *= 0x85ebca6bu;
+		hash ^= hash >> 13;
+		return hash;
+	}
+
+	Entry const* Lookup( std::size_t set, u8 const* rgba, int flags ) const
+	{
+		Entry const* ways = m_entries + set*kWays;
+		for( int i = 0; i < kWays; ++i )
+		{
+			if( ways[i].flags == flags && std::memcmp( ways[i].rgba, rgba, 64 ) == 0 )
+				return ways + i;
+		}
+		return 0;
+	}
+
+	Shard& Lock( std::size_t set )
+	{
+		Shard& shard = m_shards[set % kShards];
+#ifdef _OPENMP
+		omp_set_lock( &shard.lock );
+#endif
+		return shard;
+	}
+
+	static void Unlock( Shard& shard )
+	{
+#ifdef _OPENMP
+		omp_unset_lock( &shard.lock );
+#else
+		( void )shard;
+#endif
+	}
+
+	std::size_t m_sets;
+	Entry* m_entries;
+	u8* m_victims;
+	Shard m_shards[kShards];
+};
+
+static BlockCache* s_cache = 0;
+
+void SetBlockCacheSize( std::size_t bytes )
+{
+	delete s_cache;
+	s_cache = 0;
+
+	std::size_t sets = bytes/( BlockCache::kWays*BlockCache::kEntrySize );
+	if( sets > 0 )
+		s_cache = new BlockCache( sets );
+}
+
+BlockCacheStats GetBlockCacheStats()
+{
+	if( s_cache )
+		return s_cache->GetStats();
+
+	BlockCacheStats stats;
+	stats.hits = 0;
+	stats.misses = 0;
+	return stats;
+}
+
+bool IsBlockCacheEnabled()
+{
+	return s_cache != 0;
+}
+
+bool FindCachedBlock( u8 const* rgba, int flags, void* block )
+{
+	return s_cache->Find( rgba, flags, block );
+}
+
+void CacheBlock( u8 const* rgba, int flags, void const* block )
+{
+	s_cache->Insert( rgba, flags, block );
+}
+
+} // namespace squish
@@ -0,0 +1,56 @@
+/* -----------------------------------------------------------------------------
+
+	Copyright (c) 2006 Simon Brown                          si@sjbrown.co.uk
+
+	Permission is hereby granted, free of charge, to any person obtaining
+	a copy of this software and associated documentation files (the 
+	"Software"), to	deal in the Software without restriction, including
+	without limitation the rights to use, copy, modify, merge, publish,
+	distribute, sublicense, and/or sell copies of the Software, and to 
+	permit persons to whom the Software is furnished to do so, subject to 
+	the following conditions:
+
+	The above copyright notice and this permission notice shall be included
+	in all copies or substantial portions of the Software.
+
+	THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS
+	OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF 
+	MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+	IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY 
+	CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, 
+	TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE 
+	SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+	
+   -------------------------------------------------------------------------- */
+
+#ifndef SQUISH_BLOCKCACHE_H
+#define SQUISH_BLOCKCACHE_H
+
+#include <squish.h>
+
+namespace squish {
+
+//! Whether SetBlockCacheSize enabled the cache.
+bool IsBlockCacheEnabled();
+
+/*! @brief Looks up the compressed block of 16 pixels.
+
+	@param rgba		The rgba values of the 16 source pixels.
+	@param flags	The (fixed) compression flags.
+	@param block	Storage for the compressed DXT block.
+	
+	Returns whether the block was found, in which case it was copied.
+*/
+bool FindCachedBlock( u8 const* rgba, int flags, void* block );
+
+/*! @brief Remembers the compressed block of 16 pixels.
+
+	@param rgba		The rgba values of the 16 source pixels.
+	@param flags	The (fixed) compression flags.
+	@param block	The compressed DXT block.
+*/
+void CacheBlock( u8 const* rgba, int flags, void const* block );
+
+} // namespace squish
+
+#endif // ndef SQUISH_BLOCKCACHE_H
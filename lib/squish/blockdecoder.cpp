@@ -0,0 +1,249 @@
+/* -----------------------------------------------------------------------------
+
+	Copyright (c) 2006 Simon Brown                          si@sjbrown.co.uk
+
+	Permission is hereby granted, free of charge, to any person obtaining
+	a copy of this software and associated documentation files (the
+	"Software"), to	deal in the Software without restriction, including
+	without limitation the rights to use, copy, modify, merge, publish,
+	distribute, sublicense, and/or sell copies of the Software, and to
+	permit persons to whom the Software is furnished to do so, subject to
+	the following conditions:
+
+	The above copyright notice and this permission notice shall be included
+	in all copies or substantial portions of the Software.
+
+	THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS
+	OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+	MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+	IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY
+	CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+	TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+	SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+
+   -------------------------------------------------------------------------- */
+   
+#include "blockdecoder.h"
+#include "blockdecoder.inl"
+
+namespace squish {
+namespace {
+
+//! The 4 colours of a colour block, one channel at a time.
+struct Palette
+{
+	int red[4];
+	int green[4];
+	int blue[4];
+	int alpha[4];
+};
+
+//! Expands the 565 colour at packed into entry i, as Unpack565 in colourblock.cpp.
+int Unpack565( u8 const* packed, Palette& palette, int i )
+{
+	int value = ( int )packed[0] | ( ( int )packed[1] << 8 );
+	int red = ( value >> 11 ) & 0x1f;
+	int green = ( value >> 5 ) & 0x3f;
+	int blue = value & 0x1f;
+
+	palette.red[i] = ( red << 3 ) | ( red >> 2 );
+	palette.green[i] = ( green << 2 ) | ( green >> 4 );
+	palette.blue[i] = ( blue << 3 ) | ( blue >> 2 );
+	return value;
+}
+
+/*! @brief Builds the palette of a colour block, as DecompressColour in colourblock.cpp.
+
+	The colours are opaque for DXT1, and have zero alpha for DXT3 and DXT5
+	so that the alpha values can be or'ed in.
+*/
+void GetColourPalette( u8 const* bytes, bool isDxt1, Palette& palette )
+{
+	int a = Unpack565( bytes, palette, 0 );
+	int b = Unpack565( bytes + 2, palette, 1 );
+
+	bool const threeColour = isDxt1 && a <= b;
+	int* channels[3] = { palette.red, palette.green, palette.blue };
+	for( int i = 0; i < 3; ++i )
+	{
+		int* channel = channels[i];
+		int c = channel[0];
+		int d = channel[1];
+		if( threeColour )
+		{
+			channel[2] = ( c + d )/2;
+			channel[3] = 0;
+		}
+		else
+		{
+			channel[2] = ( 2*c + d )/3;
+			channel[3] = ( c + 2*d )/3;
+		}
+	}
+
+	int const opaque = isDxt1 ? 255 : 0;
+	palette.alpha[0] = opaque;
+	palette.alpha[1] = opaque;
+	palette.alpha[2] = opaque;
+	palette.alpha[3] = threeColour ? 0 : opaque;
+}
+
+//! Builds the codebook of a DXT5 alpha block, as DecompressAlphaDxt5.
+void GetAlphaCodes( u8 const* bytes, int* codes )
+{
+	int alpha0 = bytes[0];
+	int alpha1 = bytes[1];
+	codes[0] = alpha0;
+	codes[1] = alpha1;
+	if( alpha0 <= alpha1 )
+	{
+		for( int i = 1; i < 5; ++i )
+			codes[1 + i] = ( ( 5 - i )*alpha0 + i*alpha1 )/5;
+		codes[6] = 0;
+		codes[7] = 255;
+	}
+	else
+	{
+		for( int i = 1; i < 7; ++i )
+			codes[1 + i] = ( ( 7 - i )*alpha0 + i*alpha1 )/7;
+	}
+}
+
+//! Writes the 4 rows of pixels of a block, with the alpha values (if any) in alpha.
+void WriteColours( Palette const& palette, u8 const* indices, u8 const* alpha, u8* rgba, std::ptrdiff_t pitch )
+{
+	u8 colours[16];
+	for( int i = 0; i < 4; ++i )
+	{
+		colours[4*i] = ( u8 )palette.red[i];
+		colours[4*i + 1] = ( u8 )palette.green[i];
+		colours[4*i + 2] = ( u8 )palette.blue[i];
+		colours[4*i + 3] = ( u8 )palette.alpha[i];
+	}
+
+	for( int r = 0; r < 4; ++r )
+	{
+		u8* row = rgba + pitch*r;
+		int packed = indices[r];
+		for( int i = 0; i < 4; ++i )
+		{
+			u8 pixel[4];
+			std::memcpy( pixel, colours + 4*( ( packed >> 2*i ) & 0x3 ), 4 );
+			if( alpha )
+				pixel[3] = alpha[4*r + i];
+			std::memcpy( row + 4*i, pixel, 4 );
+		}
+	}
+}
+
+void DecodeDxt1( u8 const* block, u8* rgba, std::ptrdiff_t pitch )
+{
+	Palette palette;
+	GetColourPalette( block, true, palette );
+	WriteColours( palette, block + 4, 0, rgba, pitch );
+}
+
+void DecodeDxt3( u8 const* block, u8* rgba, std::ptrdiff_t pitch )
+{
+	// unpack the alpha values pairwise
+	u8 alpha[16];
+	for( int i = 0; i < 8; ++i )
+	{
+		int lo = block[i] & 0x0f;
+		int hi = block[i] & 0xf0;
+		alpha[2*i] = ( u8 )( lo | ( lo << 4 ) );
+		alpha[2*i + 1] = ( u8 )( hi | ( hi >> 4 ) );
+	}
+
+	Palette palette;
+	GetColourPalette( block + 8, false, palette );
+	WriteColours( palette, block + 12, alpha, rgba, pitch );
+}
+
+void DecodeDxt5( u8 const* block, u8* rgba, std::ptrdiff_t pitch )
+{
+	int codes[8];
+	GetAlphaCodes( block, codes );
+
+	// look up the 3-bit indices, 8 at a time
+	u8 alpha[16];
+	for( int i = 0; i < 2; ++i )
+	{
+		u8 const* src = block + 2 + 3*i;
+		int value = ( int )src[0] | ( ( int )src[1] << 8 ) | ( ( int )src[2] << 16 );
+		for( int j = 0; j < 8; ++j )
+			alpha[8*i + j] = ( u8 )codes[( value >> 3*j ) & 0x7];
+	}
+
+	Palette palette;
+	GetColourPalette( block + 8, false, palette );
+	WriteColours( palette, block + 12, alpha, rgba, pitch );
+}
+
+#if SQUISH_BUILD_SSE41 || SQUISH_BUILD_AVX2 || SQUISH_BUILD_AVX512BW
+//! The shuffle control selecting the palette entry of each pixel, for every index byte.
+struct RowShuffles
+{
+	u8 bytes[256*16];
+
+	RowShuffles()
+	{
+		for( int packed = 0; packed < 256; ++packed )
+		{
+			for( int i = 0; i < 4; ++i )
+			{
+				int index = ( packed >> 2*i ) & 0x3;
+				for( int j = 0; j < 4; ++j )
+					bytes[16*packed + 4*i + j] = ( u8 )( 4*index + j );
+			}
+		}
+	}
+};
+
+RowShuffles const s_rowShuffles;
+#endif
+
+} // anonymous namespace
+
+#if SQUISH_BUILD_SSE41 || SQUISH_BUILD_AVX2 || SQUISH_BUILD_AVX512BW
+u8 const* GetRowShuffles()
+{
+	return s_rowShuffles.bytes;
+}
+#endif
+
+void DecompressBlockRow( u8* rgba, int width, int height, int pitch, int y, u8 const* sourceBlock, int flags )
+{
+	int const features = GetCpuFeatures();
+	( void )features;
+#if SQUISH_BUILD_AVX512BW
+	if( ( features & kCpuAvx512Bw ) != 0 )
+	{
+		DecompressBlockRowAvx512( rgba, width, height, pitch, y, sourceBlock, flags );
+		return;
+	}
+#endif
+#if SQUISH_BUILD_AVX2
+	if( ( features & kCpuAvx2 ) != 0 )
+	{
+		DecompressBlockRowAvx2( rgba, width, height, pitch, y, sourceBlock, flags );
+		return;
+	}
+#endif
+#if SQUISH_BUILD_SSE41
+	if( ( features & kCpuSse41 ) != 0 )
+	{
+		DecompressBlockRowSse41( rgba, width, height, pitch, y, sourceBlock, flags );
+		return;
+	}
+#endif
+
+	if( ( flags & kDxt3 ) != 0 )
+		DecompressRow< 16, DecodeDxt3 >( rgba, width, height, pitch, y, sourceBlock );
+	else if( ( flags & kDxt5 ) != 0 )
+		DecompressRow< 16, DecodeDxt5 >( rgba, width, height, pitch, y, sourceBlock );
+	else
+		DecompressRow< 8, DecodeDxt1 >( rgba, width, height, pitch, y, sourceBlock );
+}
+
+} // namespace squish
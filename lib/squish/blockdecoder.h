@@ -0,0 +1,79 @@
+/* -----------------------------------------------------------------------------
+
+	Copyright (c) 2006 Simon Brown                          si@sjbrown.co.uk
+
+	Permission is hereby granted, free of charge, to any person obtaining
+	a copy of this software and associated documentation files (the
+	"Software"), to	deal in the Software without restriction, including
+	without limitation the rights to use, copy, modify, merge, publish,
+	distribute, sublicense, and/or sell copies of the Software, and to
+	permit persons to whom the Software is furnished to do so, subject to
+	the following conditions:
+
+	The above copyright notice and this permission notice shall be included
+	in all copies or substantial portions of the Software.
+
+	THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS
+	OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+	MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+	IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY
+	CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+	TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+	SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+
+   -------------------------------------------------------------------------- */
+   
+   
+#ifndef SQUISH_BLOCKDECODER_H
+#define SQUISH_BLOCKDECODER_H
+
+#include <squish.h>
+#include "config.h"
+
+namespace squish {
+
+/*! @brief Decompresses a row of blocks into the 4 rows of pixels they cover.
+
+	@param rgba			The first row of pixels of the image.
+	@param width		The width of the image.
+	@param height		The height of the image.
+	@param pitch		The distance in bytes from one row of pixels to the next.
+	@param y			The first row of pixels covered by the blocks.
+	@param sourceBlock	The first block of the row.
+	@param flags		The (fixed) compression flags.
+	
+	Gives the same pixels as squish::Decompress over each block. The blocks
+	inside the image are written straight into it, a row of 4 pixels at a
+	time, and only those on its right and bottom edges go through a copy.
+	The widest decoder the processor supports is used.
+*/
+void DecompressBlockRow( u8* rgba, int width, int height, int pitch, int y, u8 const* sourceBlock, int flags );
+
+#if SQUISH_BUILD_SSE41 || SQUISH_BUILD_AVX2 || SQUISH_BUILD_AVX512BW
+/*! @brief Gets the byte shuffles expanding a row of 2-bit colour indices.
+
+	Row r of a block with index byte b is shuffled out of the 4 packed rgba
+	palette entries by the 16 bytes starting at 16*b. The table is built
+	along with the processor features, in code that runs on any processor.
+*/
+u8 const* GetRowShuffles();
+#endif
+
+#if SQUISH_BUILD_SSE41
+//! Behaves as DecompressBlockRow, expanding the palettes with byte shuffles (for processors with SSE4.1).
+void DecompressBlockRowSse41( u8* rgba, int width, int height, int pitch, int y, u8 const* sourceBlock, int flags );
+#endif
+
+#if SQUISH_BUILD_AVX2
+//! Behaves as DecompressBlockRowSse41, writing 2 blocks at a time (for processors with AVX2).
+void DecompressBlockRowAvx2( u8* rgba, int width, int height, int pitch, int y, u8 const* sourceBlock, int flags );
+#endif
+
+#if SQUISH_BUILD_AVX512BW
+//! Behaves as DecompressBlockRowSse41, writing 4 blocks at a time (for processors with AVX-512BW).
+void DecompressBlockRowAvx512( u8* rgba, int width, int height, int pitch, int y, u8 const* sourceBlock, int flags );
+#endif
+
+} // namespace squish
+
+#endif // ndef SQUISH_BLOCKDECODER_H
@@ -0,0 +1,107 @@
+/* -----------------------------------------------------------------------------
+
+	Copyright (c) 2006 Simon Brown                          si@sjbrown.co.uk
+
+	Permission is hereby granted, free of charge, to any person obtaining
+	a copy of this software and associated documentation files (the
+	"Software"), to	deal in the Software without restriction, including
+	without limitation the rights to use, copy, modify, merge, publish,
+	distribute, sublicense, and/or sell copies of the Software, and to
+	permit persons to whom the Software is furnished to do so, subject to
+	the following conditions:
+
+	The above copyright notice and this permission notice shall be included
+	in all copies or substantial portions of the Software.
+
+	THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS
+	OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+	MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+	IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY
+	CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+	TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+	SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+
+   -------------------------------------------------------------------------- */
+   
+   
+/*! @file
+
+	The parts of the block decoders shared by every instruction set. 
+	
+	Everything here has internal linkage, since the decoders are built with 
+	their own instruction set flags.
+*/
+
+#include <cstddef>
+#include <cstring>
+
+namespace squish {
+namespace {
+
+//! Decodes a block into 4 rows of 4 pixels, pitch bytes apart.
+typedef void ( *BlockDecoder )( u8 const* block, u8* rgba, std::ptrdiff_t pitch );
+
+/*! @brief Decodes the blocks of a row from pixel column x on.
+
+	The blocks wholly inside the image are written in place, and those on 
+	its right and bottom edges go through a copy.
+*/
+template< int BytesPerBlock, BlockDecoder Decode >
+void DecompressBlocks( u8* firstRow, int x, int width, int rows, int pitch, u8 const* sourceBlock )
+{
+	if( rows == 4 )
+	{
+		for( ; x + 4 <= width; x += 4 )
+		{
+			Decode( sourceBlock, firstRow + 4*x, pitch );
+			sourceBlock += BytesPerBlock;
+		}
+	}
+
+	for( ; x < width; x += 4 )
+	{
+		u8 targetRgba[4*16];
+		Decode( sourceBlock, targetRgba, 16 );
+
+		int const columns = ( width - x < 4 ) ? width - x : 4;
+		for( int py = 0; py < rows; ++py )
+			std::memcpy( firstRow + std::ptrdiff_t( pitch )*py + 4*x, targetRgba + 16*py, 4*columns );
+
+		sourceBlock += BytesPerBlock;
+	}
+}
+
+//! Decodes a row of blocks, writing the blocks inside the image in place.
+template< int BytesPerBlock, BlockDecoder Decode >
+void DecompressRow( u8* rgba, int width, int height, int pitch, int y, u8 const* sourceBlock )
+{
+	int const rows = ( height - y < 4 ) ? height - y : 4;
+	DecompressBlocks< BytesPerBlock, Decode >( rgba + std::ptrdiff_t( pitch )*y, 0, width, rows, pitch, sourceBlock );
+}
+
+/*! @brief Decodes a row of blocks, Count adjacent blocks at a time.
+
+	DecodeGroup writes Count blocks side by side, and the blocks left over 
+	(or on the edges) go through Decode.
+*/
+template< int BytesPerBlock, int Count, BlockDecoder DecodeGroup, BlockDecoder Decode >
+void DecompressRowInGroups( u8* rgba, int width, int height, int pitch, int y, u8 const* sourceBlock )
+{
+	int const rows = ( height - y < 4 ) ? height - y : 4;
+	u8* firstRow = rgba + std::ptrdiff_t( pitch )*y;
+
+	int x = 0;
+	if( rows == 4 )
+	{
+		for( ; x + 4*Count <= width; x += 4*Count )
+		{
+			DecodeGroup( sourceBlock, firstRow + 4*x, pitch );
+			sourceBlock += Count*BytesPerBlock;
+		}
+	}
+
+	DecompressBlocks< BytesPerBlock, Decode >( firstRow, x, width, rows, pitch, sourceBlock );
+}
+
+} // anonymous namespace
+} // namespace squish
@@ -0,0 +1,84 @@
+/* -----------------------------------------------------------------------------
+
+	Copyright (c) 2006 Simon Brown                          si@sjbrown.co.uk
+
+	Permission is hereby granted, free of charge, to any person obtaining
+	a copy of this software and associated documentation files (the
+	"Software"), to	deal in the Software without restriction, including
+	without limitation the rights to use, copy, modify, merge, publish,
+	distribute, sublicense, and/or sell copies of the Software, and to
+	permit persons to whom the Software is furnished to do so, subject to
+	the following conditions:
+
+	The above copyright notice and this permission notice shall be included
+	in all copies or substantial portions of the Software.
+
+	THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS
+	OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+	MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+	IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY
+	CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+	TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+	SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+
+   -------------------------------------------------------------------------- */
+   
+/*! @file
+
+	The AVX2 block decoders, 2 blocks at a time. Each block is loaded as in
+	the SSE4.1 decoders, into one half of a register, so that every row of
+	8 pixels gets expanded and written at once.
+*/
+
+#include "blockdecoder.h"
+
+#if SQUISH_BUILD_AVX2
+
+#include <immintrin.h>
+#include "blockdecoder_simd.inl"
+
+namespace squish {
+namespace {
+
+//! Joins the registers of 2 blocks, the first in the low half.
+__m256i Join( __m128i first, __m128i second )
+{
+	return _mm256_inserti128_si256( _mm256_castsi128_si256( first ), second, 1 );
+}
+
+//! Writes the 4 rows of pixels of 2 adjacent blocks of the given format.
+template< int Format, int BytesPerBlock >
+void DecodePair( u8 const* blocks, u8* rgba, std::ptrdiff_t pitch )
+{
+	SimdBlock first, second;
+	LoadBlock< Format >( blocks, first );
+	LoadBlock< Format >( blocks + BytesPerBlock, second );
+
+	__m256i const colours = Join( first.colours, second.colours );
+	__m256i const alpha = Join( first.alpha, second.alpha );
+
+	for( int r = 0; r < 4; ++r )
+	{
+		__m256i const shuffle = Join( GetRowShuffle( first.indices, r ), GetRowShuffle( second.indices, r ) );
+		__m256i row = _mm256_shuffle_epi8( colours, shuffle );
+		if( Format != kDxt1 )
+			row = _mm256_or_si256( row, _mm256_shuffle_epi8( alpha, _mm256_broadcastsi128_si256( GetAlphaSpread( r ) ) ) );
+		_mm256_storeu_si256( reinterpret_cast< __m256i* >( rgba + pitch*r ), row );
+	}
+}
+
+} // anonymous namespace
+
+void DecompressBlockRowAvx2( u8* rgba, int width, int height, int pitch, int y, u8 const* sourceBlock, int flags )
+{
+	if( ( flags & kDxt3 ) != 0 )
+		DecompressRowInGroups< 16, 2, DecodePair< kDxt3, 16 >, Decode< kDxt3 > >( rgba, width, height, pitch, y, sourceBlock );
+	else if( ( flags & kDxt5 ) != 0 )
+		DecompressRowInGroups< 16, 2, DecodePair< kDxt5, 16 >, Decode< kDxt5 > >( rgba, width, height, pitch, y, sourceBlock );
+	else
+		DecompressRowInGroups< 8, 2, DecodePair< kDxt1, 8 >, Decode< kDxt1 > >( rgba, width, height, pitch, y, sourceBlock );
+}
+
+} // namespace squish
+
+#endif // SQUISH_BUILD_AVX2
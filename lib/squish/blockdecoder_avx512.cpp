@@ -0,0 +1,103 @@
+/* -----------------------------------------------------------------------------
+
+	Copyright (c) 2006 Simon Brown                          si@sjbrown.co.uk
+
+	Permission is hereby granted, free of charge, to any person obtaining
+	a copy of this software and associated documentation files (the
+	"Software"), to	deal in the Software without restriction, including
+	without limitation the rights to use, copy, modify, merge, publish,
+	distribute, sublicense, and/or sell copies of the Software, and to
+	permit persons to whom the Software is furnished to do so, subject to
+	the following conditions:
+
+	The above copyright notice and this permission notice shall be included
+	in all copies or substantial portions of the Software.
+
+	THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS
+	OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+	MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+	IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY
+	CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+	TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+	SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+
+   -------------------------------------------------------------------------- */
+   
+/*! @file
+
+	The AVX-512 block decoders, 4 blocks at a time. Each block is loaded as
+	in the SSE4.1 decoders, into a quarter of a register, so that every row
+	of 16 pixels gets expanded and written at once. The byte shuffles need
+	AVX-512BW.
+*/
+
+#include "blockdecoder.h"
+
+#if SQUISH_BUILD_AVX512BW
+
+// the AVX-512 intrinsics of GCC 12 start from deliberately uninitialised
+// vectors, which -Wuninitialized reports at every use
+#if defined( __GNUC__ ) && !defined( __clang__ )
+#pragma GCC diagnostic ignored "-Wuninitialized"
+#pragma GCC diagnostic ignored "-Wmaybe-uninitialized"
+#endif
+
+#include <immintrin.h>
+#include "blockdecoder_simd.inl"
+
+namespace squish {
+namespace {
+
+//! Joins the registers of 4 blocks, in order from the low quarter up.
+__m512i Join( __m128i const* quarters )
+{
+	__m512i joined = _mm512_castsi128_si512( quarters[0] );
+	joined = _mm512_inserti32x4( joined, quarters[1], 1 );
+	joined = _mm512_inserti32x4( joined, quarters[2], 2 );
+	return _mm512_inserti32x4( joined, quarters[3], 3 );
+}
+
+//! Writes the 4 rows of pixels of 4 adjacent blocks of the given format.
+template< int Format, int BytesPerBlock >
+void DecodeQuad( u8 const* blocks, u8* rgba, std::ptrdiff_t pitch )
+{
+	SimdBlock loaded[4];
+	__m128i colours[4], alpha[4];
+	for( int i = 0; i < 4; ++i )
+	{
+		LoadBlock< Format >( blocks + i*BytesPerBlock, loaded[i] );
+		colours[i] = loaded[i].colours;
+		alpha[i] = loaded[i].alpha;
+	}
+
+	__m512i const palettes = Join( colours );
+	__m512i const alphas = Join( alpha );
+
+	for( int r = 0; r < 4; ++r )
+	{
+		__m128i shuffles[4];
+		for( int i = 0; i < 4; ++i )
+			shuffles[i] = GetRowShuffle( loaded[i].indices, r );
+
+		__m512i row = _mm512_shuffle_epi8( palettes, Join( shuffles ) );
+		if( Format != kDxt1 )
+			row = _mm512_or_si512( row, _mm512_shuffle_epi8( alphas, _mm512_broadcast_i32x4( GetAlphaSpread( r ) ) ) );
+		_mm512_storeu_si512( rgba + pitch*r, row );
+	}
+}
+
+} // anonymous namespace
+
+void DecompressBlockRowAvx512( u8* rgba, int width, int height, int pitch, int y, u8 const* sourceBlock, int flags )
+{
+	if( ( flags & kDxt3 ) != 0 )
+		DecompressRowInGroups< 16, 4, DecodeQuad< kDxt3, 16 >, Decode< kDxt3 > >( rgba, width, height, pitch, y, sourceBlock );
+	else if( ( flags & kDxt5 ) != 0 )
+		DecompressRowInGroups< 16, 4, DecodeQuad< kDxt5, 16 >, Decode< kDxt5 > >( rgba, width, height, pitch, y, sourceBlock );
+	else
+		DecompressRowInGroups< 8, 4, DecodeQuad< kDxt1, 8 >, Decode< kDxt1 > >( rgba, width, height, pitch, y, sourceBlock );
+}
+
+} // namespace squish
+
+#endif // SQUISH_BUILD_AVX512BW
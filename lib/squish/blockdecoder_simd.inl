@@ -0,0 +1,213 @@
+/* -----------------------------------------------------------------------------
+
+	Copyright (c) 2006 Simon Brown                          si@sjbrown.co.uk
+
+	Permission is hereby granted, free of charge, to any person obtaining
+	a copy of this software and associated documentation files (the
+	"Software"), to	deal in the Software without restriction, including
+	without limitation the rights to use, copy, modify, merge, publish,
+	distribute, sublicense, and/or sell copies of the Software, and to
+	permit persons to whom the Software is furnished to do so, subject to
+	the following conditions:
+
+	The above copyright notice and this permission notice shall be included
+	in all copies or substantial portions of the Software.
+
+	THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS
+	OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+	MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+	IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY
+	CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+	TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+	SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+
+   -------------------------------------------------------------------------- */
+   
+/*! @file
+
+	The parts of the SSE4.1, AVX2 and AVX-512 block decoders working on one
+	block at a time, in 128-bit registers. Each decoder includes this after
+	its own intrinsics header, and builds it with its own instruction set 
+	flags, so everything has internal linkage.
+*/
+
+#include "blockdecoder.inl"
+
+namespace squish {
+namespace {
+
+//! Expands the 565 colour at packed, as Unpack565 in colourblock.cpp.
+int Unpack565( u8 const* packed, int* channels )
+{
+	int value = ( int )packed[0] | ( ( int )packed[1] << 8 );
+	int red = ( value >> 11 ) & 0x1f;
+	int green = ( value >> 5 ) & 0x3f;
+	int blue = value & 0x1f;
+
+	channels[0] = ( red << 3 ) | ( red >> 2 );
+	channels[1] = ( green << 2 ) | ( green >> 4 );
+	channels[2] = ( blue << 3 ) | ( blue >> 2 );
+	return value;
+}
+
+/*! @brief Builds the palette of a colour block, one rgba pixel per lane.
+
+	The palette matches GetColourPalette, interpolating in 16 bits and 
+	dividing by 3 as a multiply by 65536/3 rounded up, which is exact for 
+	the sums of 3 channels.
+*/
+__m128i LoadPalette( u8 const* bytes, bool isDxt1 )
+{
+	int c[3], d[3];
+	int a = Unpack565( bytes, c );
+	int b = Unpack565( bytes + 2, d );
+
+	// the end points, then the same swapped
+	__m128i const ends = _mm_setr_epi16( c[0], c[1], c[2], 0, d[0], d[1], d[2], 0 );
+	__m128i const swapped = _mm_shuffle_epi32( ends, _MM_SHUFFLE( 1, 0, 3, 2 ) );
+	__m128i const sum = _mm_add_epi16( ends, swapped );
+
+	__m128i between;
+	bool const threeColour = isDxt1 && a <= b;
+	if( threeColour )
+		between = _mm_move_epi64( _mm_srli_epi16( sum, 1 ) );
+	else
+		between = _mm_mulhi_epu16( _mm_add_epi16( sum, ends ), _mm_set1_epi16( 21846 ) );
+
+	__m128i colours = _mm_packus_epi16( ends, between );
+	if( isDxt1 )
+	{
+		__m128i const opaque = _mm_setr_epi32( 0xff << 24, 0xff << 24, 0xff << 24, threeColour ? 0 : 0xff << 24 );
+		colours = _mm_or_si128( colours, opaque );
+	}
+	return colours;
+}
+
+/*! @brief Builds the codebook of a DXT5 alpha block, one code per byte.
+
+	The codebook matches GetAlphaCodes, dividing by 5 or 7 as a multiply by
+	65536/5 or 65536/7 rounded up, which is exact for the weighted sums.
+*/
+__m128i LoadAlphaCodes( u8 const* bytes )
+{
+	int alpha0 = bytes[0];
+	int alpha1 = bytes[1];
+	__m128i const first = _mm_set1_epi16( alpha0 );
+	__m128i const second = _mm_set1_epi16( alpha1 );
+	if( alpha0 <= alpha1 )
+	{
+		__m128i const sum = _mm_add_epi16( 
+			_mm_mullo_epi16( first, _mm_setr_epi16( 5, 0, 4, 3, 2, 1, 0, 0 ) ), 
+			_mm_mullo_epi16( second, _mm_setr_epi16( 0, 5, 1, 2, 3, 4, 0, 0 ) ) );
+		__m128i const codes = _mm_mulhi_epu16( sum, _mm_set1_epi16( 13108 ) );
+		return _mm_packus_epi16( _mm_or_si128( codes, _mm_setr_epi16( 0, 0, 0, 0, 0, 0, 0, 255 ) ), _mm_setzero_si128() );
+	}
+	else
+	{
+		__m128i const sum = _mm_add_epi16( 
+			_mm_mullo_epi16( first, _mm_setr_epi16( 7, 0, 6, 5, 4, 3, 2, 1 ) ), 
+			_mm_mullo_epi16( second, _mm_setr_epi16( 0, 7, 1, 2, 3, 4, 5, 6 ) ) );
+		__m128i const codes = _mm_mulhi_epu16( sum, _mm_set1_epi16( 9363 ) );
+		return _mm_packus_epi16( codes, _mm_setzero_si128() );
+	}
+}
+
+//! Gets the 16 alpha values of a DXT3 block, in pixel order.
+__m128i LoadAlphaDxt3( u8 const* block )
+{
+	// split the 4-bit values, and interleave them back into pixel order
+	__m128i const nibble = _mm_set1_epi8( 0x0f );
+	__m128i const bytes = _mm_loadl_epi64( reinterpret_cast< __m128i const* >( block ) );
+	__m128i const lo = _mm_and_si128( bytes, nibble );
+	__m128i const hi = _mm_and_si128( _mm_srli_epi16( bytes, 4 ), nibble );
+	__m128i const quant = _mm_unpacklo_epi8( lo, hi );
+
+	// convert back up to bytes
+	return _mm_or_si128( quant, _mm_slli_epi16( quant, 4 ) );
+}
+
+//! Gets the 16 alpha values of a DXT5 block, in pixel order.
+__m128i LoadAlphaDxt5( u8 const* block )
+{
+	__m128i const codebook = LoadAlphaCodes( block );
+
+	// gather the two bytes holding each 3-bit index, starting at bit 3*i of 
+	// the 6 bytes after the endpoints
+	__m128i const bytes = _mm_loadu_si128( reinterpret_cast< __m128i const* >( block ) );
+	__m128i const first = _mm_shuffle_epi8( bytes, _mm_setr_epi8( 
+		2, 3, 2, 3, 2, 3, 3, 4, 3, 4, 3, 4, 4, 5, 4, 5 ) );
+	__m128i const second = _mm_shuffle_epi8( bytes, _mm_setr_epi8( 
+		5, 6, 5, 6, 5, 6, 6, 7, 6, 7, 6, 7, 7, 8, 7, 8 ) );
+
+	// shift each index to the top byte (multiplying by 2^( 8 - bit ) in 16 
+	// bits), then down to the bottom
+	__m128i const scale = _mm_setr_epi16( 256, 32, 4, 128, 16, 2, 64, 8 );
+	__m128i const mask = _mm_set1_epi16( 0x7 );
+	__m128i const lo = _mm_and_si128( _mm_srli_epi16( _mm_mullo_epi16( first, scale ), 8 ), mask );
+	__m128i const hi = _mm_and_si128( _mm_srli_epi16( _mm_mullo_epi16( second, scale ), 8 ), mask );
+
+	// look up the codebook
+	return _mm_shuffle_epi8( codebook, _mm_packus_epi16( lo, hi ) );
+}
+
+//! A block ready to be written out: its palette, alpha values and colour indices.
+struct SimdBlock
+{
+	__m128i colours;
+	__m128i alpha;
+	u8 const* indices;
+};
+
+/*! @brief Loads a block of the given format (kDxt1, kDxt3 or kDxt5).
+
+	The alpha values are zero for DXT1, whose palette carries them.
+*/
+template< int Format >
+void LoadBlock( u8 const* block, SimdBlock& loaded )
+{
+	if( Format == kDxt1 )
+	{
+		loaded.colours = LoadPalette( block, true );
+		loaded.alpha = _mm_setzero_si128();
+		loaded.indices = block + 4;
+	}
+	else
+	{
+		loaded.colours = LoadPalette( block + 8, false );
+		loaded.alpha = ( Format == kDxt3 ) ? LoadAlphaDxt3( block ) : LoadAlphaDxt5( block );
+		loaded.indices = block + 12;
+	}
+}
+
+//! Gets the shuffle moving the alpha values of row r to the top byte of each pixel.
+__m128i GetAlphaSpread( int r )
+{
+	return _mm_setr_epi8( 
+		-1, -1, -1, ( char )( 4*r ), -1, -1, -1, ( char )( 4*r + 1 ), 
+		-1, -1, -1, ( char )( 4*r + 2 ), -1, -1, -1, ( char )( 4*r + 3 ) );
+}
+
+//! Gets the shuffle expanding row r of a block from its palette.
+__m128i GetRowShuffle( u8 const* indices, int r )
+{
+	return _mm_loadu_si128( reinterpret_cast< __m128i const* >( GetRowShuffles() + 16*indices[r] ) );
+}
+
+//! Writes the 4 rows of pixels of a block of the given format, a row at a time.
+template< int Format >
+void Decode( u8 const* block, u8* rgba, std::ptrdiff_t pitch )
+{
+	SimdBlock loaded;
+	LoadBlock< Format >( block, loaded );
+
+	for( int r = 0; r < 4; ++r )
+	{
+		__m128i row = _mm_shuffle_epi8( loaded.colours, GetRowShuffle( loaded.indices, r ) );
+		if( Format != kDxt1 )
+			row = _mm_or_si128( row, _mm_shuffle_epi8( loaded.alpha, GetAlphaSpread( r ) ) );
+		_mm_storeu_si128( reinterpret_cast< __m128i* >( rgba + pitch*r ), row );
+	}
+}
+
+} // anonymous namespace
+} // namespace squish
@@ -0,0 +1,54 @@
+/* -----------------------------------------------------------------------------
+
+	Copyright (c) 2006 Simon Brown                          si@sjbrown.co.uk
+
+	Permission is hereby granted, free of charge, to any person obtaining
+	a copy of this software and associated documentation files (the
+	"Software"), to	deal in the Software without restriction, including
+	without limitation the rights to use, copy, modify, merge, publish,
+	distribute, sublicense, and/or sell copies of the Software, and to
+	permit persons to whom the Software is furnished to do so, subject to
+	the following conditions:
+
+	The above copyright notice and this permission notice shall be included
+	in all copies or substantial portions of the Software.
+
+	THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS
+	OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+	MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+	IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY
+	CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+	TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+	SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+
+   -------------------------------------------------------------------------- */
+   
+/*! @file
+
+	The SSE4.1 block decoders, used where the processor has SSE4.1 as the
+	cluster fit kernel of the same tier is. The palettes are expanded with
+	byte shuffles, a row of 4 pixels at a time.
+*/
+
+#include "blockdecoder.h"
+
+#if SQUISH_BUILD_SSE41
+
+#include <smmintrin.h>
+#include "blockdecoder_simd.inl"
+
+namespace squish {
+
+void DecompressBlockRowSse41( u8* rgba, int width, int height, int pitch, int y, u8 const* sourceBlock, int flags )
+{
+	if( ( flags & kDxt3 ) != 0 )
+		DecompressRow< 16, Decode< kDxt3 > >( rgba, width, height, pitch, y, sourceBlock );
+	else if( ( flags & kDxt5 ) != 0 )
+		DecompressRow< 16, Decode< kDxt5 > >( rgba, width, height, pitch, y, sourceBlock );
+	else
+		DecompressRow< 8, Decode< kDxt1 > >( rgba, width, height, pitch, y, sourceBlock );
+}
+
+} // namespace squish
+
+#endif // SQUISH_BUILD_SSE41
@@ -0,0 +1,99 @@
+/* -----------------------------------------------------------------------------
+
+	Copyright (c) 2006 Simon Brown                          si@sjbrown.co.uk
+	Copyright (c) 2007 Ignacio Castano                   icastano@nvidia.com
+
+	Permission is hereby granted, free of charge, to any person obtaining
+	a copy of this software and associated documentation files (the
+	"Software"), to	deal in the Software without restriction, including
+	without limitation the rights to use, copy, modify, merge, publish,
+	distribute, sublicense, and/or sell copies of the Software, and to
+	permit persons to whom the Software is furnished to do so, subject to
+	the following conditions:
+
+	The above copyright notice and this permission notice shall be included
+	in all copies or substantial portions of the Software.
+
+	THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS
+	OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+	MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+	IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY
+	CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+	TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+	SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+
+   -------------------------------------------------------------------------- */
+
+/*! @file
+
+	The batched cluster fit kernel for AVX-512, 16 blocks at a time.
+*/
+
+#include "clusterfitbatch.h"
+
+#if SQUISH_BUILD_AVX512
+
+// the AVX-512 intrinsics of GCC 12 start from deliberately uninitialised
+// vectors, which -Wuninitialized reports at every use
+#if defined( __GNUC__ ) && !defined( __clang__ )
+#pragma GCC diagnostic ignored "-Wuninitialized"
+#pragma GCC diagnostic ignored "-Wmaybe-uninitialized"
+#endif
+
+#include <immintrin.h>
+
+namespace squish {
+namespace {
+
+struct Lanes16
+{
+	typedef __m512 Arg;
+	typedef __mmask16 Mask;
+
+	enum { kWidth = 16 };
+
+	static Arg Load( float const* p ) { return _mm512_loadu_ps( p ); }
+	static void Store( float* p, Arg v ) { _mm512_storeu_ps( p, v ); }
+	static Arg Splat( float f ) { return _mm512_set1_ps( f ); }
+	static Arg Zero() { return _mm512_setzero_ps(); }
+
+	static Arg Add( Arg a, Arg b ) { return _mm512_add_ps( a, b ); }
+	static Arg Sub( Arg a, Arg b ) { return _mm512_sub_ps( a, b ); }
+	static Arg Mul( Arg a, Arg b ) { return _mm512_mul_ps( a, b ); }
+	static Arg Min( Arg a, Arg b ) { return _mm512_min_ps( a, b ); }
+	static Arg Max( Arg a, Arg b ) { return _mm512_max_ps( a, b ); }
+	static Arg Truncate( Arg v ) { return _mm512_cvtepi32_ps( _mm512_cvttps_epi32( v ) ); }
+
+	// _mm512_rcp14_ps is more precise than the SSE estimate, which would
+	// change the blocks, so the estimate is taken on each half instead
+	static Arg ReciprocalEstimate( Arg v )
+	{
+		__m256 lo = _mm256_rcp_ps( _mm512_castps512_ps256( v ) );
+		__m256 hi = _mm256_rcp_ps( _mm256_castpd_ps( _mm512_extractf64x4_pd( _mm512_castps_pd( v ), 1 ) ) );
+		return _mm512_castpd_ps( _mm512_insertf64x4( _mm512_castps_pd( _mm512_castps256_ps512( lo ) ), _mm256_castps_pd( hi ), 1 ) );
+	}
+
+	static Mask CompareLessThan( Arg a, Arg b ) { return _mm512_cmp_ps_mask( a, b, _CMP_LT_OQ ); }
+	static Mask CompareLessEqual( Arg a, Arg b ) { return _mm512_cmp_ps_mask( a, b, _CMP_LE_OQ ); }
+	static Mask And( Mask a, Mask b ) { return Mask( a & b ); }
+	static bool Any( Mask m ) { return m != 0; }
+
+	// pick a where m is set, b elsewhere
+	static Arg Select( Mask m, Arg a, Arg b ) { return _mm512_mask_blend_ps( m, b, a ); }
+};
+
+} // anonymous namespace
+} // namespace squish
+
+#include "clusterfitbatch.inl"
+
+namespace squish {
+
+void ClusterFitAvx512( ClusterFitLanes const& lanes, int colours, ClusterFitResult& result )
+{
+	ClusterFitSearch< Lanes16 >::Run( lanes, colours, result );
+}
+
+} // namespace squish
+
+#endif // SQUISH_BUILD_AVX512
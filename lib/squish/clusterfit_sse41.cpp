@@ -0,0 +1,84 @@
+/* -----------------------------------------------------------------------------
+
+	Copyright (c) 2006 Simon Brown                          si@sjbrown.co.uk
+	Copyright (c) 2007 Ignacio Castano                   icastano@nvidia.com
+
+	Permission is hereby granted, free of charge, to any person obtaining
+	a copy of this software and associated documentation files (the
+	"Software"), to	deal in the Software without restriction, including
+	without limitation the rights to use, copy, modify, merge, publish,
+	distribute, sublicense, and/or sell copies of the Software, and to
+	permit persons to whom the Software is furnished to do so, subject to
+	the following conditions:
+
+	The above copyright notice and this permission notice shall be included
+	in all copies or substantial portions of the Software.
+
+	THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS
+	OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+	MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+	IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY
+	CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+	TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+	SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+
+   -------------------------------------------------------------------------- */
+
+/*! @file
+
+	The batched cluster fit kernel for SSE4.1, 4 blocks at a time.
+*/
+
+#include "clusterfitbatch.h"
+
+#if SQUISH_BUILD_SSE41
+
+#include <smmintrin.h>
+
+namespace squish {
+namespace {
+
+struct Lanes4Blend
+{
+	typedef __m128 Arg;
+	typedef __m128 Mask;
+
+	enum { kWidth = 4 };
+
+	static Arg Load( float const* p ) { return _mm_loadu_ps( p ); }
+	static void Store( float* p, Arg v ) { _mm_storeu_ps( p, v ); }
+	static Arg Splat( float f ) { return _mm_set1_ps( f ); }
+	static Arg Zero() { return _mm_setzero_ps(); }
+
+	static Arg Add( Arg a, Arg b ) { return _mm_add_ps( a, b ); }
+	static Arg Sub( Arg a, Arg b ) { return _mm_sub_ps( a, b ); }
+	static Arg Mul( Arg a, Arg b ) { return _mm_mul_ps( a, b ); }
+	static Arg Min( Arg a, Arg b ) { return _mm_min_ps( a, b ); }
+	static Arg Max( Arg a, Arg b ) { return _mm_max_ps( a, b ); }
+	static Arg ReciprocalEstimate( Arg v ) { return _mm_rcp_ps( v ); }
+	static Arg Truncate( Arg v ) { return _mm_cvtepi32_ps( _mm_cvttps_epi32( v ) ); }
+
+	static Mask CompareLessThan( Arg a, Arg b ) { return _mm_cmplt_ps( a, b ); }
+	static Mask CompareLessEqual( Arg a, Arg b ) { return _mm_cmple_ps( a, b ); }
+	static Mask And( Mask a, Mask b ) { return _mm_and_ps( a, b ); }
+	static bool Any( Mask m ) { return _mm_movemask_ps( m ) != 0; }
+
+	// pick a where m is set, b elsewhere
+	static Arg Select( Mask m, Arg a, Arg b ) { return _mm_blendv_ps( b, a, m ); }
+};
+
+} // anonymous namespace
+} // namespace squish
+
+#include "clusterfitbatch.inl"
+
+namespace squish {
+
+void ClusterFitSse41( ClusterFitLanes const& lanes, int colours, ClusterFitResult& result )
+{
+	ClusterFitSearch< Lanes4Blend >::Run( lanes, colours, result );
+}
+
+} // namespace squish
+
+#endif // SQUISH_BUILD_SSE41
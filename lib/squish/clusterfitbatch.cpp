@@ -0,0 +1,230 @@
+/* -----------------------------------------------------------------------------
+
+	Copyright (c) 2006 Simon Brown                          si@sjbrown.co.uk
+	Copyright (c) 2007 Ignacio Castano                   icastano@nvidia.com
+
+	Permission is hereby granted, free of charge, to any person obtaining
+	a copy of this software and associated documentation files (the
+	"Software"), to	deal in the Software without restriction, including
+	without limitation the rights to use, copy, modify, merge, publish,
+	distribute, sublicense, and/or sell copies of the Software, and to
+	permit persons to whom the Software is furnished to do so, subject to
+	the following conditions:
+
+	The above copyright notice and this permission notice shall be included
+	in all copies or substantial portions of the Software.
+
+	THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS
+	OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+	MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+	IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY
+	CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+	TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+	SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+
+   -------------------------------------------------------------------------- */
+
+#include "clusterfitbatch.h"
+#include "colourset.h"
+#include "colourblock.h"
+#include <cfloat>
+
+namespace squish {
+
+ClusterFitKernel GetClusterFitKernel()
+{
+	int const features = GetCpuFeatures();
+	(void)features;
+
+#if SQUISH_BUILD_AVX512
+	if( ( features & kCpuAvx512 ) != 0 )
+		return ClusterFitAvx512;
+#endif
+#if SQUISH_BUILD_AVX2
+	if( ( features & kCpuAvx2 ) != 0 )
+		return ClusterFitAvx2;
+#endif
+#if SQUISH_BUILD_SSE41
+	if( ( features & kCpuSse41 ) != 0 )
+		return ClusterFitSse41;
+#endif
+#if SQUISH_USE_SSE >= 2
+	return ClusterFitSse2;
+#else
+	return 0;
+#endif
+}
+
+//! Builds the ordering of the points along the principle axis, as ClusterFit::ConstructOrdering.
+static void ConstructOrdering( ColourSet const& colours, u8* order )
+{
+	// cache some values
+	int const count = colours.GetCount();
+	Vec3 const* values = colours.GetPoints();
+
+	// compute the principle component
+	Sym3x3 covariance = ComputeWeightedCovariance( count, values, colours.GetWeights() );
+	Vec3 axis = ComputePrincipleComponent( covariance );
+
+	// build the list of dot products
+	float dps[16];
+	for( int i = 0; i < count; ++i )
+	{
+		dps[i] = Dot( values[i], axis );
+		order[i] = ( u8 )i;
+	}
+
+	// stable sort using them
+	for( int i = 0; i < count; ++i )
+	{
+		for( int j = i; j > 0 && dps[j] < dps[j - 1]; --j )
+		{
+			std::swap( dps[j], dps[j - 1] );
+			std::swap( order[j], order[j - 1] );
+		}
+	}
+}
+
+void ClusterFitBatch( ClusterFitKernel kernel, ColourSet const* colours, void* const* blocks, int count, int flags )
+{
+	// put blocks with as many points next to each other, so that the 
+	// kernels loop over as few unused partitions as possible
+	int lane[kClusterFitBatchSize];
+	for( int l = 0; l < count; ++l )
+	{
+		int m = l;
+		for( ; m > 0 && colours[lane[m - 1]].GetCount() > colours[l].GetCount(); --m )
+			lane[m] = lane[m - 1];
+		lane[m] = l;
+	}
+
+	// lay out the weighted points of every block in fit order
+	ClusterFitLanes lanes;
+	u8 order[kClusterFitBatchSize][16];
+	for( int l = 0; l < kClusterFitBatchSize; ++l )
+	{
+		int const n = ( l < count ) ? colours[lane[l]].GetCount() : 0;
+		lanes.counts[l] = float( n );
+		for( int ch = 0; ch < 4; ++ch )
+			lanes.sums[ch][l] = 0.0f;
+		if( n == 0 )
+		{
+			for( int i = 0; i < 16; ++i )
+				for( int ch = 0; ch < 4; ++ch )
+					lanes.points[ch][i][l] = 0.0f;
+			continue;
+		}
+
+		ColourSet const& set = colours[lane[l]];
+		ConstructOrdering( set, order[l] );
+
+		Vec3 const* unweighted = set.GetPoints();
+		float const* weights = set.GetWeights();
+		for( int i = 0; i < 16; ++i )
+		{
+			float x[4] = { 0.0f, 0.0f, 0.0f, 0.0f };
+			if( i < n )
+			{
+				int j = order[l][i];
+				x[0] = unweighted[j].X()*weights[j];
+				x[1] = unweighted[j].Y()*weights[j];
+				x[2] = unweighted[j].Z()*weights[j];
+				x[3] = weights[j];
+			}
+			for( int ch = 0; ch < 4; ++ch )
+			{
+				lanes.points[ch][i][l] = x[ch];
+				if( i < n )
+					lanes.sums[ch][l] += x[ch];
+			}
+		}
+	}
+
+	// initialise the metric
+	bool perceptual = ( ( flags & kColourMetricPerceptual ) != 0 );
+	float const metric[3] = { 0.2126f, 0.7152f, 0.0722f };
+	for( int ch = 0; ch < 3; ++ch )
+		lanes.metric[ch] = perceptual ? metric[ch] : 1.0f;
+
+	// the error of the block written so far, per lane
+	ClusterFitResult result;
+	float besterror[kClusterFitBatchSize];
+	for( int l = 0; l < kClusterFitBatchSize; ++l )
+	{
+		besterror[l] = FLT_MAX;
+		result.i[l] = result.j[l] = result.k[l] = 0.0f;
+		for( int ch = 0; ch < 3; ++ch )
+			result.start[ch][l] = result.end[ch][l] = 0.0f;
+	}
+
+	bool const isDxt1 = ( ( flags & kDxt1 ) != 0 );
+	for( int colourCount = isDxt1 ? 3 : 4; colourCount <= 4; ++colourCount )
+	{
+		// the four colour fit is skipped for blocks with transparency
+		if( colourCount == 4 && isDxt1 )
+		{
+			for( int l = 0; l < count; ++l )
+				if( colours[lane[l]].IsTransparent() )
+					lanes.counts[l] = 0.0f;
+		}
+
+		// search every lane, starting from the error to beat
+		for( int l = 0; l < kClusterFitBatchSize; ++l )
+			result.error[l] = besterror[l];
+		kernel( lanes, colourCount, result );
+
+		// save the blocks if necessary
+		for( int l = 0; l < count; ++l )
+		{
+			ColourSet const& set = colours[lane[l]];
+
+			if( lanes.counts[l] == 0.0f || !( result.error[l] < besterror[l] ) )
+				continue;
+
+			int const n = set.GetCount();
+			int const besti = int( result.i[l] );
+			int const bestj = int( result.j[l] );
+			int const bestk = int( result.k[l] );
+
+			// remap the indices
+			u8 const* lorder = order[l];
+			u8 unordered[16];
+			u8 bestindices[16];
+			if( colourCount == 3 )
+			{
+				for( int m = 0; m < besti; ++m )
+					unordered[lorder[m]] = 0;
+				for( int m = besti; m < bestj; ++m )
+					unordered[lorder[m]] = 2;
+				for( int m = bestj; m < n; ++m )
+					unordered[lorder[m]] = 1;
+			}
+			else
+			{
+				for( int m = 0; m < besti; ++m )
+					unordered[lorder[m]] = 0;
+				for( int m = besti; m < bestj; ++m )
+					unordered[lorder[m]] = 2;
+				for( int m = bestj; m < bestk; ++m )
+					unordered[lorder[m]] = 3;
+				for( int m = bestk; m < n; ++m )
+					unordered[lorder[m]] = 1;
+			}
+
+			set.RemapIndices( unordered, bestindices );
+
+			// save the block
+			Vec3 start( result.start[0][l], result.start[1][l], result.start[2][l] );
+			Vec3 end( result.end[0][l], result.end[1][l], result.end[2][l] );
+			if( colourCount == 3 )
+				WriteColourBlock3( start, end, bestindices, blocks[lane[l]] );
+			else
+				WriteColourBlock4( start, end, bestindices, blocks[lane[l]] );
+
+			// save the error
+			besterror[l] = result.error[l];
+		}
+	}
+}
+
+} // namespace squish
@@ -0,0 +1,118 @@
+/* -----------------------------------------------------------------------------
+
+	Copyright (c) 2006 Simon Brown                          si@sjbrown.co.uk
+	Copyright (c) 2007 Ignacio Castano                   icastano@nvidia.com
+
+	Permission is hereby granted, free of charge, to any person obtaining
+	a copy of this software and associated documentation files (the
+	"Software"), to	deal in the Software without restriction, including
+	without limitation the rights to use, copy, modify, merge, publish,
+	distribute, sublicense, and/or sell copies of the Software, and to
+	permit persons to whom the Software is furnished to do so, subject to
+	the following conditions:
+
+	The above copyright notice and this permission notice shall be included
+	in all copies or substantial portions of the Software.
+
+	THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS
+	OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+	MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+	IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY
+	CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+	TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+	SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+
+   -------------------------------------------------------------------------- */
+
+#ifndef SQUISH_CLUSTERFITBATCH_H
+#define SQUISH_CLUSTERFITBATCH_H
+
+#include <squish.h>
+#include "config.h"
+
+namespace squish {
+
+class ColourSet;
+
+//! The number of blocks cluster fitted at once by ClusterFitBatch.
+enum { kClusterFitBatchSize = 16 };
+
+/*! @brief The weighted points of a batch of blocks, one block per lane.
+
+	Only plain floats cross over to the kernels, since they are built with
+	their own instruction set flags and must not share inline code with the
+	rest of squish.
+*/
+struct ClusterFitLanes
+{
+	//! The x*w, y*w, z*w and w of each point, in fit order, padded with zeros.
+	float points[4][16][kClusterFitBatchSize];
+
+	//! The sums of the points.
+	float sums[4][kClusterFitBatchSize];
+
+	//! The number of points of each block.
+	float counts[kClusterFitBatchSize];
+
+	//! The weights of the red, green and blue errors.
+	float metric[3];
+};
+
+//! The best partition of each block of a batch.
+struct ClusterFitResult
+{
+	//! The error to beat on input, the error of the best partition on output.
+	float error[kClusterFitBatchSize];
+
+	float start[3][kClusterFitBatchSize];
+	float end[3][kClusterFitBatchSize];
+	float i[kClusterFitBatchSize];
+	float j[kClusterFitBatchSize];
+	float k[kClusterFitBatchSize];
+};
+
+/*! @brief Searches the partitions of a batch of blocks.
+
+	@param lanes	The points of the blocks.
+	@param colours	Search for 3 or 4 colour blocks.
+	@param result	The best partition of each block.
+
+	The lanes whose error is not beaten are left as they are.
+*/
+typedef void ( *ClusterFitKernel )( ClusterFitLanes const& lanes, int colours, ClusterFitResult& result );
+
+#if SQUISH_USE_SSE >= 2
+void ClusterFitSse2( ClusterFitLanes const& lanes, int colours, ClusterFitResult& result );
+#endif
+#if SQUISH_BUILD_SSE41
+void ClusterFitSse41( ClusterFitLanes const& lanes, int colours, ClusterFitResult& result );
+#endif
+#if SQUISH_BUILD_AVX2
+void ClusterFitAvx2( ClusterFitLanes const& lanes, int colours, ClusterFitResult& result );
+#endif
+#if SQUISH_BUILD_AVX512
+void ClusterFitAvx512( ClusterFitLanes const& lanes, int colours, ClusterFitResult& result );
+#endif
+
+/*! @brief Picks the widest kernel the processor supports.
+
+	Returns null if there is none, in which case ClusterFit should be used.
+*/
+ClusterFitKernel GetClusterFitKernel();
+
+/*! @brief Cluster fits the colours of several blocks at once.
+
+	@param kernel	The kernel to search the partitions with.
+	@param colours	The colour sets of the blocks, each with more than one colour.
+	@param blocks	The colour blocks to write to.
+	@param count	The number of blocks, at most kClusterFitBatchSize.
+	@param flags	The compression flags, without iterative cluster fit.
+
+	Gives the same blocks as a ClusterFit over each colour set. Only the
+	principle axis and the ordering of the points are computed per block.
+*/
+void ClusterFitBatch( ClusterFitKernel kernel, ColourSet const* colours, void* const* blocks, int count, int flags );
+
+} // namespace squish
+
+#endif // ndef SQUISH_CLUSTERFITBATCH_H
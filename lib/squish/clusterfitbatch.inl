@@ -0,0 +1,321 @@
+/* -----------------------------------------------------------------------------
+
+	Copyright (c) 2006 Simon Brown                          si@sjbrown.co.uk
+	Copyright (c) 2007 Ignacio Castano                   icastano@nvidia.com
+
+	Permission is hereby granted, free of charge, to any person obtaining
+	a copy of this software and associated documentation files (the
+	"Software"), to	deal in the Software without restriction, including
+	without limitation the rights to use, copy, modify, merge, publish,
+	distribute, sublicense, and/or sell copies of the Software, and to
+	permit persons to whom the Software is furnished to do so, subject to
+	the following conditions:
+
+	The above copyright notice and this permission notice shall be included
+	in all copies or substantial portions of the Software.
+
+	THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS
+	OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+	MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+	IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY
+	CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+	TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+	SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+
+   -------------------------------------------------------------------------- */
+
+/*! @file
+
+	The partition search of ClusterFit::Compress3 and ClusterFit::Compress4,
+	with the blocks laid out as a structure of arrays, one block per lane.
+
+	It is included by each kernel after defining its vector type V, with
+	Arg and Mask types, a kWidth lane count and the operations used below.
+	Every operation of the SSE2 Vec4 code is mirrored per channel in the
+	same order, so that the blocks come out bit identical.
+*/
+
+namespace squish {
+namespace {
+
+template< typename V >
+struct ClusterFitSearch
+{
+	typedef typename V::Arg Arg;
+	typedef typename V::Mask Mask;
+
+	//! The best fit so far of each lane.
+	struct Best
+	{
+		Arg error;
+		Arg start[3];
+		Arg end[3];
+		Arg i, j, k;
+	};
+
+	Arg points[4][16];
+	Arg sums[4];
+	Arg counts;
+	Arg metric[3];
+	Arg grid[3];
+	Arg gridrcp[3];
+	int maxCount;
+
+	static Arg MultiplyAdd( Arg a, Arg b, Arg c )
+	{
+		return V::Add( V::Mul( a, b ), c );
+	}
+
+	static Arg NegativeMultiplySubtract( Arg a, Arg b, Arg c )
+	{
+		return V::Sub( c, V::Mul( a, b ) );
+	}
+
+	static Arg Reciprocal( Arg v )
+	{
+		// get the reciprocal estimate
+		Arg estimate = V::ReciprocalEstimate( v );
+
+		// one round of Newton-Rhaphson refinement
+		Arg diff = V::Sub( V::Splat( 1.0f ), V::Mul( estimate, v ) );
+		return V::Add( V::Mul( diff, estimate ), estimate );
+	}
+
+	//! Solves for the endpoints of one partition and keeps it if it wins.
+	void Evaluate( Arg const* alphax, Arg alpha2, Arg const* betax, Arg beta2, Arg alphabeta,
+		Mask valid, Arg i, Arg j, Arg k, Best& best ) const
+	{
+		Arg const two = V::Splat( 2.0f );
+		Arg const one = V::Splat( 1.0f );
+		Arg const zero = V::Zero();
+		Arg const half = V::Splat( 0.5f );
+
+		// compute the least-squares optimal points
+		Arg factor = Reciprocal( NegativeMultiplySubtract( alphabeta, alphabeta, V::Mul( alpha2, beta2 ) ) );
+
+		Arg a[3], b[3], e5[3];
+		for( int ch = 0; ch < 3; ++ch )
+		{
+			a[ch] = V::Mul( NegativeMultiplySubtract( betax[ch], alphabeta, V::Mul( alphax[ch], beta2 ) ), factor );
+			b[ch] = V::Mul( NegativeMultiplySubtract( alphax[ch], alphabeta, V::Mul( betax[ch], alpha2 ) ), factor );
+
+			// clamp to the grid
+			a[ch] = V::Min( one, V::Max( zero, a[ch] ) );
+			b[ch] = V::Min( one, V::Max( zero, b[ch] ) );
+			a[ch] = V::Mul( V::Truncate( MultiplyAdd( grid[ch], a[ch], half ) ), gridrcp[ch] );
+			b[ch] = V::Mul( V::Truncate( MultiplyAdd( grid[ch], b[ch], half ) ), gridrcp[ch] );
+
+			// compute the error (we skip the constant xxsum)
+			Arg e1 = MultiplyAdd( V::Mul( a[ch], a[ch] ), alpha2, V::Mul( V::Mul( b[ch], b[ch] ), beta2 ) );
+			Arg e2 = NegativeMultiplySubtract( a[ch], alphax[ch], V::Mul( V::Mul( a[ch], b[ch] ), alphabeta ) );
+			Arg e3 = NegativeMultiplySubtract( b[ch], betax[ch], e2 );
+			Arg e4 = MultiplyAdd( two, e3, e1 );
+
+			// apply the metric to the error term
+			e5[ch] = V::Mul( e4, metric[ch] );
+		}
+		Arg error = V::Add( V::Add( e5[0], e5[1] ), e5[2] );
+
+		// keep the solution if it wins
+		Mask wins = V::And( valid, V::CompareLessThan( error, best.error ) );
+		if( !V::Any( wins ) )
+			return;
+
+		best.error = V::Select( wins, error, best.error );
+		for( int ch = 0; ch < 3; ++ch )
+		{
+			best.start[ch] = V::Select( wins, a[ch], best.start[ch] );
+			best.end[ch] = V::Select( wins, b[ch], best.end[ch] );
+		}
+		best.i = V::Select( wins, i, best.i );
+		best.j = V::Select( wins, j, best.j );
+		best.k = V::Select( wins, k, best.k );
+	}
+
+	//! Mirrors the partition loops of ClusterFit::Compress3.
+	void Search3( Best& best ) const
+	{
+		Arg const zero = V::Zero();
+		Arg const half_half2[4] = { V::Splat( 0.5f ), V::Splat( 0.5f ), V::Splat( 0.5f ), V::Splat( 0.25f ) };
+
+		// first cluster [0,i) is at the start
+		Arg part0[4] = { zero, zero, zero, zero };
+		for( int i = 0; i < maxCount; ++i )
+		{
+			Arg const fi = V::Splat( float( i ) );
+			Mask const valid_i = V::CompareLessThan( fi, counts );
+
+			// second cluster [i,j) is half along
+			Arg part1[4];
+			for( int ch = 0; ch < 4; ++ch )
+				part1[ch] = ( i == 0 ) ? points[ch][0] : zero;
+			int jmin = ( i == 0 ) ? 1 : i;
+			for( int j = jmin;; )
+			{
+				Arg const fj = V::Splat( float( j ) );
+				Mask const valid = V::And( valid_i, V::CompareLessEqual( fj, counts ) );
+
+				// last cluster [j,count) is at the end
+				Arg alphax[4], betax[4];
+				for( int ch = 0; ch < 4; ++ch )
+				{
+					Arg part2 = V::Sub( V::Sub( sums[ch], part1[ch] ), part0[ch] );
+
+					// compute least squares terms directly
+					alphax[ch] = MultiplyAdd( part1[ch], half_half2[ch], part0[ch] );
+					betax[ch] = MultiplyAdd( part1[ch], half_half2[ch], part2 );
+				}
+				Arg alphabeta = V::Mul( part1[3], half_half2[3] );
+
+				Evaluate( alphax, alphax[3], betax, betax[3], alphabeta, valid, fi, fj, zero, best );
+
+				// advance
+				if( j == maxCount )
+					break;
+				for( int ch = 0; ch < 4; ++ch )
+					part1[ch] = V::Add( part1[ch], points[ch][j] );
+				++j;
+			}
+
+			// advance
+			for( int ch = 0; ch < 4; ++ch )
+				part0[ch] = V::Add( part0[ch], points[ch][i] );
+		}
+	}
+
+	//! Mirrors the partition loops of ClusterFit::Compress4.
+	void Search4( Best& best ) const
+	{
+		Arg const zero = V::Zero();
+		Arg const onethird_onethird2[4] = { V::Splat( 1.0f/3.0f ), V::Splat( 1.0f/3.0f ), V::Splat( 1.0f/3.0f ), V::Splat( 1.0f/9.0f ) };
+		Arg const twothirds_twothirds2[4] = { V::Splat( 2.0f/3.0f ), V::Splat( 2.0f/3.0f ), V::Splat( 2.0f/3.0f ), V::Splat( 4.0f/9.0f ) };
+		Arg const twonineths = V::Splat( 2.0f/9.0f );
+
+		// first cluster [0,i) is at the start
+		Arg part0[4] = { zero, zero, zero, zero };
+		for( int i = 0; i < maxCount; ++i )
+		{
+			Arg const fi = V::Splat( float( i ) );
+			Mask const valid_i = V::CompareLessThan( fi, counts );
+
+			// second cluster [i,j) is one third along
+			Arg part1[4] = { zero, zero, zero, zero };
+			for( int j = i;; )
+			{
+				Arg const fj = V::Splat( float( j ) );
+				Mask const valid_j = V::And( valid_i, V::CompareLessEqual( fj, counts ) );
+
+				// third cluster [j,k) is two thirds along
+				Arg part2[4];
+				for( int ch = 0; ch < 4; ++ch )
+					part2[ch] = ( j == 0 ) ? points[ch][0] : zero;
+				int kmin = ( j == 0 ) ? 1 : j;
+				for( int k = kmin;; )
+				{
+					Arg const fk = V::Splat( float( k ) );
+					Mask const valid = V::And( valid_j, V::CompareLessEqual( fk, counts ) );
+
+					// last cluster [k,count) is at the end
+					Arg alphax[4], betax[4];
+					for( int ch = 0; ch < 4; ++ch )
+					{
+						Arg part3 = V::Sub( V::Sub( V::Sub( sums[ch], part2[ch] ), part1[ch] ), part0[ch] );
+
+						// compute least squares terms directly
+						alphax[ch] = MultiplyAdd( part2[ch], onethird_onethird2[ch], MultiplyAdd( part1[ch], twothirds_twothirds2[ch], part0[ch] ) );
+						betax[ch] = MultiplyAdd( part1[ch], onethird_onethird2[ch], MultiplyAdd( part2[ch], twothirds_twothirds2[ch], part3 ) );
+					}
+					Arg alphabeta = V::Mul( twonineths, V::Add( part1[3], part2[3] ) );
+
+					Evaluate( alphax, alphax[3], betax, betax[3], alphabeta, valid, fi, fj, fk, best );
+
+					// advance
+					if( k == maxCount )
+						break;
+					for( int ch = 0; ch < 4; ++ch )
+						part2[ch] = V::Add( part2[ch], points[ch][k] );
+					++k;
+				}
+
+				// advance
+				if( j == maxCount )
+					break;
+				for( int ch = 0; ch < 4; ++ch )
+					part1[ch] = V::Add( part1[ch], points[ch][j] );
+				++j;
+			}
+
+			// advance
+			for( int ch = 0; ch < 4; ++ch )
+				part0[ch] = V::Add( part0[ch], points[ch][i] );
+		}
+	}
+
+	//! Searches each group of kWidth lanes of the batch in turn.
+	static void Run( ClusterFitLanes const& lanes, int colours, ClusterFitResult& result )
+	{
+		float const grid3[3] = { 31.0f, 63.0f, 31.0f };
+		float const gridrcp3[3] = { 1.0f/31.0f, 1.0f/63.0f, 1.0f/31.0f };
+
+		ClusterFitSearch search;
+		for( int ch = 0; ch < 3; ++ch )
+		{
+			search.metric[ch] = V::Splat( lanes.metric[ch] );
+			search.grid[ch] = V::Splat( grid3[ch] );
+			search.gridrcp[ch] = V::Splat( gridrcp3[ch] );
+		}
+
+		for( int g = 0; g < kClusterFitBatchSize; g += V::kWidth )
+		{
+			// skip the groups without blocks
+			search.maxCount = 0;
+			for( int l = g; l < g + V::kWidth; ++l )
+			{
+				if( lanes.counts[l] > float( search.maxCount ) )
+					search.maxCount = int( lanes.counts[l] );
+			}
+			if( search.maxCount == 0 )
+				continue;
+
+			// load the lanes
+			for( int ch = 0; ch < 4; ++ch )
+			{
+				for( int i = 0; i < search.maxCount; ++i )
+					search.points[ch][i] = V::Load( lanes.points[ch][i] + g );
+				search.sums[ch] = V::Load( lanes.sums[ch] + g );
+			}
+			search.counts = V::Load( lanes.counts + g );
+
+			Best best;
+			best.error = V::Load( result.error + g );
+			for( int ch = 0; ch < 3; ++ch )
+			{
+				best.start[ch] = V::Load( result.start[ch] + g );
+				best.end[ch] = V::Load( result.end[ch] + g );
+			}
+			best.i = V::Load( result.i + g );
+			best.j = V::Load( result.j + g );
+			best.k = V::Load( result.k + g );
+
+			// search them
+			if( colours == 3 )
+				search.Search3( best );
+			else
+				search.Search4( best );
+
+			// store the winners
+			V::Store( result.error + g, best.error );
+			for( int ch = 0; ch < 3; ++ch )
+			{
+				V::Store( result.start[ch] + g, best.start[ch] );
+				V::Store( result.end[ch] + g, best.end[ch] );
+			}
+			V::Store( result.i + g, best.i );
+			V::Store( result.j + g, best.j );
+			V::Store( result.k + g, best.k );
+		}
+	}
+};
+
+} // anonymous namespace
+} // namespace squish
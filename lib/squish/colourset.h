@@ -36,6 +36,7 @@ namespace squish {
 class ColourSet
 {
 public:
+	ColourSet() : m_count( 0 ), m_transparent( false ) {}
 	ColourSet( u8 const* rgba, int mask, int flags );
 
 	int GetCount() const { return m_count; }
@@ -36,10 +36,29 @@
 #define SQUISH_USE_SSE 0
 #endif
 
+// Set to 1 when building the SSE4.1, AVX2 or AVX-512 cluster fit kernels and
+// block decoders, which are picked at runtime. The AVX-512 block decoders
+// need AVX-512BW on top of the AVX-512F the cluster fit kernel uses.
+#ifndef SQUISH_BUILD_SSE41
+#define SQUISH_BUILD_SSE41 0
+#endif
+#ifndef SQUISH_BUILD_AVX2
+#define SQUISH_BUILD_AVX2 0
+#endif
+#ifndef SQUISH_BUILD_AVX512
+#define SQUISH_BUILD_AVX512 0
+#endif
+#ifndef SQUISH_BUILD_AVX512BW
+#define SQUISH_BUILD_AVX512BW 0
+#endif
+
 // Internally et SQUISH_USE_SIMD when either Altivec or SSE is available.
 #if SQUISH_USE_ALTIVEC && SQUISH_USE_SSE
 #error "Cannot enable both Altivec and SSE!"
 #endif
+#if ( SQUISH_BUILD_SSE41 || SQUISH_BUILD_AVX2 || SQUISH_BUILD_AVX512 || SQUISH_BUILD_AVX512BW ) && SQUISH_USE_SSE < 2
+#error "The runtime picked kernels mirror the SSE2 arithmetic, so they need SSE2!"
+#endif
 #if SQUISH_USE_ALTIVEC || SQUISH_USE_SSE
 #define SQUISH_USE_SIMD 1
 #else
@@ -0,0 +1,125 @@
+/* -----------------------------------------------------------------------------
+
+	Copyright (c) 2006 Simon Brown                          si@sjbrown.co.uk
+
+	Permission is hereby granted, free of charge, to any person obtaining
+	a copy of this software and associated documentation files (the 
+	"Software"), to	deal in the Software without restriction, including
+	without limitation the rights to use, copy, modify, merge, publish,
+	distribute, sublicense, and/or sell copies of the Software, and to 
+	permit persons to whom the Software is furnished to do so, subject to 
+	the following conditions:
+
+	The above copyright notice and this permission notice shall be included
+	in all copies or substantial portions of the Software.
+
+	THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS
+	OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF 
+	MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+	IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY 
+	CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, 
+	TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE 
+	SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+	
+   -------------------------------------------------------------------------- */
+   
+#include <squish.h>
+
+#if defined( __GNUC__ ) && ( defined( __i386__ ) || defined( __x86_64__ ) )
+#include <cpuid.h>
+#define SQUISH_HAVE_CPUID 1
+#elif defined( _MSC_VER ) && ( defined( _M_IX86 ) || defined( _M_X64 ) )
+#include <intrin.h>
+#define SQUISH_HAVE_CPUID 1
+#else
+#define SQUISH_HAVE_CPUID 0
+#endif
+
+namespace squish {
+
+#if SQUISH_HAVE_CPUID
+
+static void Cpuid( unsigned int leaf, unsigned int subleaf, unsigned int* regs )
+{
+#ifdef _MSC_VER
+	int info[4];
+	__cpuidex( info, int( leaf ), int( subleaf ) );
+	for( int i = 0; i < 4; ++i )
+		regs[i] = ( unsigned int )info[i];
+#else
+	__cpuid_count( leaf, subleaf, regs[0], regs[1], regs[2], regs[3] );
+#endif
+}
+
+//! Returns the low word of XCR0, which tells which registers the OS saves.
+static unsigned int GetEnabledState()
+{
+#ifdef _MSC_VER
+	return ( unsigned int )_xgetbv( 0 );
+#else
+	unsigned int eax, edx;
+	__asm__ __volatile__ ( "xgetbv" : "=a" ( eax ), "=d" ( edx ) : "c" ( 0 ) );
+	return eax;
+#endif
+}
+
+static int DetectCpuFeatures()
+{
+	unsigned int regs[4];
+	Cpuid( 0, 0, regs );
+	unsigned int const maxLeaf = regs[0];
+	if( maxLeaf < 1 )
+		return 0;
+
+	Cpuid( 1, 0, regs );
+	unsigned int const ecx1 = regs[2];
+	unsigned int const edx1 = regs[3];
+
+	int features = 0;
+	if( ( edx1 & ( 1u << 26 ) ) != 0 )
+		features |= kCpuSse2;
+	if( ( features & kCpuSse2 ) != 0 && ( ecx1 & ( 1u << 19 ) ) != 0 )
+		features |= kCpuSse41;
+
+	// the wider registers also need the OS to save them (OSXSAVE and XCR0)
+	bool const osxsave = ( ecx1 & ( 1u << 27 ) ) != 0;
+	if( !osxsave || maxLeaf < 7 || ( ecx1 & ( 1u << 28 ) ) == 0 )
+		return features;
+	unsigned int const xcr0 = GetEnabledState();
+
+	Cpuid( 7, 0, regs );
+	unsigned int const ebx7 = regs[1];
+	if( ( xcr0 & 0x6 ) == 0x6 && ( ebx7 & ( 1u << 5 ) ) != 0 && ( features & kCpuSse41 ) != 0 )
+		features |= kCpuAvx2;
+	if( ( xcr0 & 0xe6 ) == 0xe6 && ( ebx7 & ( 1u << 16 ) ) != 0 && ( features & kCpuAvx2 ) != 0 )
+		features |= kCpuAvx512;
+	if( ( features & kCpuAvx512 ) != 0 && ( ebx7 & ( 1u << 30 ) ) != 0 )
+		features |= kCpuAvx512Bw;
+
+	return features;
+}
+
+#else
+
+static int DetectCpuFeatures()
+{
+	return 0;
+}
+
+#endif
+
+// the processor is queried once, at startup
+static int const s_detectedFeatures = DetectCpuFeatures();
+static int s_features = s_detectedFeatures;
+
+int GetCpuFeatures()
+{
+	return s_features;
+}
+
+void SetCpuFeatures( int features )
+{
+	s_features = s_detectedFeatures & features;
+}
+
+} // namespace squish
@@ -0,0 +1,128 @@
+/* -----------------------------------------------------------------------------
+
+	Copyright (c) 2006 Simon Brown                          si@sjbrown.co.uk
+
+	Permission is hereby granted, free of charge, to any person obtaining
+	a copy of this software and associated documentation files (the 
+	"Software"), to	deal in the Software without restriction, including
+	without limitation the rights to use, copy, modify, merge, publish,
+	distribute, sublicense, and/or sell copies of the Software, and to 
+	permit persons to whom the Software is furnished to do so, subject to 
+	the following conditions:
+
+	The above copyright notice and this permission notice shall be included
+	in all copies or substantial portions of the Software.
+
+	THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS
+	OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF 
+	MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+	IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY 
+	CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, 
+	TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE 
+	SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+	
+   -------------------------------------------------------------------------- */
+
+/*
+ * Times CompressAlphaDxt5 over a million blocks of each of a few kinds of
+ * alpha, printing the time per block and a checksum of the blocks, so that
+ * builds with and without SSE2 can be compared for both speed and output.
+ */
+
+#include "alpha.h"
+
+#include <cstdio>
+#include <ctime>
+#include <vector>
+
+using namespace squish;
+
+namespace {
+
+int const kBlockCount = 1 << 20;
+
+//! A small linear congruential generator, so that runs are reproducible.
+class Random
+{
+public:
+	explicit Random( unsigned int seed ) : m_state( seed ) {}
+
+	int Next( int bound )
+	{
+		m_state = m_state*1103515245u + 12345u;
+		return int( ( m_state >> 16 ) % unsigned( bound ) );
+	}
+
+private:
+	unsigned int m_state;
+};
+
+enum Pattern
+{
+	kRandom,
+	kClustered,
+	kBinary,
+	kFlat,
+	kRamp,
+	kPatternCount
+};
+
+char const* const s_patternNames[kPatternCount] = { "random", "clustered", "binary", "flat", "ramp" };
+
+//! Gives the alpha of pixel i of block b.
+u8 GetAlpha( Pattern pattern, int b, int i, Random& random )
+{
+	switch( pattern )
+	{
+	case kRandom:
+		return u8( random.Next( 256 ) );
+	case kClustered:
+		return u8( ( b*37 ) % 200 + random.Next( 24 ) );
+	case kBinary:
+		return random.Next( 4 ) == 0 ? u8( random.Next( 256 ) ) : ( random.Next( 2 ) ? 255 : 0 );
+	case kFlat:
+		return u8( b );
+	default:
+		return u8( b + 15*i );
+	}
+}
+
+} // anonymous namespace
+
+int main()
+{
+	Random random( 1 );
+
+	std::vector< u8 > rgba( 64*std::size_t( kBlockCount ) );
+	std::vector< int > masks( kBlockCount );
+	std::vector< u8 > blocks( 8*std::size_t( kBlockCount ) );
+
+	for( int p = 0; p < kPatternCount; ++p )
+	{
+		Pattern const pattern = Pattern( p );
+		for( int b = 0; b < kBlockCount; ++b )
+		{
+			for( int i = 0; i < 16; ++i )
+			{
+				u8* pixel = &rgba[64*std::size_t( b ) + 4*i];
+				pixel[0] = pixel[1] = pixel[2] = 0;
+				pixel[3] = GetAlpha( pattern, b, i, random );
+			}
+			// one block in eight is on the edge of an image
+			masks[b] = ( b % 8 == 0 ) ? ( 0xffff >> random.Next( 16 ) ) : 0xffff;
+		}
+
+		std::clock_t const start = std::clock();
+		for( int b = 0; b < kBlockCount; ++b )
+			CompressAlphaDxt5( &rgba[64*std::size_t( b )], masks[b], &blocks[8*std::size_t( b )] );
+		double const seconds = double( std::clock() - start )/CLOCKS_PER_SEC;
+
+		unsigned int checksum = 0;
+		for( std::size_t i = 0; i < blocks.size(); ++i )
+			checksum = checksum*31u + blocks[i];
+
+		std::printf( "%-10s %7.2f ns/block  checksum %08x\n", s_patternNames[p], 1e9*seconds/kBlockCount, checksum );
+	}
+
+	return 0;
+}
@@ -0,0 +1,241 @@
+/* -----------------------------------------------------------------------------
+
+	Copyright (c) 2006 Simon Brown                          si@sjbrown.co.uk
+
+	Permission is hereby granted, free of charge, to any person obtaining
+	a copy of this software and associated documentation files (the 
+	"Software"), to	deal in the Software without restriction, including
+	without limitation the rights to use, copy, modify, merge, publish,
+	distribute, sublicense, and/or sell copies of the Software, and to 
+	permit persons to whom the Software is furnished to do so, subject to 
+	the following conditions:
+
+	The above copyright notice and this permission notice shall be included
+	in all copies or substantial portions of the Software.
+
+	THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS
+	OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF 
+	MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+	IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY 
+	CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, 
+	TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE 
+	SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+	
+   -------------------------------------------------------------------------- */
+
+/*
+ * Checks that CompressImage gives the same blocks as compressing each block
+ * on its own with CompressMasked, with every cluster fit kernel the
+ * processor supports. The kernels are meant to be bit identical to the
+ * scalar fit, so any difference (such as from the compiler contracting
+ * multiplies and adds into FMA) is a failure.
+ *
+ * Likewise, DecompressImage must give the same pixels as Decompress over
+ * each block, with every block decoder.
+ */
+
+#include <squish.h>
+
+#include <cstdio>
+#include <cstring>
+#include <vector>
+
+using namespace squish;
+
+namespace {
+
+//! A small linear congruential generator, so that runs are reproducible.
+class Random
+{
+public:
+	explicit Random( unsigned int seed ) : m_state( seed ) {}
+
+	int Next( int bound )
+	{
+		m_state = m_state*1103515245u + 12345u;
+		return int( ( m_state >> 16 ) % unsigned( bound ) );
+	}
+
+private:
+	unsigned int m_state;
+};
+
+/*! @brief Fills an image with a mix of gradients, noise and flat areas.
+
+	Gradients give blocks with few distinct colours, noise blocks with 
+	many, and the flat areas go through the constant block path.
+*/
+void FillImage( std::vector< u8 >& rgba, int width, int height, Random& random )
+{
+	rgba.resize( 4*width*height );
+	for( int y = 0; y < height; ++y )
+	{
+		for( int x = 0; x < width; ++x )
+		{
+			u8* pixel = &rgba[4*( width*y + x )];
+			int const region = ( x/8 + y/8 ) % 3;
+			for( int i = 0; i < 4; ++i )
+			{
+				if( region == 0 )
+					pixel[i] = u8( ( 3*x + 5*y + 40*i ) & 0xff );
+				else if( region == 1 )
+					pixel[i] = u8( random.Next( 256 ) );
+				else
+					pixel[i] = u8( 64*i + 10 );
+			}
+			// some alpha is binary, to exercise the DXT1 transparent blocks
+			if( region == 1 && ( x & 4 ) != 0 )
+				pixel[3] = ( pixel[3] < 128 ) ? 0 : 255;
+		}
+	}
+}
+
+//! Compresses each block of the image on its own.
+void CompressBlocks( u8 const* rgba, int width, int height, u8* blocks, int flags )
+{
+	int const bytesPerBlock = ( ( flags & kDxt1 ) != 0 ) ? 8 : 16;
+	for( int y = 0; y < height; y += 4 )
+	{
+		for( int x = 0; x < width; x += 4 )
+		{
+			u8 sourceRgba[16*4];
+			std::memset( sourceRgba, 0, sizeof( sourceRgba ) );
+			int mask = 0;
+			for( int py = 0; py < 4; ++py )
+			{
+				for( int px = 0; px < 4; ++px )
+				{
+					int const sx = x + px;
+					int const sy = y + py;
+					if( sx < width && sy < height )
+					{
+						std::memcpy( sourceRgba + 4*( 4*py + px ), rgba + 4*( width*sy + sx ), 4 );
+						mask |= 1 << ( 4*py + px );
+					}
+				}
+			}
+			CompressMasked( sourceRgba, mask, blocks, flags );
+			blocks += bytesPerBlock;
+		}
+	}
+}
+
+//! Decompresses each block of the image on its own.
+void DecompressBlocks( u8* rgba, int width, int height, u8 const* blocks, int flags )
+{
+	int const bytesPerBlock = ( ( flags & kDxt1 ) != 0 ) ? 8 : 16;
+	for( int y = 0; y < height; y += 4 )
+	{
+		for( int x = 0; x < width; x += 4 )
+		{
+			u8 targetRgba[16*4];
+			Decompress( targetRgba, blocks, flags );
+			for( int py = 0; py < 4; ++py )
+			{
+				for( int px = 0; px < 4; ++px )
+				{
+					int const sx = x + px;
+					int const sy = y + py;
+					if( sx < width && sy < height )
+						std::memcpy( rgba + 4*( width*sy + sx ), targetRgba + 4*( 4*py + px ), 4 );
+				}
+			}
+			blocks += bytesPerBlock;
+		}
+	}
+}
+
+} // anonymous namespace
+
+int main()
+{
+	static int const sizes[][2] = { { 4, 4 }, { 7, 5 }, { 64, 64 }, { 100, 12 }, { 130, 67 }, { 256, 250 } };
+	static int const formats[] = { kDxt1, kDxt3, kDxt5 };
+	static int const metrics[] = { kColourMetricPerceptual, kColourMetricUniform };
+	static int const fits[] = { kColourClusterFit, kColourRangeFit, kColourIterativeClusterFit };
+	static int const kernels[] = { 0, kCpuSse2, kCpuSse2 | kCpuSse41, 
+		kCpuSse2 | kCpuSse41 | kCpuAvx2, kCpuSse2 | kCpuSse41 | kCpuAvx2 | kCpuAvx512, 
+		kCpuSse2 | kCpuSse41 | kCpuAvx2 | kCpuAvx512 | kCpuAvx512Bw };
+
+	int const detected = GetCpuFeatures();
+	int cases = 0;
+	int failures = 0;
+
+	Random random( 1 );
+	for( size_t s = 0; s < sizeof( sizes )/sizeof( sizes[0] ); ++s )
+	{
+		int const width = sizes[s][0];
+		int const height = sizes[s][1];
+		std::vector< u8 > rgba;
+		FillImage( rgba, width, height, random );
+
+		for( size_t f = 0; f < sizeof( formats )/sizeof( formats[0] ); ++f )
+		for( size_t m = 0; m < sizeof( metrics )/sizeof( metrics[0] ); ++m )
+		for( size_t t = 0; t < sizeof( fits )/sizeof( fits[0] ); ++t )
+		for( int weight = 0; weight < 2; ++weight )
+		{
+			int const flags = formats[f] | metrics[m] | fits[t] | ( weight ? kWeightColourByAlpha : 0 );
+			int const size = GetStorageRequirements( width, height, flags );
+
+			std::vector< u8 > expected( size );
+			SetCpuFeatures( 0 );
+			CompressBlocks( &rgba[0], width, height, &expected[0], flags );
+
+			for( size_t k = 0; k < sizeof( kernels )/sizeof( kernels[0] ); ++k )
+			{
+				if( ( kernels[k] & detected ) != kernels[k] )
+					continue;
+
+				std::vector< u8 > actual( size );
+				SetCpuFeatures( kernels[k] );
+				CompressImage( &rgba[0], width, height, &actual[0], flags );
+
+				++cases;
+				if( std::memcmp( &expected[0], &actual[0], size ) != 0 )
+				{
+					++failures;
+					std::printf( "%dx%d, flags 0x%x, cpu features 0x%x: blocks differ\n", width, height, flags, kernels[k] );
+				}
+			}
+		}
+	}
+
+	// random blocks reach every palette mode and index
+	for( size_t s = 0; s < sizeof( sizes )/sizeof( sizes[0] ); ++s )
+	for( size_t f = 0; f < sizeof( formats )/sizeof( formats[0] ); ++f )
+	{
+		int const width = sizes[s][0];
+		int const height = sizes[s][1];
+		int const flags = formats[f];
+
+		std::vector< u8 > blocks( GetStorageRequirements( width, height, flags ) );
+		for( size_t i = 0; i < blocks.size(); ++i )
+			blocks[i] = u8( random.Next( 256 ) );
+
+		std::vector< u8 > expected( 4*width*height );
+		SetCpuFeatures( 0 );
+		DecompressBlocks( &expected[0], width, height, &blocks[0], flags );
+
+		for( size_t k = 0; k < sizeof( kernels )/sizeof( kernels[0] ); ++k )
+		{
+			if( ( kernels[k] & detected ) != kernels[k] )
+				continue;
+
+			std::vector< u8 > actual( 4*width*height );
+			SetCpuFeatures( kernels[k] );
+			DecompressImage( &actual[0], width, height, &blocks[0], flags );
+
+			++cases;
+			if( actual != expected )
+			{
+				++failures;
+				std::printf( "%dx%d, flags 0x%x, cpu features 0x%x: pixels differ\n", width, height, flags, kernels[k] );
+			}
+		}
+	}
+
+	SetCpuFeatures( detected );
+
+	std::printf( "%d of %d cases differ\n", failures, cases );
+	return failures == 0 ? 0 : 1;
+}
@@ -38,6 +38,9 @@ class RangeFit : public ColourFit
 {
 public:
 	RangeFit( ColourSet const* colours, int flags );
+
+	//! The error of the compressed block, under the colour error metric.
+	float GetError() const { return m_besterror; }
 	
 private:
 	virtual void Compress3( void* block );
@@ -28,10 +28,16 @@
 #include "maths.h"
 #include "rangefit.h"
 #include "clusterfit.h"
+#include "clusterfitbatch.h"
+#include "blockcache.h"
+#include "blockdecoder.h"
 #include "colourblock.h"
 #include "alpha.h"
 #include "singlecolourfit.h"
 
+#include <cstddef>
+#include <cstring>
+
 namespace squish {
 
 static int FixFlags( int flags )
@@ -45,10 +51,14 @@ static int FixFlags( int flags )
 	// set defaults
 	if( method != kDxt3 && method != kDxt5 )
 		method = kDxt1;
-	if( fit != kColourRangeFit )
+	if( fit != kColourRangeFit && fit != kColourIterativeClusterFit )
 		fit = kColourClusterFit;
 	if( metric != kColourMetricUniform )
 		metric = kColourMetricPerceptual;
+
+	// a range fit first only makes sense before a cluster fit
+	if( fit != kColourRangeFit && ( flags & kColourAdaptiveFit ) != 0 )
+		extra |= flags & ( kColourAdaptiveFit | kAdaptiveFitThresholdMask );
 		
 	// done
 	return method | fit | metric | extra;
@@ -60,20 +70,26 @@ void Compress( u8 const* rgba, void* block, int flags )
 	CompressMasked( rgba, 0xffff, block, flags );
 }
 
-void CompressMasked( u8 const* rgba, int mask, void* block, int flags )
+//! Range fits the colours when fitting adaptively, returning whether that fit is good enough to keep.
+static bool TryRangeFit( ColourSet const& colours, void* colourBlock, int flags )
 {
-	// fix any bad flags
-	flags = FixFlags( flags );
+	// only when asked to fit adaptively
+	if( ( flags & kColourAdaptiveFit ) == 0 )
+		return false;
 
-	// get the block locations
-	void* colourBlock = block;
-	void* alphaBock = block;
-	if( ( flags & ( kDxt3 | kDxt5 ) ) != 0 )
-		colourBlock = reinterpret_cast< u8* >( block ) + 8;
+	RangeFit fit( &colours, flags );
+	fit.Compress( colourBlock );
 
-	// create the minimal point set
-	ColourSet colours( rgba, mask, flags );
-	
+	// scale the threshold to the error of the whole block under the metric
+	float const steps = ( float )( ( flags & kAdaptiveFitThresholdMask ) >> 16 )/255.0f;
+	float const metric = ( ( flags & kColourMetricUniform ) != 0 ) 
+		? 3.0f 
+		: 0.2126f*0.2126f + 0.7152f*0.7152f + 0.0722f*0.0722f;
+	return fit.GetError() <= steps*steps*metric*( float )colours.GetCount();
+}
+
+static void CompressColour( ColourSet const& colours, void* colourBlock, int flags )
+{
 	// check the compression type and compress colour
 	if( colours.GetCount() == 1 )
 	{
@@ -87,13 +103,16 @@ void CompressMasked( u8 const* rgba, int mask, void* block, int flags )
 		RangeFit fit( &colours, flags );
 		fit.Compress( colourBlock );
 	}
-	else
+	else if( !TryRangeFit( colours, colourBlock, flags ) )
 	{
 		// default to a cluster fit (could be iterative or not)
 		ClusterFit fit( &colours, flags );
 		fit.Compress( colourBlock );
 	}
-	
+}
+
+static void CompressAlpha( u8 const* rgba, int mask, void* alphaBock, int flags )
+{
 	// compress alpha separately if necessary
 	if( ( flags & kDxt3 ) != 0 )
 		CompressAlphaDxt3( rgba, mask, alphaBock );
@@ -101,6 +120,25 @@ void CompressMasked( u8 const* rgba, int mask, void* block, int flags )
 		CompressAlphaDxt5( rgba, mask, alphaBock );
 }
 
+void CompressMasked( u8 const* rgba, int mask, void* block, int flags )
+{
+	// fix any bad flags
+	flags = FixFlags( flags );
+
+	// get the block locations
+	void* colourBlock = block;
+	void* alphaBock = block;
+	if( ( flags & ( kDxt3 | kDxt5 ) ) != 0 )
+		colourBlock = reinterpret_cast< u8* >( block ) + 8;
+
+	// create the minimal point set
+	ColourSet colours( rgba, mask, flags );
+	
+	// compress the colour and the alpha
+	CompressColour( colours, colourBlock, flags );
+	CompressAlpha( rgba, mask, alphaBock, flags );
+}
+
 void Decompress( u8* rgba, void const* block, int flags )
 {
 	// fix any bad flags
@@ -133,61 +171,296 @@ int GetStorageRequirements( int width, int height, int flags )
 	return blockcount*blocksize;	
 }
 
-void CompressImage( u8 const* rgba, int width, int height, void* blocks, int flags )
+/*! @brief Remembers the blocks of the constant pixels met in a row of blocks.
+
+	A block whose pixels are all the same, or which is fully transparent 
+	under DXT1, always compresses to the same bytes. Those are compressed
+	once and copied from then on, skipping the colour set and the fits.
+*/
+class ConstantBlockCache
 {
-	// fix any bad flags
-	flags = FixFlags( flags );
+public:
+	ConstantBlockCache( int flags, int bytesPerBlock )
+	  : m_flags( flags ), 
+		m_bytesPerBlock( bytesPerBlock ), 
+		m_count( 0 ), 
+		m_next( 0 ), 
+		m_haveTransparent( false )
+	{
+	}
 
-	// initialise the block output
-	u8* targetBlock = reinterpret_cast< u8* >( blocks );
-	int bytesPerBlock = ( ( flags & kDxt1 ) != 0 ) ? 8 : 16;
+	//! Writes the block if its pixels are constant, returning whether they were.
+	bool Compress( u8 const* rgba, int mask, u8* block )
+	{
+		// under DXT1 transparent pixels drop out whatever their colour
+		if( ( m_flags & kDxt1 ) != 0 && IsTransparent( rgba, mask ) )
+		{
+			if( !m_haveTransparent )
+			{
+				CompressMasked( rgba, mask, m_transparent, m_flags );
+				m_haveTransparent = true;
+			}
+			std::memcpy( block, m_transparent, m_bytesPerBlock );
+			return true;
+		}
 
-	// loop over blocks
-	for( int y = 0; y < height; y += 4 )
+		// partial blocks also depend on the mask, so leave them to the fits
+		if( mask != 0xffff || !IsUniform( rgba ) )
+			return false;
+
+		// look for the colour
+		for( int i = 0; i < m_count; ++i )
+		{
+			if( std::memcmp( m_colours[i], rgba, 4 ) == 0 )
+			{
+				std::memcpy( block, m_blocks[i], m_bytesPerBlock );
+				return true;
+			}
+		}
+
+		// compress it, replacing the oldest colour if full
+		int entry = m_next;
+		m_next = ( m_next + 1 ) % kEntries;
+		if( m_count < kEntries )
+			++m_count;
+		std::memcpy( m_colours[entry], rgba, 4 );
+		CompressMasked( rgba, mask, m_blocks[entry], m_flags );
+		std::memcpy( block, m_blocks[entry], m_bytesPerBlock );
+		return true;
+	}
+
+private:
+	static bool IsTransparent( u8 const* rgba, int mask )
 	{
-		for( int x = 0; x < width; x += 4 )
+		for( int i = 0; i < 16; ++i )
 		{
-			// build the 4x4 block of pixels
-			u8 sourceRgba[16*4];
-			u8* targetPixel = sourceRgba;
-			int mask = 0;
-			for( int py = 0; py < 4; ++py )
+			if( ( mask & ( 1 << i ) ) != 0 && rgba[4*i + 3] >= 128 )
+				return false;
+		}
+		return true;
+	}
+
+	static bool IsUniform( u8 const* rgba )
+	{
+		for( int i = 4; i < 16*4; ++i )
+		{
+			if( rgba[i] != rgba[i & 3] )
+				return false;
+		}
+		return true;
+	}
+
+	enum { kEntries = 8 };
+
+	int m_flags;
+	int m_bytesPerBlock;
+	int m_count;
+	int m_next;
+	u8 m_colours[kEntries][4];
+	u8 m_blocks[kEntries][16];
+	bool m_haveTransparent;
+	u8 m_transparent[16];
+};
+
+//! The cluster fits queued up by CompressBlockRow.
+struct PendingFits
+{
+	PendingFits() : count( 0 ) {}
+
+	ColourSet colours[kClusterFitBatchSize];
+	void* colourBlocks[kClusterFitBatchSize];
+
+	//! The blocks to remember once fitted, with their source pixels.
+	u8* blocks[kClusterFitBatchSize];
+	u8 rgba[kClusterFitBatchSize][16*4];
+	bool cache[kClusterFitBatchSize];
+
+	int count;
+};
+
+static void FlushFits( ClusterFitKernel kernel, PendingFits& fits, int flags )
+{
+	ClusterFitBatch( kernel, fits.colours, fits.colourBlocks, fits.count, flags );
+	for( int i = 0; i < fits.count; ++i )
+	{
+		if( fits.cache[i] )
+			CacheBlock( fits.rgba[i], flags, fits.blocks[i] );
+	}
+	fits.count = 0;
+}
+
+static int CompressBlockRow( u8 const* rgba, int width, int height, int pitch, int y, u8* targetBlock, int flags, int bytesPerBlock )
+{
+	// blocks of constant pixels take a shortcut
+	ConstantBlockCache constants( flags, bytesPerBlock );
+	int constantCount = 0;
+
+	// whole blocks seen before are copied from the block cache
+	bool const cached = IsBlockCacheEnabled();
+
+	// the cluster fits of the row are queued up and run in batches, with the
+	// widest kernel the processor supports
+	ClusterFitKernel const kernel = GetClusterFitKernel();
+	bool const batched = kernel != 0 && ( flags & ( kColourRangeFit | kColourIterativeClusterFit ) ) == 0;
+	PendingFits fits;
+
+	// loop over the blocks in this row
+	for( int x = 0; x < width; x += 4 )
+	{
+		// build the 4x4 block of pixels
+		u8 sourceRgba[16*4];
+		u8* targetPixel = sourceRgba;
+		int mask = 0;
+		for( int py = 0; py < 4; ++py )
+		{
+			for( int px = 0; px < 4; ++px )
 			{
-				for( int px = 0; px < 4; ++px )
+				// get the source pixel in the image
+				int sx = x + px;
+				int sy = y + py;
+				
+				// enable if we're in the image
+				if( sx < width && sy < height )
 				{
-					// get the source pixel in the image
-					int sx = x + px;
-					int sy = y + py;
-					
-					// enable if we're in the image
-					if( sx < width && sy < height )
-					{
-						// copy the rgba value
-						u8 const* sourcePixel = rgba + 4*( width*sy + sx );
-						for( int i = 0; i < 4; ++i )
-							*targetPixel++ = *sourcePixel++;
-							
-						// enable this pixel
-						mask |= ( 1 << ( 4*py + px ) );
-					}
-					else
-					{
-						// skip this pixel as its outside the image
-						targetPixel += 4;
-					}
+					// copy the rgba value
+					u8 const* sourcePixel = rgba + std::ptrdiff_t( pitch )*sy + 4*sx;
+					for( int i = 0; i < 4; ++i )
+						*targetPixel++ = *sourcePixel++;
+						
+					// enable this pixel
+					mask |= ( 1 << ( 4*py + px ) );
+				}
+				else
+				{
+					// skip this pixel as its outside the image
+					targetPixel += 4;
 				}
 			}
-			
-			// compress it into the output
+		}
+		
+		// the pixels outside the image are not part of the key, so only
+		// whole blocks are cached
+		bool const cacheable = cached && mask == 0xffff;
+
+		// compress it into the output
+		if( constants.Compress( sourceRgba, mask, targetBlock ) )
+			++constantCount;
+		else if( cacheable && FindCachedBlock( sourceRgba, flags, targetBlock ) )
+		{
+			// copied from an earlier block
+		}
+		else if( batched )
+		{
+			// get the block locations
+			void* colourBlock = targetBlock;
+			if( ( flags & ( kDxt3 | kDxt5 ) ) != 0 )
+				colourBlock = targetBlock + 8;
+
+			// the alpha goes first, so the block is complete once fitted
+			CompressAlpha( sourceRgba, mask, targetBlock, flags );
+
+			// queue up the colours if they need a cluster fit
+			int const i = fits.count;
+			fits.colours[i] = ColourSet( sourceRgba, mask, flags );
+			if( fits.colours[i].GetCount() > 1 && !TryRangeFit( fits.colours[i], colourBlock, flags ) )
+			{
+				fits.colourBlocks[i] = colourBlock;
+				fits.blocks[i] = targetBlock;
+				fits.cache[i] = cacheable;
+				if( cacheable )
+					std::memcpy( fits.rgba[i], sourceRgba, sizeof( sourceRgba ) );
+				if( ++fits.count == kClusterFitBatchSize )
+					FlushFits( kernel, fits, flags );
+			}
+			else
+			{
+				if( fits.colours[i].GetCount() <= 1 )
+					CompressColour( fits.colours[i], colourBlock, flags );
+				if( cacheable )
+					CacheBlock( sourceRgba, flags, targetBlock );
+			}
+		}
+		else
+		{
 			CompressMasked( sourceRgba, mask, targetBlock, flags );
-			
-			// advance
-			targetBlock += bytesPerBlock;
+			if( cacheable )
+				CacheBlock( sourceRgba, flags, targetBlock );
 		}
+		
+		// advance
+		targetBlock += bytesPerBlock;
+	}
+
+	// fit whatever is left over
+	if( fits.count > 0 )
+		FlushFits( kernel, fits, flags );
+
+	return constantCount;
+}
+
+int CompressImage( u8 const* rgba, int width, int height, void* blocks, int flags )
+{
+	return CompressImage( rgba, width, height, 4*width, blocks, flags );
+}
+
+int CompressImage( u8 const* rgba, int width, int height, int pitch, void* blocks, int flags )
+{
+	// fix any bad flags
+	flags = FixFlags( flags );
+
+	// initialise the block output
+	u8* targetBlock = reinterpret_cast< u8* >( blocks );
+	int bytesPerBlock = ( ( flags & kDxt1 ) != 0 ) ? 8 : 16;
+	int bytesPerRow = ( ( width + 3 )/4 )*bytesPerBlock;
+
+	// loop over rows of blocks
+	int constantCount = 0;
+	for( int y = 0; y < height; y += 4 )
+	{
+		constantCount += CompressBlockRow( rgba, width, height, pitch, y, targetBlock, flags, bytesPerBlock );
+		targetBlock += bytesPerRow;
 	}
+	return constantCount;
+}
+
+// below this many blocks, threading costs more than it saves
+static const int kMinParallelBlocks = 1024;
+
+int CompressImageParallel( u8 const* rgba, int width, int height, void* blocks, int flags )
+{
+	return CompressImageParallel( rgba, width, height, 4*width, blocks, flags );
+}
+
+int CompressImageParallel( u8 const* rgba, int width, int height, int pitch, void* blocks, int flags )
+{
+	// fix any bad flags
+	flags = FixFlags( flags );
+
+	// initialise the block output
+	u8* targetBlocks = reinterpret_cast< u8* >( blocks );
+	int bytesPerBlock = ( ( flags & kDxt1 ) != 0 ) ? 8 : 16;
+	int bytesPerRow = ( ( width + 3 )/4 )*bytesPerBlock;
+	int blockRows = ( height + 3 )/4;
+	int blockCount = blockRows*( ( width + 3 )/4 );
+
+	// each row of blocks goes to its own slot of the output
+	int constantCount = 0;
+#ifdef _OPENMP
+#	pragma omp parallel for schedule( dynamic, 1 ) reduction( +: constantCount ) if( blockCount >= kMinParallelBlocks )
+#endif
+	for( int row = 0; row < blockRows; ++row )
+		constantCount += CompressBlockRow( rgba, width, height, pitch, 4*row, targetBlocks + row*bytesPerRow, flags, bytesPerBlock );
+
+	(void)blockCount;
+	return constantCount;
 }
 
 void DecompressImage( u8* rgba, int width, int height, void const* blocks, int flags )
+{
+	DecompressImage( rgba, width, height, 4*width, blocks, flags );
+}
+
+void DecompressImage( u8* rgba, int width, int height, int pitch, void const* blocks, int flags )
 {
 	// fix any bad flags
 	flags = FixFlags( flags );
@@ -195,45 +468,41 @@ void DecompressImage( u8* rgba, int width, int height, void const* blocks, int f
 	// initialise the block input
 	u8 const* sourceBlock = reinterpret_cast< u8 const* >( blocks );
 	int bytesPerBlock = ( ( flags & kDxt1 ) != 0 ) ? 8 : 16;
+	int bytesPerRow = ( ( width + 3 )/4 )*bytesPerBlock;
 
-	// loop over blocks
+	// loop over rows of blocks
 	for( int y = 0; y < height; y += 4 )
 	{
-		for( int x = 0; x < width; x += 4 )
-		{
-			// decompress the block
-			u8 targetRgba[4*16];
-			Decompress( targetRgba, sourceBlock, flags );
-			
-			// write the decompressed pixels to the correct image locations
-			u8 const* sourcePixel = targetRgba;
-			for( int py = 0; py < 4; ++py )
-			{
-				for( int px = 0; px < 4; ++px )
-				{
-					// get the target location
-					int sx = x + px;
-					int sy = y + py;
-					if( sx < width && sy < height )
-					{
-						u8* targetPixel = rgba + 4*( width*sy + sx );
-						
-						// copy the rgba value
-						for( int i = 0; i < 4; ++i )
-							*targetPixel++ = *sourcePixel++;
-					}
-					else
-					{
-						// skip this pixel as its outside the image
-						sourcePixel += 4;
-					}
-				}
-			}
-			
-			// advance
-			sourceBlock += bytesPerBlock;
-		}
+		DecompressBlockRow( rgba, width, height, pitch, y, sourceBlock, flags );
+		sourceBlock += bytesPerRow;
 	}
 }
 
+void DecompressImageParallel( u8* rgba, int width, int height, void const* blocks, int flags )
+{
+	DecompressImageParallel( rgba, width, height, 4*width, blocks, flags );
+}
+
+void DecompressImageParallel( u8* rgba, int width, int height, int pitch, void const* blocks, int flags )
+{
+	// fix any bad flags
+	flags = FixFlags( flags );
+
+	// initialise the block input
+	u8 const* sourceBlocks = reinterpret_cast< u8 const* >( blocks );
+	int bytesPerBlock = ( ( flags & kDxt1 ) != 0 ) ? 8 : 16;
+	int bytesPerRow = ( ( width + 3 )/4 )*bytesPerBlock;
+	int blockRows = ( height + 3 )/4;
+	int blockCount = blockRows*( ( width + 3 )/4 );
+
+	// each row of blocks fills its own 4 rows of pixels
+#ifdef _OPENMP
+#	pragma omp parallel for schedule( static ) if( blockCount >= kMinParallelBlocks )
+#endif
+	for( int row = 0; row < blockRows; ++row )
+		DecompressBlockRow( rgba, width, height, pitch, 4*row, sourceBlocks + row*bytesPerRow, flags );
+
+	(void)blockCount;
+}
+
 } // namespace squish
@@ -32,6 +32,7 @@
 #define SQUISH_H
 
 #include <climits>
+#include <cstddef>
 
 //! All squish API functions live in this namespace.
 namespace squish {
@@ -70,11 +71,36 @@ enum
 	kColourMetricUniform = ( 1 << 6 ),
 	
 	//! Weight the colour by alpha during cluster fit (disabled by default).
-	kWeightColourByAlpha = ( 1 << 7 )
+	kWeightColourByAlpha = ( 1 << 7 ),
+
+	//! Range fit first, and cluster fit only the blocks that fitted poorly.
+	kColourAdaptiveFit = ( 1 << 9 ),
+
+	//! The bits holding the error threshold of kColourAdaptiveFit.
+	kAdaptiveFitThresholdMask = ( 0xff << 16 )
 };
 
 // -----------------------------------------------------------------------------
 
+/*! @brief Gives the flags for the error threshold of kColourAdaptiveFit.
+
+	@param error	The root mean square error per colour channel, in steps of 1/255.
+	
+	The blocks whose range fit is off by more than this, under the colour 
+	error metric, are cluster fitted. The error is clamped to [0, 255], and
+	defaults to 0.
+*/
+inline int AdaptiveFitThreshold( int error )
+{
+	if( error < 0 )
+		error = 0;
+	else if( error > 255 )
+		error = 255;
+	return error << 16;
+}
+
+// -----------------------------------------------------------------------------
+
 /*! @brief Compresses a 4x4 block of pixels.
 
 	@param rgba		The rgba values of the 16 source pixels.
@@ -103,6 +129,11 @@ enum
 	weight the colour of each pixel by its alpha value. For images that are
 	rendered using alpha blending, this can significantly increase the 
 	perceived quality.
+	
+	Adding kColourAdaptiveFit to a cluster fit range fits every block first,
+	and cluster fits only those whose error is above the threshold given by
+	squish::AdaptiveFitThreshold. This is much faster on smooth or flat
+	images, for which the range fit is nearly as good.
 */
 void Compress( u8 const* rgba, void* block, int flags );
 
@@ -144,6 +175,11 @@ void Compress( u8 const* rgba, void* block, int flags );
 	weight the colour of each pixel by its alpha value. For images that are
 	rendered using alpha blending, this can significantly increase the 
 	perceived quality.
+	
+	Adding kColourAdaptiveFit to a cluster fit range fits every block first,
+	and cluster fits only those whose error is above the threshold given by
+	squish::AdaptiveFitThreshold. This is much faster on smooth or flat
+	images, for which the range fit is nearly as good.
 */
 void CompressMasked( u8 const* rgba, int mask, void* block, int flags );
 
@@ -217,11 +253,70 @@ int GetStorageRequirements( int width, int height, int flags );
 	rendered using alpha blending, this can significantly increase the 
 	perceived quality.
 	
+	Adding kColourAdaptiveFit to a cluster fit range fits every block first,
+	and cluster fits only those whose error is above the threshold given by
+	squish::AdaptiveFitThreshold. This is much faster on smooth or flat
+	images, for which the range fit is nearly as good.
+	
 	Internally this function calls squish::Compress for each block. To see how
 	much memory is required in the compressed image, use
 	squish::GetStorageRequirements.
+	
+	Blocks whose pixels are all the same (or, under DXT1, all transparent)
+	always compress to the same bytes, so they are compressed once per row
+	of blocks and copied from then on. The number of such blocks is returned.
+*/
+int CompressImage( u8 const* rgba, int width, int height, void* blocks, int flags );
+
+// -----------------------------------------------------------------------------
+
+/*! @brief Compresses an image in memory, with a given distance between rows.
+
+	@param rgba		The first row of pixels of the source.
+	@param width	The width of the source image.
+	@param height	The height of the source image.
+	@param pitch	The distance in bytes from one row of pixels to the next.
+	@param blocks	Storage for the compressed output.
+	@param flags	Compression flags.
+	
+	Behaves as squish::CompressImage, except that row y of the image starts at
+	rgba + y*pitch. A negative pitch, with rgba pointing at the last row in
+	memory, compresses a vertically flipped image.
+*/
+int CompressImage( u8 const* rgba, int width, int height, int pitch, void* blocks, int flags );
+
+// -----------------------------------------------------------------------------
+
+/*! @brief Compresses an image in memory, using multiple threads.
+
+	@param rgba		The pixels of the source.
+	@param width	The width of the source image.
+	@param height	The height of the source image.
+	@param blocks	Storage for the compressed output.
+	@param flags	Compression flags.
+	
+	Behaves exactly as squish::CompressImage, producing the same output, but
+	splits the rows of blocks among threads when built with OpenMP support.
+	Small images are compressed serially.
 */
-void CompressImage( u8 const* rgba, int width, int height, void* blocks, int flags );
+int CompressImageParallel( u8 const* rgba, int width, int height, void* blocks, int flags );
+
+// -----------------------------------------------------------------------------
+
+/*! @brief Compresses (using multiple threads) an image in memory, with a given distance between rows.
+
+	@param rgba		The first row of pixels of the source.
+	@param width	The width of the source image.
+	@param height	The height of the source image.
+	@param pitch	The distance in bytes from one row of pixels to the next.
+	@param blocks	Storage for the compressed output.
+	@param flags	Compression flags.
+	
+	Behaves as squish::CompressImageParallel, except that row y of the image starts at
+	rgba + y*pitch. A negative pitch, with rgba pointing at the last row in
+	memory, compresses a vertically flipped image.
+*/
+int CompressImageParallel( u8 const* rgba, int width, int height, int pitch, void* blocks, int flags );
 
 // -----------------------------------------------------------------------------
 
@@ -242,12 +337,133 @@ void CompressImage( u8 const* rgba, int width, int height, void* blocks, int fla
 	however, DXT1 will be used by default if none is specified. All other flags 
 	are ignored.
 
-	Internally this function calls squish::Decompress for each block.
+	The output is the same as squish::Decompress gives for each block, but 
+	the decoder is specialised for each format, and writes whole rows of 4 
+	pixels straight into the image wherever the blocks fit inside it.
 */
 void DecompressImage( u8* rgba, int width, int height, void const* blocks, int flags );
 
 // -----------------------------------------------------------------------------
 
+/*! @brief Decompresses an image in memory, with a given distance between rows.
+
+	@param rgba		Storage for the first row of decompressed pixels.
+	@param width	The width of the source image.
+	@param height	The height of the source image.
+	@param pitch	The distance in bytes from one row of pixels to the next.
+	@param blocks	The compressed DXT blocks.
+	@param flags	Compression flags.
+	
+	Behaves as squish::DecompressImage, except that row y of the image starts at
+	rgba + y*pitch. A negative pitch, with rgba pointing at the last row in
+	memory, decompresses into a vertically flipped image.
+*/
+void DecompressImage( u8* rgba, int width, int height, int pitch, void const* blocks, int flags );
+
+// -----------------------------------------------------------------------------
+
+/*! @brief Decompresses an image in memory, using multiple threads.
+
+	@param rgba		Storage for the decompressed pixels.
+	@param width	The width of the source image.
+	@param height	The height of the source image.
+	@param blocks	The compressed DXT blocks.
+	@param flags	Compression flags.
+	
+	Behaves exactly as squish::DecompressImage, but splits the rows of blocks
+	among threads when built with OpenMP support. Small images are
+	decompressed serially.
+*/
+void DecompressImageParallel( u8* rgba, int width, int height, void const* blocks, int flags );
+
+// -----------------------------------------------------------------------------
+
+/*! @brief Decompresses (using multiple threads) an image in memory, with a given distance between rows.
+
+	@param rgba		Storage for the first row of decompressed pixels.
+	@param width	The width of the source image.
+	@param height	The height of the source image.
+	@param pitch	The distance in bytes from one row of pixels to the next.
+	@param blocks	The compressed DXT blocks.
+	@param flags	Compression flags.
+	
+	Behaves as squish::DecompressImageParallel, except that row y of the image starts at
+	rgba + y*pitch. A negative pitch, with rgba pointing at the last row in
+	memory, decompresses into a vertically flipped image.
+*/
+void DecompressImageParallel( u8* rgba, int width, int height, int pitch, void const* blocks, int flags );
+
+// -----------------------------------------------------------------------------
+
+enum
+{
+	//! The processor supports SSE2.
+	kCpuSse2 = ( 1 << 0 ),
+
+	//! The processor supports SSE4.1.
+	kCpuSse41 = ( 1 << 1 ),
+
+	//! The processor and the operating system support AVX2.
+	kCpuAvx2 = ( 1 << 2 ),
+
+	//! The processor and the operating system support AVX-512F.
+	kCpuAvx512 = ( 1 << 3 ),
+
+	//! The processor and the operating system support AVX-512BW as well.
+	kCpuAvx512Bw = ( 1 << 4 )
+};
+
+// -----------------------------------------------------------------------------
+
+/*! @brief Gets the instruction sets the compression and decompression kernels may use.
+
+	The processor is queried once, at startup, and the widest kernel squish
+	was built with that it supports is picked for each compression or 
+	decompression. The output is the same whichever kernel is used.
+*/
+int GetCpuFeatures();
+
+// -----------------------------------------------------------------------------
+
+/*! @brief Restricts the instruction sets the compression kernels may use.
+
+	@param features	A combination of kCpuSse2, kCpuSse41, kCpuAvx2, kCpuAvx512 and kCpuAvx512Bw.
+	
+	The features the processor lacks are ignored. This is meant for testing
+	and benchmarking the kernels against each other, and should not be
+	called while compressing.
+*/
+void SetCpuFeatures( int features );
+
+// -----------------------------------------------------------------------------
+
+/*! @brief Sets the memory given to remembering compressed blocks.
+
+	@param bytes	The size of the cache, or 0 to disable it (the default).
+	
+	When enabled, the image compression functions look up every full block 
+	of 16 pixels in a cache shared by all images and threads before 
+	compressing it, so the blocks repeated across mipmaps, atlas sheets and 
+	similar textures are only compressed once. The output is the same either 
+	way. Resizing empties the cache, and should not be done while 
+	compressing.
+*/
+void SetBlockCacheSize( std::size_t bytes );
+
+// -----------------------------------------------------------------------------
+
+//! The number of lookups in the block cache since it was last resized.
+struct BlockCacheStats
+{
+	unsigned long hits;
+	unsigned long misses;
+};
+
+// -----------------------------------------------------------------------------
+
+//! Gets the hits and misses of the block cache, which are zero when it is disabled.
+BlockCacheStats GetBlockCacheStats();
+
 } // namespace squish
 
 #endif // ndef SQUISH_H
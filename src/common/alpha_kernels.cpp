@@ -0,0 +1,282 @@
+/*
+Copyright (C) 2013  simplex
+
+This program is free software; you can redistribute it and/or
+modify it under the terms of the GNU General Public License
+as published by the Free Software Foundation; either version 2
+of the License, or (at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+
+
+
+#include "alpha_kernels.hpp"
+#include "image_operations.hpp"
+
+#ifdef __SSE2__
+#	include <emmintrin.h>
+#endif
+
+#if KTOOLS_BUILD_AVX2 || KTOOLS_BUILD_AVX512BW
+#	ifndef __SSE2__
+#		error "The AVX2 and AVX-512 pixel kernels need the SSE2 ones."
+#	endif
+#	include <squish/squish.h>
+#endif
+
+
+using namespace KTools;
+using namespace KTools::ImOp;
+
+
+/*
+ * Largest (8 bit) alpha zeroing the colour on premultiplication.
+ */
+static const int PREMULTIPLY_CUTOFF = 25;
+
+#ifdef __SSE2__
+
+/*
+ * floor(65536/a), for a quotient estimate at most one below the exact
+ * one (65535 standing in for 1 and 0 for the unused 0).
+ */
+static uint16_t demultiply_reciprocals[256];
+
+static struct DemultiplyReciprocalsInitializer {
+	DemultiplyReciprocalsInitializer() {
+		demultiply_reciprocals[0] = 0;
+		demultiply_reciprocals[1] = 65535;
+		for(unsigned int a = 2; a < 256; a++) {
+			demultiply_reciprocals[a] = uint16_t(65536/a);
+		}
+	}
+} demultiply_reciprocals_initializer;
+
+/*
+ * Lanes holding the alpha of the two pixels in a register of 16 bit
+ * channels.
+ */
+static inline __m128i alphaLanes() {
+	return _mm_set_epi16(-1, 0, 0, 0, -1, 0, 0, 0);
+}
+
+static inline __m128i broadcastAlpha(__m128i v) {
+	v = _mm_shufflelo_epi16(v, _MM_SHUFFLE(3, 3, 3, 3));
+	return _mm_shufflehi_epi16(v, _MM_SHUFFLE(3, 3, 3, 3));
+}
+
+static inline __m128i select(__m128i mask, __m128i a, __m128i b) {
+	return _mm_or_si128( _mm_and_si128(mask, a), _mm_andnot_si128(mask, b) );
+}
+
+/*
+ * Two pixels, as 16 bit channels. (c*a + 127)/255 is c*a/255 rounded,
+ * since it never falls halfway.
+ */
+static inline __m128i premultiplyPair(__m128i v) {
+	const __m128i a = broadcastAlpha(v);
+	const __m128i kept = _mm_cmpgt_epi16(a, _mm_set1_epi16(PREMULTIPLY_CUTOFF));
+
+	__m128i t = _mm_mullo_epi16(v, _mm_and_si128(a, kept));
+	t = _mm_add_epi16(t, _mm_set1_epi16(128));
+	t = _mm_srli_epi16( _mm_add_epi16(t, _mm_srli_epi16(t, 8)), 8 );
+
+	return select(alphaLanes(), v, t);
+}
+
+/*
+ * Two pixels, as 16 bit channels, with the reciprocals of their alphas.
+ * The quotient estimate gets corrected by comparing the remainder with
+ * the alpha, and is then clamped to 255.
+ */
+static inline __m128i demultiplyPair(__m128i v, __m128i m) {
+	const __m128i a = broadcastAlpha(v);
+
+	const __m128i n = _mm_add_epi16( _mm_mullo_epi16(v, _mm_set1_epi16(255)), _mm_srli_epi16(a, 1) );
+	__m128i q = _mm_mulhi_epu16(n, m);
+	const __m128i r = _mm_sub_epi16(n, _mm_mullo_epi16(q, a));
+
+	// r < 2a <= 510, so the signed comparison is safe.
+	q = _mm_add_epi16( _mm_add_epi16(q, _mm_set1_epi16(1)), _mm_cmpgt_epi16(a, r) );
+	q = _mm_sub_epi16( q, _mm_subs_epu16(q, _mm_set1_epi16(255)) );
+
+	const __m128i kept = _mm_or_si128( alphaLanes(), _mm_cmpeq_epi16(a, _mm_setzero_si128()) );
+	return select(kept, v, q);
+}
+
+static inline __m128i reciprocalPair(const uint8_t* p) {
+	const uint16_t m0 = demultiply_reciprocals[p[3]];
+	const uint16_t m1 = demultiply_reciprocals[p[7]];
+	return _mm_set_epi16(m1, m1, m1, m1, m0, m0, m0, m0);
+}
+
+#endif // __SSE2__
+
+#if KTOOLS_BUILD_AVX2 || KTOOLS_BUILD_AVX512BW
+
+const uint16_t* KTools::ImOp::getDemultiplyReciprocals() {
+	return demultiply_reciprocals;
+}
+
+#endif
+
+/*
+ * The widest row kernels built that the processor supports, or NULL.
+ */
+typedef size_t (*row_kernel_t)(uint8_t* row, size_t width);
+
+static row_kernel_t getPremultiplyKernel() {
+#if KTOOLS_BUILD_AVX2 || KTOOLS_BUILD_AVX512BW
+	const int features = squish::GetCpuFeatures();
+#endif
+#if KTOOLS_BUILD_AVX512BW
+	if(features & squish::kCpuAvx512Bw) {
+		return premultiplyAlphaRowAvx512;
+	}
+#endif
+#if KTOOLS_BUILD_AVX2
+	if(features & squish::kCpuAvx2) {
+		return premultiplyAlphaRowAvx2;
+	}
+#endif
+	return NULL;
+}
+
+static row_kernel_t getDemultiplyKernel() {
+#if KTOOLS_BUILD_AVX2 || KTOOLS_BUILD_AVX512BW
+	const int features = squish::GetCpuFeatures();
+#endif
+#if KTOOLS_BUILD_AVX512BW
+	if(features & squish::kCpuAvx512Bw) {
+		return demultiplyAlphaRowAvx512;
+	}
+#endif
+#if KTOOLS_BUILD_AVX2
+	if(features & squish::kCpuAvx2) {
+		return demultiplyAlphaRowAvx2;
+	}
+#endif
+	return NULL;
+}
+
+void KTools::ImOp::premultiplyAlphaRow(uint8_t* row, size_t width) {
+	uint8_t* p = row;
+	size_t j = 0;
+
+	if(const row_kernel_t kernel = getPremultiplyKernel()) {
+		j = kernel(row, width);
+		p += 4*j;
+	}
+
+#ifdef __SSE2__
+	const __m128i zero = _mm_setzero_si128();
+	for(; j + 4 <= width; j += 4, p += 16) {
+		const __m128i v = _mm_loadu_si128( reinterpret_cast<const __m128i*>(p) );
+		const __m128i lo = premultiplyPair( _mm_unpacklo_epi8(v, zero) );
+		const __m128i hi = premultiplyPair( _mm_unpackhi_epi8(v, zero) );
+		_mm_storeu_si128( reinterpret_cast<__m128i*>(p), _mm_packus_epi16(lo, hi) );
+	}
+#endif
+
+	premultiplyPixelAlpha op;
+	for(; j < width; j++, p += 4) {
+		op.call(p);
+	}
+}
+
+void KTools::ImOp::demultiplyAlphaRow(uint8_t* row, size_t width) {
+	uint8_t* p = row;
+	size_t j = 0;
+
+	if(const row_kernel_t kernel = getDemultiplyKernel()) {
+		j = kernel(row, width);
+		p += 4*j;
+	}
+
+#ifdef __SSE2__
+	const __m128i zero = _mm_setzero_si128();
+	for(; j + 4 <= width; j += 4, p += 16) {
+		const __m128i v = _mm_loadu_si128( reinterpret_cast<const __m128i*>(p) );
+		const __m128i lo = demultiplyPair( _mm_unpacklo_epi8(v, zero), reciprocalPair(p) );
+		const __m128i hi = demultiplyPair( _mm_unpackhi_epi8(v, zero), reciprocalPair(p + 8) );
+		_mm_storeu_si128( reinterpret_cast<__m128i*>(p), _mm_packus_epi16(lo, hi) );
+	}
+#endif
+
+	demultiplyPixelAlpha op;
+	for(; j < width; j++, p += 4) {
+		op.call(p);
+	}
+}
+
+#if MAGICKCORE_QUANTUM_DEPTH == 16 && !MAGICKCORE_HDRI_ENABLE && !defined(MAGICKCORE_HDRI_SUPPORT)
+
+/*
+ * Exact integer versions of the double precision ones, over 16 bit
+ * quanta. 6553 is the largest alpha up to 0.1.
+ */
+
+void KTools::ImOp::premultiplyAlphaRow(Magick::PixelPacket* row, size_t width) {
+	Magick::PixelPacket* RESTRICT p = row;
+	for(size_t j = 0; j < width; j++, p++) {
+		const uint32_t a = 65535u - p->opacity;
+		if(a == 65535u) continue;
+		if(a <= 6553u) {
+			p->red = p->green = p->blue = 0;
+			continue;
+		}
+
+		p->red = Magick::Quantum( (p->red*a)/65535u );
+		p->green = Magick::Quantum( (p->green*a)/65535u );
+		p->blue = Magick::Quantum( (p->blue*a)/65535u );
+	}
+}
+
+/*
+ * c*65535/a through a rounded up 32.32 reciprocal, whose error stays
+ * below 1/a.
+ */
+static inline Magick::Quantum demultiplyQuantum(uint32_t c, uint64_t inva) {
+	const uint64_t v = (uint64_t(c)*inva) >> 32;
+	return Magick::Quantum( v > 65535u ? 65535u : v );
+}
+
+void KTools::ImOp::demultiplyAlphaRow(Magick::PixelPacket* row, size_t width) {
+	Magick::PixelPacket* RESTRICT p = row;
+	for(size_t j = 0; j < width; j++, p++) {
+		const uint32_t a = 65535u - p->opacity;
+		if(a == 0 || a == 65535u) continue;
+
+		const uint64_t inva = ((uint64_t(65535u) << 32) + a - 1)/a;
+
+		p->red = demultiplyQuantum(p->red, inva);
+		p->green = demultiplyQuantum(p->green, inva);
+		p->blue = demultiplyQuantum(p->blue, inva);
+	}
+}
+
+#else
+
+void KTools::ImOp::premultiplyAlphaRow(Magick::PixelPacket* row, size_t width) {
+	premultiplyPixelAlpha op;
+	for(size_t j = 0; j < width; j++) {
+		op.call(row++);
+	}
+}
+
+void KTools::ImOp::demultiplyAlphaRow(Magick::PixelPacket* row, size_t width) {
+	demultiplyPixelAlpha op;
+	for(size_t j = 0; j < width; j++) {
+		op.call(row++);
+	}
+}
+
+#endif
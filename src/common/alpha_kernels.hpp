@@ -0,0 +1,69 @@
+/*
+Copyright (C) 2013  simplex
+
+This program is free software; you can redistribute it and/or
+modify it under the terms of the GNU General Public License
+as published by the Free Software Foundation; either version 2
+of the License, or (at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+
+
+#ifndef KTOOLS_ALPHA_KERNELS_HPP
+#define KTOOLS_ALPHA_KERNELS_HPP
+
+#include "ktools_common.hpp"
+
+namespace KTools {
+namespace ImOp {
+	/*
+	 * Row kernels behind premultiplyAlpha and demultiplyAlpha, with the
+	 * same results as the per pixel operations: alpha up to 0.1 (25 in
+	 * 8 bits) zeroes the colour on premultiplication, while fully opaque
+	 * and fully transparent pixels are left alone on demultiplication.
+	 *
+	 * The 8 bit ones (over RGBA pixels) use SSE2 where available, and the
+	 * AVX2 or AVX-512 versions below when built and the processor has
+	 * them (as detected once at startup, see squish::GetCpuFeatures()). The
+	 * Magick ones use integer math when the quantum is 16 bit (and not
+	 * HDRI), falling back to the per pixel operations otherwise.
+	 */
+
+	void premultiplyAlphaRow(uint8_t* row, size_t width);
+	void demultiplyAlphaRow(uint8_t* row, size_t width);
+
+#if KTOOLS_BUILD_AVX2 || KTOOLS_BUILD_AVX512BW
+	/*
+	 * The 256 reciprocals (about 65536/a for an 8 bit alpha a) the
+	 * demultiplication kernels estimate quotients with.
+	 */
+	const uint16_t* getDemultiplyReciprocals();
+#endif
+
+	/*
+	 * The wider kernels only do the leading pixels of a row, in multiples
+	 * of 8 (AVX2) or 16 (AVX-512), returning how many. The rest is left
+	 * to the SSE2 and per pixel code.
+	 */
+#if KTOOLS_BUILD_AVX2
+	size_t premultiplyAlphaRowAvx2(uint8_t* row, size_t width);
+	size_t demultiplyAlphaRowAvx2(uint8_t* row, size_t width);
+#endif
+#if KTOOLS_BUILD_AVX512BW
+	size_t premultiplyAlphaRowAvx512(uint8_t* row, size_t width);
+	size_t demultiplyAlphaRowAvx512(uint8_t* row, size_t width);
+#endif
+
+	void premultiplyAlphaRow(Magick::PixelPacket* row, size_t width);
+	void demultiplyAlphaRow(Magick::PixelPacket* row, size_t width);
+}}
+
+#endif
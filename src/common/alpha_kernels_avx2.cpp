@@ -0,0 +1,148 @@
+/*
+Copyright (C) 2013  simplex
+
+This program is free software; you can redistribute it and/or
+modify it under the terms of the GNU General Public License
+as published by the Free Software Foundation; either version 2
+of the License, or (at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+
+
+
+/*
+ * The AVX2 versions of the 8 bit row kernels, 8 pixels at a time, picked
+ * at runtime (see alpha_kernels.cpp). Built with -mavx2.
+ */
+
+#include "alpha_kernels.hpp"
+
+#if KTOOLS_BUILD_AVX2
+
+#include <immintrin.h>
+
+
+using namespace KTools;
+using namespace KTools::ImOp;
+
+
+/*
+ * Largest (8 bit) alpha zeroing the colour on premultiplication.
+ */
+static const int PREMULTIPLY_CUTOFF = 25;
+
+/*
+ * Lanes (of every 4) holding alpha, as a 16 bit blend mask.
+ */
+static const int ALPHA_LANES = 0x88;
+
+/*
+ * Reads 4 pixels as 16 bit channels.
+ */
+static inline __m256i load4(const uint8_t* p) {
+	return _mm256_cvtepu8_epi16( _mm_loadu_si128(reinterpret_cast<const __m128i*>(p)) );
+}
+
+/*
+ * Writes 8 pixels back from 16 bit channels of at most 255.
+ */
+static inline void store8(uint8_t* p, __m256i lo, __m256i hi) {
+	const __m256i packed = _mm256_permute4x64_epi64( _mm256_packus_epi16(lo, hi), _MM_SHUFFLE(3, 1, 2, 0) );
+	_mm256_storeu_si256( reinterpret_cast<__m256i*>(p), packed );
+}
+
+static inline __m256i broadcastAlpha(__m256i v) {
+	v = _mm256_shufflelo_epi16(v, _MM_SHUFFLE(3, 3, 3, 3));
+	return _mm256_shufflehi_epi16(v, _MM_SHUFFLE(3, 3, 3, 3));
+}
+
+static inline __m256i broadcastLow(__m256i v) {
+	v = _mm256_shufflelo_epi16(v, _MM_SHUFFLE(0, 0, 0, 0));
+	return _mm256_shufflehi_epi16(v, _MM_SHUFFLE(0, 0, 0, 0));
+}
+
+/*
+ * As premultiplyPair in alpha_kernels.cpp, over 4 pixels.
+ */
+static inline __m256i premultiply4(__m256i v) {
+	const __m256i a = broadcastAlpha(v);
+	const __m256i kept = _mm256_cmpgt_epi16(a, _mm256_set1_epi16(PREMULTIPLY_CUTOFF));
+
+	__m256i t = _mm256_mullo_epi16(v, _mm256_and_si256(a, kept));
+	t = _mm256_add_epi16(t, _mm256_set1_epi16(128));
+	t = _mm256_srli_epi16( _mm256_add_epi16(t, _mm256_srli_epi16(t, 8)), 8 );
+
+	return _mm256_blend_epi16(t, v, ALPHA_LANES);
+}
+
+/*
+ * The reciprocals of the alphas of 8 pixels. Each is gathered as the top
+ * half of the 32 bits starting at the entry before it, which keeps the
+ * reads inside the table; fully transparent pixels are left out, being
+ * kept as they are anyway.
+ */
+static inline __m256i gatherReciprocals(const uint8_t* p, const uint16_t* reciprocals) {
+	const __m256i alphas = _mm256_srli_epi32( _mm256_loadu_si256(reinterpret_cast<const __m256i*>(p)), 24 );
+	const __m256i opaque = _mm256_xor_si256( _mm256_cmpeq_epi32(alphas, _mm256_setzero_si256()), _mm256_set1_epi32(-1) );
+	const __m256i previous = _mm256_sub_epi32(alphas, _mm256_set1_epi32(1));
+
+	const __m256i m = _mm256_mask_i32gather_epi32(_mm256_setzero_si256(), reinterpret_cast<const int*>(reciprocals), previous, opaque, 2);
+	return _mm256_srli_epi32(m, 16);
+}
+
+/*
+ * Spreads 4 pixels' reciprocals over their 16 bit channels.
+ */
+static inline __m256i spreadReciprocals(__m128i m) {
+	return broadcastLow( _mm256_cvtepu32_epi64(m) );
+}
+
+/*
+ * As demultiplyPair in alpha_kernels.cpp, over 4 pixels.
+ */
+static inline __m256i demultiply4(__m256i v, __m256i m) {
+	const __m256i a = broadcastAlpha(v);
+
+	const __m256i n = _mm256_add_epi16( _mm256_mullo_epi16(v, _mm256_set1_epi16(255)), _mm256_srli_epi16(a, 1) );
+	__m256i q = _mm256_mulhi_epu16(n, m);
+	const __m256i r = _mm256_sub_epi16(n, _mm256_mullo_epi16(q, a));
+
+	q = _mm256_add_epi16( _mm256_add_epi16(q, _mm256_set1_epi16(1)), _mm256_cmpgt_epi16(a, r) );
+	q = _mm256_min_epu16(q, _mm256_set1_epi16(255));
+
+	const __m256i transparent = _mm256_cmpeq_epi16(a, _mm256_setzero_si256());
+	return _mm256_blend_epi16( _mm256_blendv_epi8(q, v, transparent), v, ALPHA_LANES );
+}
+
+
+size_t KTools::ImOp::premultiplyAlphaRowAvx2(uint8_t* row, size_t width) {
+	uint8_t* p = row;
+	size_t j = 0;
+	for(; j + 8 <= width; j += 8, p += 32) {
+		store8( p, premultiply4(load4(p)), premultiply4(load4(p + 16)) );
+	}
+	return j;
+}
+
+size_t KTools::ImOp::demultiplyAlphaRowAvx2(uint8_t* row, size_t width) {
+	const uint16_t* reciprocals = getDemultiplyReciprocals();
+
+	uint8_t* p = row;
+	size_t j = 0;
+	for(; j + 8 <= width; j += 8, p += 32) {
+		const __m256i m = gatherReciprocals(p, reciprocals);
+		store8( p, demultiply4(load4(p), spreadReciprocals(_mm256_castsi256_si128(m))),
+			demultiply4(load4(p + 16), spreadReciprocals(_mm256_extracti128_si256(m, 1))) );
+	}
+	return j;
+}
+
+#endif // KTOOLS_BUILD_AVX2
@@ -0,0 +1,155 @@
+/*
+Copyright (C) 2013  simplex
+
+This program is free software; you can redistribute it and/or
+modify it under the terms of the GNU General Public License
+as published by the Free Software Foundation; either version 2
+of the License, or (at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+
+
+
+/*
+ * The AVX-512 versions of the 8 bit row kernels, 16 pixels at a time,
+ * picked at runtime (see alpha_kernels.cpp). The 16 bit lanes need
+ * AVX-512BW. Built with -mavx512f -mavx512bw.
+ */
+
+#include "alpha_kernels.hpp"
+
+#if KTOOLS_BUILD_AVX512BW
+
+// GCC's AVX-512 intrinsics start from deliberately uninitialized vectors.
+#if defined(__GNUC__) && !defined(__clang__)
+#	pragma GCC diagnostic ignored "-Wuninitialized"
+#	pragma GCC diagnostic ignored "-Wmaybe-uninitialized"
+#endif
+
+#include <immintrin.h>
+
+
+using namespace KTools;
+using namespace KTools::ImOp;
+
+
+/*
+ * Largest (8 bit) alpha zeroing the colour on premultiplication.
+ */
+static const int PREMULTIPLY_CUTOFF = 25;
+
+/*
+ * Lanes (of every 4) holding alpha, as a 16 bit lane mask.
+ */
+static const __mmask32 ALPHA_LANES = 0x88888888u;
+
+/*
+ * Reads 8 pixels as 16 bit channels.
+ */
+static inline __m512i load8(const uint8_t* p) {
+	return _mm512_cvtepu8_epi16( _mm256_loadu_si256(reinterpret_cast<const __m256i*>(p)) );
+}
+
+/*
+ * Writes 8 pixels back from 16 bit channels of at most 255.
+ */
+static inline void store8(uint8_t* p, __m512i v) {
+	_mm256_storeu_si256( reinterpret_cast<__m256i*>(p), _mm512_cvtepi16_epi8(v) );
+}
+
+static inline __m512i broadcastAlpha(__m512i v) {
+	v = _mm512_shufflelo_epi16(v, _MM_SHUFFLE(3, 3, 3, 3));
+	return _mm512_shufflehi_epi16(v, _MM_SHUFFLE(3, 3, 3, 3));
+}
+
+static inline __m512i broadcastLow(__m512i v) {
+	v = _mm512_shufflelo_epi16(v, _MM_SHUFFLE(0, 0, 0, 0));
+	return _mm512_shufflehi_epi16(v, _MM_SHUFFLE(0, 0, 0, 0));
+}
+
+/*
+ * As premultiplyPair in alpha_kernels.cpp, over 8 pixels.
+ */
+static inline __m512i premultiply8(__m512i v) {
+	const __m512i a = broadcastAlpha(v);
+	const __mmask32 kept = _mm512_cmpgt_epi16_mask(a, _mm512_set1_epi16(PREMULTIPLY_CUTOFF));
+
+	__m512i t = _mm512_mullo_epi16(v, _mm512_maskz_mov_epi16(kept, a));
+	t = _mm512_add_epi16(t, _mm512_set1_epi16(128));
+	t = _mm512_srli_epi16( _mm512_add_epi16(t, _mm512_srli_epi16(t, 8)), 8 );
+
+	return _mm512_mask_blend_epi16(ALPHA_LANES, t, v);
+}
+
+/*
+ * The reciprocals of the alphas of 16 pixels. Each is gathered as the top
+ * half of the 32 bits starting at the entry before it, which keeps the
+ * reads inside the table; fully transparent pixels are left out, being
+ * kept as they are anyway.
+ */
+static inline __m512i gatherReciprocals(const uint8_t* p, const uint16_t* reciprocals) {
+	const __m512i alphas = _mm512_srli_epi32( _mm512_loadu_si512(p), 24 );
+	const __mmask16 opaque = _mm512_test_epi32_mask(alphas, alphas);
+	const __m512i previous = _mm512_sub_epi32(alphas, _mm512_set1_epi32(1));
+
+	return _mm512_srli_epi32( _mm512_mask_i32gather_epi32(_mm512_setzero_si512(), opaque, previous, reciprocals, 2), 16 );
+}
+
+/*
+ * Spreads 8 pixels' reciprocals over their 16 bit channels.
+ */
+static inline __m512i spreadReciprocals(__m256i m) {
+	return broadcastLow( _mm512_cvtepu32_epi64(m) );
+}
+
+/*
+ * As demultiplyPair in alpha_kernels.cpp, over 8 pixels.
+ */
+static inline __m512i demultiply8(__m512i v, __m512i m) {
+	const __m512i a = broadcastAlpha(v);
+
+	const __m512i n = _mm512_add_epi16( _mm512_mullo_epi16(v, _mm512_set1_epi16(255)), _mm512_srli_epi16(a, 1) );
+	const __m512i q = _mm512_mulhi_epu16(n, m);
+	const __m512i r = _mm512_sub_epi16(n, _mm512_mullo_epi16(q, a));
+
+	// q + 1, unless the remainder is below the alpha.
+	const __m512i corrected = _mm512_mask_blend_epi16( _mm512_cmpgt_epi16_mask(a, r), _mm512_add_epi16(q, _mm512_set1_epi16(1)), q );
+	const __m512i clamped = _mm512_min_epu16(corrected, _mm512_set1_epi16(255));
+
+	const __mmask32 kept = ALPHA_LANES | _mm512_cmpeq_epi16_mask(a, _mm512_setzero_si512());
+	return _mm512_mask_blend_epi16(kept, clamped, v);
+}
+
+
+size_t KTools::ImOp::premultiplyAlphaRowAvx512(uint8_t* row, size_t width) {
+	uint8_t* p = row;
+	size_t j = 0;
+	for(; j + 16 <= width; j += 16, p += 64) {
+		store8( p, premultiply8(load8(p)) );
+		store8( p + 32, premultiply8(load8(p + 32)) );
+	}
+	return j;
+}
+
+size_t KTools::ImOp::demultiplyAlphaRowAvx512(uint8_t* row, size_t width) {
+	const uint16_t* reciprocals = getDemultiplyReciprocals();
+
+	uint8_t* p = row;
+	size_t j = 0;
+	for(; j + 16 <= width; j += 16, p += 64) {
+		const __m512i m = gatherReciprocals(p, reciprocals);
+		store8( p, demultiply8(load8(p), spreadReciprocals(_mm512_castsi512_si256(m))) );
+		store8( p + 32, demultiply8(load8(p + 32), spreadReciprocals(_mm512_extracti64x4_epi64(m, 1))) );
+	}
+	return j;
+}
+
+#endif // KTOOLS_BUILD_AVX512BW
@@ -148,9 +148,7 @@ namespace KTools {
 				KTEX::File tex;
 
 				VirtualPath tex_path = basedir/std::string(texture_filename);
-				std::istream* in = tex_path.open_in(std::ifstream::binary);
-				tex.load( *in, std::min(0, verbosity) );
-				delete in;
+				tex.loadFrom( tex_path, -1 );
 
 				final_image = parent().getDecompressor()(tex);
 			}
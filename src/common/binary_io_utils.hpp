@@ -173,6 +173,10 @@ namespace KTools {
 			return false;
 		}
 
+		bool hasSourceAsTarget() const {
+			return source_endianness == target_endianness;
+		}
+
 		void copySource(const BinIOHelper& h) {
 			source_endianness = h.source_endianness;
 		}
@@ -320,6 +324,61 @@ namespace KTools {
 	};
 
 	typedef BinIOHelper BinaryIOHelper;
+
+	/*
+	 * Stream buffer over a fixed block of memory, allowing in memory data
+	 * (such as a mapped file) to be parsed through the stream interface
+	 * without copying it.
+	 */
+	class MemoryStreamBuffer : public std::streambuf {
+	public:
+		MemoryStreamBuffer(char* begin, size_t size) {
+			setg(begin, begin, begin + size);
+			setp(begin, begin + size);
+		}
+
+		char* base() const {
+			return eback();
+		}
+
+	protected:
+		virtual pos_type seekoff(off_type off, std::ios_base::seekdir dir, std::ios_base::openmode which = std::ios_base::in | std::ios_base::out) {
+			const off_type size = off_type(egptr() - eback());
+
+			off_type ref;
+			if(dir == std::ios_base::beg) {
+				ref = 0;
+			}
+			else if(dir == std::ios_base::end) {
+				ref = size;
+			}
+			else if(which & std::ios_base::in) {
+				ref = off_type(gptr() - eback());
+			}
+			else {
+				ref = off_type(pptr() - pbase());
+			}
+
+			const off_type target = ref + off;
+			if(target < 0 || target > size) {
+				return pos_type(off_type(-1));
+			}
+
+			if(which & std::ios_base::in) {
+				setg(eback(), eback() + target, egptr());
+			}
+			if(which & std::ios_base::out) {
+				setp(pbase(), epptr());
+				pbump(int(target));
+			}
+
+			return pos_type(target);
+		}
+
+		virtual pos_type seekpos(pos_type pos, std::ios_base::openmode which = std::ios_base::in | std::ios_base::out) {
+			return seekoff(off_type(pos), std::ios_base::beg, which);
+		}
+	};
 }
 
 #endif
@@ -356,6 +356,25 @@ namespace Compat {
 			return inner_stat(buf) == 0;
 		}
 
+		/*
+		 * Returns whether both paths resolve to the same existing file.
+		 *
+		 * Under Unix this compares device and inode numbers, so hard links
+		 * count as the same file.
+		 */
+		bool isSameFileAs(const PathAbstraction& p) const {
+#ifdef IS_WINDOWS
+			PathAbstraction a(*this), b(p);
+			return exists() && a.makeAbsolute() && b.makeAbsolute() && a == b;
+#else
+			stat_t mybuf, otherbuf;
+			if(inner_stat(mybuf) != 0 || p.inner_stat(otherbuf) != 0) {
+				return false;
+			}
+			return mybuf.st_dev == otherbuf.st_dev && mybuf.st_ino == otherbuf.st_ino;
+#endif
+		}
+
 		/*
 		 * If p doesn't exist and *this does, returns true.
 		 * Likewise, if *this doesn't exist and p does, returns false.
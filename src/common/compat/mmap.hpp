@@ -0,0 +1,236 @@
+/*
+ * Header-only library abstracting memory mapped files.
+ */
+
+#ifndef KTOOLS_COMPAT_MMAP_HPP
+#define KTOOLS_COMPAT_MMAP_HPP
+
+#include "compat/common.hpp"
+#include "compat/posix.hpp"
+
+#include <string>
+#include <cstddef>
+#include <algorithm>
+#include <cerrno>
+
+#ifdef IS_WINDOWS
+#	include <windows.h>
+#else
+extern "C" {
+#	include <sys/types.h>
+#	include <sys/mman.h>
+#	include <fcntl.h>
+#	include <unistd.h>
+}
+#endif
+
+namespace Compat {
+	/*
+	 * A memory mapping of a whole file.
+	 *
+	 * Files mapped through open() get a private (copy on write) mapping:
+	 * the mapped memory is writable, but changes are never carried back
+	 * to the file, the pages touched being copied on demand.
+	 *
+	 * Files mapped through create() get a shared mapping, so that writes
+	 * to the memory end up in the file.
+	 */
+	class MappedFile {
+		char* base;
+		size_t len;
+
+#ifdef IS_WINDOWS
+		HANDLE file_handle;
+		HANDLE map_handle;
+#endif
+
+		MappedFile(const MappedFile&);
+		MappedFile& operator=(const MappedFile&);
+
+	public:
+		MappedFile() : base(NULL), len(0)
+#ifdef IS_WINDOWS
+			, file_handle(INVALID_HANDLE_VALUE), map_handle(NULL)
+#endif
+		{}
+
+		~MappedFile() {
+			close();
+		}
+
+		bool isOpen() const {
+			return base != NULL;
+		}
+
+		char* data() const {
+			return base;
+		}
+
+		size_t size() const {
+			return len;
+		}
+
+		/*
+		 * Returns false if the file could not be mapped (including
+		 * the case of an empty file), leaving errno set accordingly
+		 * under Unix.
+		 */
+		bool open(const std::string& path) {
+			close();
+
+#ifdef IS_WINDOWS
+			file_handle = CreateFileA(path.c_str(), GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL);
+			if(file_handle == INVALID_HANDLE_VALUE) {
+				return false;
+			}
+
+			LARGE_INTEGER filesize;
+			if(!GetFileSizeEx(file_handle, &filesize) || filesize.QuadPart == 0 || ULONGLONG(filesize.QuadPart) > ULONGLONG(size_t(-1))) {
+				close();
+				return false;
+			}
+
+			map_handle = CreateFileMappingA(file_handle, NULL, PAGE_WRITECOPY, 0, 0, NULL);
+			if(map_handle == NULL) {
+				close();
+				return false;
+			}
+
+			void* p = MapViewOfFile(map_handle, FILE_MAP_COPY, 0, 0, 0);
+			if(p == NULL) {
+				close();
+				return false;
+			}
+
+			base = static_cast<char*>(p);
+			len = size_t(filesize.QuadPart);
+#else
+			const int fd = ::open(path.c_str(), O_RDONLY);
+			if(fd < 0) {
+				return false;
+			}
+
+			struct stat buf;
+			if(::fstat(fd, &buf) != 0 || !S_ISREG(buf.st_mode) || buf.st_size <= 0) {
+				::close(fd);
+				return false;
+			}
+
+			void* p = ::mmap(NULL, size_t(buf.st_size), PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, 0);
+
+			// The mapping holds its own reference to the file.
+			::close(fd);
+
+			if(p == MAP_FAILED) {
+				return false;
+			}
+
+			base = static_cast<char*>(p);
+			len = size_t(buf.st_size);
+#endif
+			return true;
+		}
+
+		/*
+		 * Creates (or truncates) the file, sets its size and maps it
+		 * for writing. Returns false on failure, as open().
+		 */
+		bool create(const std::string& path, size_t size) {
+			close();
+
+			if(size == 0) {
+				return false;
+			}
+
+#ifdef IS_WINDOWS
+			file_handle = CreateFileA(path.c_str(), GENERIC_READ | GENERIC_WRITE, 0, NULL, CREATE_ALWAYS, FILE_ATTRIBUTE_NORMAL, NULL);
+			if(file_handle == INVALID_HANDLE_VALUE) {
+				return false;
+			}
+
+			const ULONGLONG size64 = ULONGLONG(size);
+			map_handle = CreateFileMappingA(file_handle, NULL, PAGE_READWRITE, DWORD(size64 >> 32), DWORD(size64 & 0xffffffff), NULL);
+			if(map_handle == NULL) {
+				close();
+				return false;
+			}
+
+			void* p = MapViewOfFile(map_handle, FILE_MAP_WRITE, 0, 0, size);
+			if(p == NULL) {
+				close();
+				return false;
+			}
+#else
+			const int fd = ::open(path.c_str(), O_RDWR | O_CREAT | O_TRUNC, 0666);
+			if(fd < 0) {
+				return false;
+			}
+
+#ifdef HAVE_POSIX_FALLOCATE
+			/*
+			 * ftruncate() alone leaves a sparse file, and running out of
+			 * disk space while writing to its mapping raises SIGBUS.
+			 * Reserving the blocks upfront turns that into a failure here,
+			 * which callers handle by writing through a stream instead.
+			 */
+			const int fallocate_err = ::posix_fallocate(fd, 0, off_t(size));
+			if(fallocate_err != 0) {
+				::close(fd);
+				errno = fallocate_err;
+				return false;
+			}
+#else
+			if(::ftruncate(fd, off_t(size)) != 0) {
+				::close(fd);
+				return false;
+			}
+#endif
+
+			void* p = ::mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+
+			::close(fd);
+
+			if(p == MAP_FAILED) {
+				return false;
+			}
+#endif
+			base = static_cast<char*>(p);
+			len = size;
+
+			return true;
+		}
+
+		void close() {
+#ifdef IS_WINDOWS
+			if(base != NULL) {
+				UnmapViewOfFile(base);
+			}
+			if(map_handle != NULL) {
+				CloseHandle(map_handle);
+				map_handle = NULL;
+			}
+			if(file_handle != INVALID_HANDLE_VALUE) {
+				CloseHandle(file_handle);
+				file_handle = INVALID_HANDLE_VALUE;
+			}
+#else
+			if(base != NULL) {
+				::munmap(base, len);
+			}
+#endif
+			base = NULL;
+			len = 0;
+		}
+
+		void swap(MappedFile& m) {
+			std::swap(base, m.base);
+			std::swap(len, m.len);
+#ifdef IS_WINDOWS
+			std::swap(file_handle, m.file_handle);
+			std::swap(map_handle, m.map_handle);
+#endif
+		}
+	};
+}
+
+#endif
@@ -87,6 +87,10 @@ namespace KTools {
 #endif
 		}
 
+		bool isRegular() const {
+			return getVirtualDirectory().getType() == VirtualDirectory::REGULAR;
+		}
+
 		bool isZipArchive() const {
 #if defined(HAVE_LIBZIP)
 			return hasExtension("zip") && super::exists();
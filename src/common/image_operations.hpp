@@ -20,7 +20,11 @@ along with this program.  If not, see <http://www.gnu.org/licenses/>.
 #define KTOOLS_IMAGE_OPERATIONS_HPP
 
 #include "ktools_common.hpp"
+#include "metaprogramming.hpp"
 #include "compat.hpp"
+#include "rgba_image.hpp"
+#include "alpha_kernels.hpp"
+#include "noise_reduction.hpp"
 #include <functional>
 
 namespace KTools {
@@ -94,6 +98,8 @@ namespace ImOp {
 
 	typedef operation_t<Magick::PixelPacket*> pixel_operation_t;
 
+	typedef operation_t<RGBAImage&> rgba_image_operation_t;
+
 	///
 
 	template<class Op>
@@ -208,6 +214,113 @@ namespace ImOp {
 
 	///
 
+	/*
+	 * A native image operation mapping each row of pixels independently
+	 * of the others. An operation_chain fuses consecutive ones into a
+	 * single pass over the image, so callRow() may be run on different
+	 * rows concurrently.
+	 */
+	class row_operation_t : public rgba_image_operation_t {
+	public:
+		virtual void callRow(RGBAImage::byte_t* row, size_t width) const = 0;
+
+		virtual void call(RGBAImage& img) const {
+			const size_t w = img.columns(), h = img.rows();
+			for(size_t i = 0; i < h; i++) {
+				callRow(img.row(i), w);
+			}
+		}
+	};
+
+	// Picks the fusable stages when they are pushed onto a chain.
+	inline const row_operation_t* asRowOperation(const row_operation_t* op) {
+		return op;
+	}
+
+	inline const row_operation_t* asRowOperation(const void*) {
+		return NULL;
+	}
+
+	/*
+	 * Whether T derives from row_operation_t.
+	 */
+	template<typename T>
+	class IsRowOperation {
+		typedef char yes_t;
+		typedef char (&no_t)[2];
+
+		static yes_t test(const row_operation_t*);
+		static no_t test(const void*);
+
+	public:
+		static const bool value = (sizeof(test(static_cast<const T*>(NULL))) == sizeof(yes_t));
+	};
+
+	/*
+	 * Runs every operation over a row before moving on to the next one,
+	 * while the row is still in cache.
+	 */
+	inline void callFused(RGBAImage& img, const std::vector<const row_operation_t*>& ops) {
+		const long h = long(img.rows());
+		const size_t w = img.columns();
+		const size_t n = ops.size();
+
+#ifdef _OPENMP
+		static const size_t PARALLEL_MIN_PIXELS = 256*256;
+#	pragma omp parallel for schedule(static) if(w*size_t(h) >= PARALLEL_MIN_PIXELS)
+#endif
+		for(long i = 0; i < h; i++) {
+			RGBAImage::byte_t* row = img.row(size_t(i));
+			for(size_t k = 0; k < n; k++) {
+				ops[k]->callRow(row, w);
+			}
+		}
+	}
+
+	/*
+	 * Runs the stages of an operation_chain in order. Only native images
+	 * have fusable stages, so this is specialized for them below.
+	 */
+	template<typename argument_type>
+	struct chain_runner {
+		static const bool fuses_rows = false;
+
+		template<typename const_iterator>
+		static void run(argument_type arg, const_iterator it, const_iterator end) {
+			for(; it != end; ++it) {
+				it->ref.call(arg);
+			}
+		}
+	};
+
+	template<>
+	struct chain_runner<RGBAImage&> {
+		static const bool fuses_rows = true;
+
+		/*
+		 * Each run of consecutive fusable stages takes a single pass over
+		 * the image.
+		 */
+		template<typename const_iterator>
+		static void run(RGBAImage& img, const_iterator it, const_iterator end) {
+			std::vector<const row_operation_t*> fused;
+
+			while(it != end) {
+				if(it->rowwise == NULL) {
+					it->ref.call(img);
+					++it;
+					continue;
+				}
+
+				fused.clear();
+				for(; it != end && it->rowwise != NULL; ++it) {
+					fused.push_back(it->rowwise);
+				}
+				callFused(img, fused);
+			}
+		}
+	};
+
 	template<typename argument_type>
 	class operation_chain : public operation_t<argument_type> {
 	public:
@@ -215,7 +328,18 @@ namespace ImOp {
 		typedef operation_ref_t<element_type> reference_type;
 
 	private:
-		typedef std::deque<reference_type> chain_t;
+		typedef chain_runner<argument_type> runner_t;
+
+		struct stage_t {
+			reference_type ref;
+
+			// Non null if the stage is fusable (on native images only).
+			const row_operation_t* rowwise;
+
+			stage_t(const reference_type& _ref, const row_operation_t* _rowwise) : ref(_ref), rowwise(_rowwise) {}
+		};
+
+		typedef std::deque<stage_t> chain_t;
 		typedef typename chain_t::iterator iterator;
 		typedef typename chain_t::const_iterator const_iterator;
 
@@ -233,19 +357,43 @@ namespace ImOp {
 		}
 
 		virtual void call(argument_type arg) const {
-			for(const_iterator it = chain.begin(); it != chain.end(); ++it) {
-				it->call(arg);
-			}
+			runner_t::run(arg, chain.begin(), chain.end());
 		}
 
+		/*
+		 * Row operations work on native images, so pushing one onto any
+		 * other chain doesn't compile.
+		 */
 		template<typename derivative_type>
 		void push_back(const derivative_type* f) {
-			chain.push_back( reference_type(f) );
+			staticAssert< runner_t::fuses_rows || !IsRowOperation<derivative_type>::value >();
+			chain.push_back( stage_t(reference_type(f), runner_t::fuses_rows ? asRowOperation(f) : NULL) );
 		}
 
 		template<typename derivative_type>
 		void push_back(const derivative_type& f) {
-			chain.push_back( reference_type::copy(f) );
+			staticAssert< runner_t::fuses_rows || !IsRowOperation<derivative_type>::value >();
+			derivative_type* op = new derivative_type(f);
+			chain.push_back( stage_t(reference_type(op), runner_t::fuses_rows ? asRowOperation(op) : NULL) );
+		}
+
+		inline size_t size() const {
+			return chain.size();
+		}
+
+		/*
+		 * Number of passes call() takes over its argument.
+		 */
+		size_t passes() const {
+			size_t n = 0;
+			for(const_iterator it = chain.begin(); it != chain.end(); ++it) {
+				const_iterator next = it;
+				++next;
+				if(it->rowwise == NULL || next == chain.end() || next->rowwise == NULL) {
+					n++;
+				}
+			}
+			return n;
 		}
 
 		operation_chain& operator<<(const element_type* f) {
@@ -259,6 +407,8 @@ namespace ImOp {
 
 	typedef operation_chain<KTEX::File&> ktex_operation_chain;
 
+	typedef operation_chain<RGBAImage&> rgba_image_operation_chain;
+
 	///
 
 	class read : public unary_operation_t {
@@ -353,6 +503,23 @@ namespace ImOp {
 			p->green = multiplyQuantum(p->green, a);
 			p->blue = multiplyQuantum(p->blue, a);
 		}
+
+		/*
+		 * The same over an RGBA8 pixel, with the alpha cutoff of 0.1
+		 * falling at 25 and the product rounded.
+		 */
+		void call(RGBAImage::byte_t* p) const {
+			const unsigned int a = p[3];
+			if(a == 255) return;
+			if(a <= 25) {
+				p[0] = p[1] = p[2] = 0;
+				return;
+			}
+
+			for(int c = 0; c < 3; c++) {
+				p[c] = RGBAImage::byte_t( (p[c]*a + 127)/255 );
+			}
+		}
 	};
 
 	class demultiplyPixelAlpha : public pixel_operation_t {
@@ -369,12 +536,79 @@ namespace ImOp {
 			p->green = multiplyQuantum(p->green, inva);
 			p->blue = multiplyQuantum(p->blue, inva);
 		}
+
+		/*
+		 * The same over an RGBA8 pixel, with the quotient rounded.
+		 */
+		void call(RGBAImage::byte_t* p) const {
+			const unsigned int a = p[3];
+			if(a == 0 || a == 255) return;
+
+			for(int c = 0; c < 3; c++) {
+				const unsigned int v = (p[c]*255 + a/2)/a;
+				p[c] = RGBAImage::byte_t( v > 255 ? 255 : v );
+			}
+		}
 	};
 
+	/*
+	 * Maps the pixel operation over n consecutive pixels. Operations with
+	 * row kernels overload these.
+	 */
+	template<typename PixelOperation>
+	inline void mapPixels(const PixelOperation& op, Magick::PixelPacket* RESTRICT p, size_t n) {
+		for(size_t j = 0; j < n; j++) {
+			op(p++);
+		}
+	}
+
+	template<typename PixelOperation>
+	inline void mapPixels(const PixelOperation& op, RGBAImage::byte_t* RESTRICT p, size_t n) {
+		for(size_t j = 0; j < n; j++, p += 4) {
+			op.call(p);
+		}
+	}
+
+	inline void mapPixels(const premultiplyPixelAlpha&, Magick::PixelPacket* p, size_t n) {
+		premultiplyAlphaRow(p, n);
+	}
+
+	inline void mapPixels(const premultiplyPixelAlpha&, RGBAImage::byte_t* p, size_t n) {
+		premultiplyAlphaRow(p, n);
+	}
+
+	inline void mapPixels(const demultiplyPixelAlpha&, Magick::PixelPacket* p, size_t n) {
+		demultiplyAlphaRow(p, n);
+	}
+
+	inline void mapPixels(const demultiplyPixelAlpha&, RGBAImage::byte_t* p, size_t n) {
+		demultiplyAlphaRow(p, n);
+	}
+
+	/*
+	 * Maps the pixel operation over the rows of a native image. Being a
+	 * row operation, it is fused with its neighbours in an
+	 * operation_chain.
+	 */
+	template<typename PixelOperation>
+	class pixelRowMap : public row_operation_t {
+		PixelOperation op;
+	public:
+		virtual void callRow(RGBAImage::byte_t* row, size_t width) const {
+			mapPixels(op, row, width);
+		}
+	};
+
+	/*
+	 * Maps the pixel operation over a Magick image or, through
+	 * pixelRowMap, over a native one.
+	 */
 	template<typename PixelOperation>
 	class pixelMap : public image_operation_t {
 		PixelOperation op;
 	public:
+		using image_operation_t::operator();
+
 		virtual void call(Magick::Image& img) const {
 			using namespace Magick;
 			img.type(TrueColorMatteType);
@@ -383,18 +617,18 @@ namespace ImOp {
 			Pixels view(img);
 
 			const size_t w = img.columns(), h = img.rows();
-			{
-				PixelPacket * RESTRICT p = view.get(0, 0, w, h);
-
-				for(size_t i = 0; i < h; i++) {
-					for(size_t j = 0; j < w; j++) {
-						op(p++);
-					}
-				}
-			}
+			mapPixels(op, view.get(0, 0, w, h), w*h);
 
 			view.sync();
 		}
+
+		void call(RGBAImage& img) const {
+			pixelRowMap<PixelOperation>()(img);
+		}
+
+		void operator()(RGBAImage& img) const {
+			call(img);
+		}
 	};
 
 	/*
@@ -410,10 +644,25 @@ namespace ImOp {
 
 	class demultiplyAlpha : public pixelMap<demultiplyPixelAlpha> {};
 
+	// Fusable versions, for native image chains.
+	typedef pixelRowMap<premultiplyPixelAlpha> premultiplyAlphaRows;
+
+	typedef pixelRowMap<demultiplyPixelAlpha> demultiplyAlphaRows;
+
 	class cleanNoise : public image_operation_t {
 	public:
+		using image_operation_t::operator();
+
 		cleanNoise() {}
 
+		void call(RGBAImage& img) const {
+			cleanImageNoise(img);
+		}
+
+		void operator()(RGBAImage& img) const {
+			call(img);
+		}
+
 		virtual void call(Magick::Image& img) const {
 			using namespace Magick;
 
@@ -0,0 +1,378 @@
+/*
+Copyright (C) 2013  simplex
+
+This program is free software; you can redistribute it and/or
+modify it under the terms of the GNU General Public License
+as published by the Free Software Foundation; either version 2
+of the License, or (at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+
+#include "ktex/ktex.hpp"
+#include "binary_io_utils.hpp"
+
+#include <cstring>
+
+
+using namespace KTools;
+using namespace KTools::KTEX;
+
+
+static uint32_t makeFourCC(const char* s) {
+	return uint32_t((unsigned char)s[0]) | (uint32_t((unsigned char)s[1]) << 8) | (uint32_t((unsigned char)s[2]) << 16) | (uint32_t((unsigned char)s[3]) << 24);
+}
+
+/*
+ * Compared with the rawFourCC() of the first 4 bytes of a file.
+ */
+static const uint32_t DDS_MAGIC_NUMBER = makeFourCC("DDS ");
+
+/*
+ * The four character code of an integer read raw (in native order).
+ */
+static uint32_t rawFourCC(uint32_t n) {
+	char s[4];
+	std::memcpy(s, &n, 4);
+	return makeFourCC(s);
+}
+
+static const uint32_t DDS_HEADER_SIZE = 124;
+static const uint32_t DDS_PIXELFORMAT_SIZE = 32;
+
+// dwFlags
+static const uint32_t DDSD_MIPMAPCOUNT = 0x20000;
+static const uint32_t DDSD_DEPTH = 0x800000;
+
+// ddspf.dwFlags
+static const uint32_t DDPF_FOURCC = 0x4;
+
+// dwCaps2
+static const uint32_t DDSCAPS2_CUBEMAP = 0x200;
+static const uint32_t DDSCAPS2_VOLUME = 0x200000;
+
+// DXGI formats (for the DX10 extended header).
+static const uint32_t DXGI_FORMAT_BC1_TYPELESS = 70;
+static const uint32_t DXGI_FORMAT_BC1_UNORM_SRGB = 72;
+static const uint32_t DXGI_FORMAT_BC2_TYPELESS = 73;
+static const uint32_t DXGI_FORMAT_BC2_UNORM_SRGB = 75;
+static const uint32_t DXGI_FORMAT_BC3_TYPELESS = 76;
+static const uint32_t DXGI_FORMAT_BC3_UNORM_SRGB = 78;
+
+static const uint32_t D3D10_RESOURCE_DIMENSION_TEXTURE2D = 3;
+static const uint32_t D3D10_RESOURCE_MISC_TEXTURECUBE = 0x4;
+
+// miscFlags2 of the DX10 extended header.
+static const uint32_t DDS_ALPHA_MODE_MASK = 0x7;
+static const uint32_t DDS_ALPHA_MODE_PREMULTIPLIED = 2;
+
+/*
+ * Returns the name of the KTEX compression matching the DDS pixel format,
+ * or NULL if there is none.
+ */
+static const char* getDDSCompression(uint32_t fourcc, const Maybe<uint32_t>& dxgi_format) {
+	if(dxgi_format != nil) {
+		const uint32_t f = dxgi_format.value();
+		if(DXGI_FORMAT_BC1_TYPELESS <= f && f <= DXGI_FORMAT_BC1_UNORM_SRGB) {
+			return "DXT1";
+		}
+		if(DXGI_FORMAT_BC2_TYPELESS <= f && f <= DXGI_FORMAT_BC2_UNORM_SRGB) {
+			return "DXT3";
+		}
+		if(DXGI_FORMAT_BC3_TYPELESS <= f && f <= DXGI_FORMAT_BC3_UNORM_SRGB) {
+			return "DXT5";
+		}
+		return NULL;
+	}
+
+	if(fourcc == makeFourCC("DXT1")) {
+		return "DXT1";
+	}
+	// DXT2 and DXT4 are the premultiplied alpha variants.
+	if(fourcc == makeFourCC("DXT2") || fourcc == makeFourCC("DXT3")) {
+		return "DXT3";
+	}
+	if(fourcc == makeFourCC("DXT4") || fourcc == makeFourCC("DXT5")) {
+		return "DXT5";
+	}
+	return NULL;
+}
+
+static int getSquishFlags(const std::string& compression) {
+	if(compression == "DXT1") {
+		return squish::kDxt1;
+	}
+	if(compression == "DXT3") {
+		return squish::kDxt3;
+	}
+	return squish::kDxt5;
+}
+
+/*
+ * Whether any DXT1 block uses its punch through (transparent) colour.
+ */
+static bool hasTransparentTexels(const squish::u8* blocks, size_t nblocks) {
+	for(size_t i = 0; i < nblocks; i++, blocks += 8) {
+		const unsigned int c0 = blocks[0] | (unsigned int)(blocks[1]) << 8;
+		const unsigned int c1 = blocks[2] | (unsigned int)(blocks[3]) << 8;
+		if(c0 > c1) {
+			continue;
+		}
+		for(int k = 4; k < 8; k++) {
+			for(int shift = 0; shift < 8; shift += 2) {
+				if(((blocks[k] >> shift) & 3) == 3) {
+					return true;
+				}
+			}
+		}
+	}
+	return false;
+}
+
+/*
+ * Reverses the order of the first nrows pixel rows of a DXT block.
+ */
+static void flipBlockRows(squish::u8* block, int squish_flags, int nrows) {
+	squish::u8* colour_block = block;
+
+	if(squish_flags & squish::kDxt3) {
+		// Explicit alpha: 2 bytes per row.
+		for(int i = 0, j = nrows - 1; i < j; i++, j--) {
+			std::swap(block[2*i], block[2*j]);
+			std::swap(block[2*i + 1], block[2*j + 1]);
+		}
+		colour_block = block + 8;
+	}
+	else if(squish_flags & squish::kDxt5) {
+		// Interpolated alpha: 3 bit indices, 12 bits per row, packed
+		// little endian after the two endpoints.
+		uint64_t bits = 0;
+		for(int k = 0; k < 6; k++) {
+			bits |= uint64_t(block[2 + k]) << (8*k);
+		}
+
+		uint64_t rows[4];
+		for(int r = 0; r < 4; r++) {
+			rows[r] = (bits >> (12*r)) & 0xfff;
+		}
+		std::reverse(rows, rows + nrows);
+
+		bits = 0;
+		for(int r = 0; r < 4; r++) {
+			bits |= rows[r] << (12*r);
+		}
+		for(int k = 0; k < 6; k++) {
+			block[2 + k] = squish::u8(bits >> (8*k));
+		}
+		colour_block = block + 8;
+	}
+
+	// Colour indices: 1 byte per row, after the two endpoints.
+	std::reverse(colour_block + 4, colour_block + 4 + nrows);
+}
+
+/*
+ * Flips the DXT compressed image vertically, without decoding it.
+ *
+ * This is only possible if the rows of the image don't straddle block
+ * boundaries when flipped, that is, if the height is a multiple of 4 or
+ * fits in a single block row. Otherwise the blocks are decoded and
+ * compressed again.
+ */
+static void flipBlocks(squish::u8* blocks, int width, int height, int squish_flags) {
+	const size_t block_size = (squish_flags & squish::kDxt1) ? 8 : 16;
+	const size_t blocks_wide = size_t(width + 3)/4;
+	const size_t blocks_high = size_t(height + 3)/4;
+	const size_t row_size = blocks_wide*block_size;
+
+	if(height > 4 && height % 4 != 0) {
+		std::vector<squish::u8> rgba(size_t(width)*size_t(height)*4);
+		squish::DecompressImageParallel(&rgba[0], width, height, blocks, squish_flags);
+		squish::CompressImageParallel(&rgba[0] + size_t(height - 1)*size_t(width)*4, width, height, -4*width, blocks, squish_flags);
+		return;
+	}
+
+	for(size_t i = 0, j = blocks_high - 1; i < j; i++, j--) {
+		std::swap_ranges(blocks + i*row_size, blocks + (i + 1)*row_size, blocks + j*row_size);
+	}
+
+	const int nrows = std::min(height, 4);
+	const size_t nblocks = blocks_wide*blocks_high;
+	for(size_t i = 0; i < nblocks; i++) {
+		flipBlockRows(blocks + i*block_size, squish_flags, nrows);
+	}
+}
+
+
+bool KTools::KTEX::File::isDDSFile(std::istream& in) {
+	try {
+		return rawFourCC(BinIOHelper::getMagicNumber(in)) == DDS_MAGIC_NUMBER;
+	}
+	catch(...) {
+		return false;
+	}
+}
+
+bool KTools::KTEX::File::loadDDSFrom(const VirtualPath& path, const DDSConversion& conv, int verbosity) {
+	if(verbosity >= 0) {
+		std::cout << "Loading DDS from `" << path << "'..." << std::endl;
+	}
+
+	std::istream* in = path.open_in(std::ifstream::binary);
+	bool ret;
+	try {
+		in->imbue(std::locale::classic());
+		ret = loadDDS(*in, conv, verbosity);
+	}
+	catch(...) {
+		delete in;
+		throw;
+	}
+	delete in;
+
+	return ret;
+}
+
+bool KTools::KTEX::File::loadDDS(std::istream& in, const DDSConversion& conv, int verbosity) {
+	BinIOHelper ddsio;
+	ddsio.setLittleSource();
+
+	uint32_t magic;
+	BinIOHelper::raw_read_integer(in, magic);
+	if(rawFourCC(magic) != DDS_MAGIC_NUMBER) {
+		throw(KToolsError("Attempt to read a non-DDS file as DDS."));
+	}
+
+	uint32_t hdr[DDS_HEADER_SIZE/4];
+	for(size_t i = 0; i < DDS_HEADER_SIZE/4; i++) {
+		ddsio.read_integer(in, hdr[i]);
+	}
+
+	const uint32_t size = hdr[0];
+	const uint32_t flags = hdr[1];
+	const uint32_t height = hdr[2];
+	const uint32_t width = hdr[3];
+	const uint32_t dds_mipmap_count = hdr[6];
+	const uint32_t* const pf = hdr + 18;
+	const uint32_t caps2 = hdr[27];
+
+	if(size != DDS_HEADER_SIZE || pf[0] != DDS_PIXELFORMAT_SIZE) {
+		throw(KToolsError("Invalid DDS header."));
+	}
+
+	if(!(pf[1] & DDPF_FOURCC)) {
+		return false;
+	}
+	if((flags & DDSD_DEPTH) || (caps2 & (DDSCAPS2_CUBEMAP | DDSCAPS2_VOLUME))) {
+		return false;
+	}
+
+	Maybe<uint32_t> dxgi_format;
+	bool premultiplied = (pf[2] == makeFourCC("DXT2") || pf[2] == makeFourCC("DXT4"));
+	if(pf[2] == makeFourCC("DX10")) {
+		uint32_t dx10[5];
+		for(size_t i = 0; i < 5; i++) {
+			ddsio.read_integer(in, dx10[i]);
+		}
+		// Texture arrays are not supported either.
+		if(dx10[1] != D3D10_RESOURCE_DIMENSION_TEXTURE2D || (dx10[2] & D3D10_RESOURCE_MISC_TEXTURECUBE) || dx10[3] > 1) {
+			return false;
+		}
+		dxgi_format = Just(dx10[0]);
+		premultiplied = ((dx10[4] & DDS_ALPHA_MODE_MASK) == DDS_ALPHA_MODE_PREMULTIPLIED);
+	}
+
+	const char* compression = getDDSCompression(pf[2], dxgi_format);
+	if(compression == NULL) {
+		return false;
+	}
+	const bool is_dxt1 = (std::string(compression) == "DXT1");
+
+	// Automatic compression is only sure to pick DXT1 for opaque images,
+	// which is checked below along with the DXT1 alpha.
+	if(conv.auto_compression ? !is_dxt1 : header.getFieldString("compression") != compression) {
+		return false;
+	}
+
+	// DXT1 is either opaque or punch through, so it is only known to
+	// match later, from its blocks.
+	if(!is_dxt1 && premultiplied != conv.premultiply) {
+		return false;
+	}
+
+	if(width == 0 || height == 0 || width > 0xffff || height > 0xffff) {
+		throw(KToolsError(strformat("Unsupported DDS dimensions %ux%u.", (unsigned int)width, (unsigned int)height)));
+	}
+
+	size_t dds_mipmaps = 1;
+	if((flags & DDSD_MIPMAPCOUNT) && dds_mipmap_count > 1) {
+		dds_mipmaps = dds_mipmap_count;
+	}
+
+	// The mipmaps the conversion would generate, which the DDS must have.
+	const size_t mipmap_count = (conv.mipmaps ? getMipmapCount(width, height) : 1);
+	if(dds_mipmaps < mipmap_count) {
+		return false;
+	}
+
+	if(mipmap_count >= (size_t(1) << HeaderSpecs::FieldSpecs["mipmap_count"].length)) {
+		throw(KToolsError("Too many mipmaps in DDS file."));
+	}
+
+	// The blocks are read in before touching the KTEX, since those of
+	// DXT1 may still turn out not to match.
+	const int squish_flags = getSquishFlags(compression);
+	std::vector< std::vector<squish::u8> > blocks(mipmap_count);
+	bool has_transparency = false;
+	for(size_t i = 0; i < mipmap_count; i++) {
+		const int w = int(getMipmapDimension(width, i));
+		const int h = int(getMipmapDimension(height, i));
+		blocks[i].resize(size_t(squish::GetStorageRequirements(w, h, squish_flags)));
+
+		if(!in.read(reinterpret_cast<char*>(&blocks[i][0]), std::streamsize(blocks[i].size()))) {
+			throw(KToolsError("Failed to read DDS mipmap."));
+		}
+
+		if(is_dxt1 && !has_transparency) {
+			has_transparency = hasTransparentTexels(&blocks[i][0], blocks[i].size()/8);
+		}
+	}
+
+	// Punch through texels hold straight alpha, and automatic
+	// compression may not have picked DXT1 for them.
+	if(has_transparency && (conv.premultiply || conv.auto_compression)) {
+		return false;
+	}
+
+	header.setField("compression", std::string(compression));
+	reallocateMipmaps(mipmap_count);
+
+	const CompressionFormat fmt = getCompressionFormat();
+
+	if(verbosity >= 1) {
+		std::cout << "Copying " << mipmap_count << " " << compression << " mipmaps..." << std::endl;
+	}
+
+	for(size_t i = 0; i < mipmap_count; i++) {
+		Mipmap& M = Mipmaps[i];
+
+		layoutMipmap(M, getMipmapDimension(width, i), getMipmapDimension(height, i), fmt);
+		assert( M.datasz == blocks[i].size() );
+
+		M.setDataSize( M.datasz );
+		std::memcpy(M.data, &blocks[i][0], M.datasz);
+
+		if(flip_image) {
+			flipBlocks(M.data, M.width, M.height, fmt.squish_flags);
+		}
+	}
+
+	return true;
+}
@@ -0,0 +1,323 @@
+/*
+Copyright (C) 2013  simplex
+
+This program is free software; you can redistribute it and/or
+modify it under the terms of the GNU General Public License
+as published by the Free Software Foundation; either version 2
+of the License, or (at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+
+
+#include "ktex/fastdxt.hpp"
+
+#include <cstring>
+#include <cstddef>
+
+
+using squish::u8;
+
+
+/*
+ * Image size (in pixels) from which the rows of blocks are split among the
+ * workers.
+ */
+static const size_t PARALLEL_MIN_PIXELS = 256*256;
+
+/*
+ * Copies the 4x4 block at (x, y), repeating the last column and row for the
+ * blocks on the edges.
+ */
+static void loadBlock(const u8* first_row, int width, int height, int pitch, int x, int y, u8* rgba) {
+	for(int py = 0; py < 4; py++) {
+		const int sy = (y + py < height ? y + py : height - 1);
+		const u8* row = first_row + std::ptrdiff_t(pitch)*sy;
+
+		for(int px = 0; px < 4; px++) {
+			const int sx = (x + px < width ? x + px : width - 1);
+			std::memcpy(rgba + 4*(4*py + px), row + 4*sx, 4);
+		}
+	}
+}
+
+static bool isUniformBlock(const u8* rgba) {
+	for(int i = 1; i < 16; i++) {
+		if(std::memcmp(rgba, rgba + 4*i, 4) != 0) {
+			return false;
+		}
+	}
+	return true;
+}
+
+static int pack565(const int* rgb) {
+	const int r = (31*rgb[0] + 127)/255;
+	const int g = (63*rgb[1] + 127)/255;
+	const int b = (31*rgb[2] + 127)/255;
+	return (r << 11) | (g << 5) | b;
+}
+
+/*
+ * Expands a 565 colour as the decoder does.
+ */
+static void unpack565(int value, int* rgb) {
+	const int r = (value >> 11) & 0x1f;
+	const int g = (value >> 5) & 0x3f;
+	const int b = value & 0x1f;
+	rgb[0] = (r << 3) | (r >> 2);
+	rgb[1] = (g << 2) | (g >> 4);
+	rgb[2] = (b << 3) | (b >> 2);
+}
+
+/*
+ * Index of the palette entry nearest to the pixel.
+ */
+static int nearestColour(const u8* pixel, const int (*palette)[3], int count) {
+	int best = 0;
+	int best_error = 0x7fffffff;
+	for(int j = 0; j < count; j++) {
+		const int dr = int(pixel[0]) - palette[j][0];
+		const int dg = int(pixel[1]) - palette[j][1];
+		const int db = int(pixel[2]) - palette[j][2];
+		const int error = dr*dr + dg*dg + db*db;
+		if(error < best_error) {
+			best = j;
+			best_error = error;
+		}
+	}
+	return best;
+}
+
+/*
+ * Writes the colour block. For DXT1, pixels with alpha below 128 are made
+ * transparent, as in squish, through the 3 colour mode.
+ */
+static void compressColours(const u8* rgba, bool is_dxt1, u8* block) {
+	int lo[3] = {255, 255, 255};
+	int hi[3] = {0, 0, 0};
+	bool transparent[16];
+	bool any_transparent = false;
+	bool any_opaque = false;
+
+	for(int i = 0; i < 16; i++) {
+		transparent[i] = is_dxt1 && rgba[4*i + 3] < 128;
+		if(transparent[i]) {
+			any_transparent = true;
+			continue;
+		}
+		any_opaque = true;
+		for(int c = 0; c < 3; c++) {
+			const int v = rgba[4*i + c];
+			if(v < lo[c]) lo[c] = v;
+			if(v > hi[c]) hi[c] = v;
+		}
+	}
+
+	if(!any_opaque) {
+		lo[0] = lo[1] = lo[2] = 0;
+		hi[0] = hi[1] = hi[2] = 0;
+	}
+
+	// Inset the bounding box, since its corners are rarely hit.
+	for(int c = 0; c < 3; c++) {
+		const int inset = (hi[c] - lo[c]) >> 4;
+		lo[c] += inset;
+		hi[c] -= inset;
+	}
+
+	int a = pack565(hi);
+	int b = pack565(lo);
+
+	int palette[4][3];
+	int count;
+
+	if(any_transparent) {
+		// The 3 colour mode is picked by a <= b.
+		if(a > b) {
+			const int tmp = a;
+			a = b;
+			b = tmp;
+		}
+		unpack565(a, palette[0]);
+		unpack565(b, palette[1]);
+		for(int c = 0; c < 3; c++) {
+			palette[2][c] = (palette[0][c] + palette[1][c])/2;
+		}
+		count = 3;
+	}
+	else if(a == b) {
+		// Any mode gives the colour at index 0.
+		unpack565(a, palette[0]);
+		count = 1;
+	}
+	else {
+		// The 4 colour mode is picked by a > b.
+		if(a < b) {
+			const int tmp = a;
+			a = b;
+			b = tmp;
+		}
+		unpack565(a, palette[0]);
+		unpack565(b, palette[1]);
+		for(int c = 0; c < 3; c++) {
+			palette[2][c] = (2*palette[0][c] + palette[1][c])/3;
+			palette[3][c] = (palette[0][c] + 2*palette[1][c])/3;
+		}
+		count = 4;
+	}
+
+	block[0] = u8(a & 0xff);
+	block[1] = u8(a >> 8);
+	block[2] = u8(b & 0xff);
+	block[3] = u8(b >> 8);
+
+	for(int r = 0; r < 4; r++) {
+		int packed = 0;
+		for(int px = 0; px < 4; px++) {
+			const int i = 4*r + px;
+			const int index = (transparent[i] ? 3 : nearestColour(rgba + 4*i, palette, count));
+			packed |= index << 2*px;
+		}
+		block[4 + r] = u8(packed);
+	}
+}
+
+static void compressAlphaDxt3(const u8* rgba, u8* block) {
+	for(int i = 0; i < 8; i++) {
+		const int lo = (15*int(rgba[4*(2*i) + 3]) + 127)/255;
+		const int hi = (15*int(rgba[4*(2*i + 1) + 3]) + 127)/255;
+		block[i] = u8(lo | (hi << 4));
+	}
+}
+
+/*
+ * Picks the nearest DXT5 alpha code for each pixel, with the codebook of the
+ * given end points. Returns the total absolute error.
+ */
+static int fitAlphaCodes(const u8* rgba, int alpha0, int alpha1, u8* indices) {
+	int codes[8];
+	codes[0] = alpha0;
+	codes[1] = alpha1;
+	if(alpha0 <= alpha1) {
+		for(int i = 1; i < 5; i++) {
+			codes[1 + i] = ((5 - i)*alpha0 + i*alpha1)/5;
+		}
+		codes[6] = 0;
+		codes[7] = 255;
+	}
+	else {
+		for(int i = 1; i < 7; i++) {
+			codes[1 + i] = ((7 - i)*alpha0 + i*alpha1)/7;
+		}
+	}
+
+	int total = 0;
+	for(int i = 0; i < 16; i++) {
+		const int value = rgba[4*i + 3];
+		int best = 0;
+		int best_error = 256;
+		for(int j = 0; j < 8; j++) {
+			const int error = (value > codes[j] ? value - codes[j] : codes[j] - value);
+			if(error < best_error) {
+				best = j;
+				best_error = error;
+			}
+		}
+		indices[i] = u8(best);
+		total += best_error;
+	}
+	return total;
+}
+
+static void compressAlphaDxt5(const u8* rgba, u8* block) {
+	int lo = 255, hi = 0;
+	int inner_lo = 255, inner_hi = 0;
+	for(int i = 0; i < 16; i++) {
+		const int value = rgba[4*i + 3];
+		if(value < lo) lo = value;
+		if(value > hi) hi = value;
+		if(value != 0 && value != 255) {
+			if(value < inner_lo) inner_lo = value;
+			if(value > inner_hi) inner_hi = value;
+		}
+	}
+	if(inner_lo > inner_hi) {
+		inner_lo = inner_hi = lo;
+	}
+
+	// The 8 code mode over the whole range, against the 6 code one over
+	// the values other than 0 and 255.
+	u8 indices[16];
+	int alpha0 = inner_lo, alpha1 = inner_hi;
+	const int error = fitAlphaCodes(rgba, alpha0, alpha1, indices);
+	if(hi > lo) {
+		u8 full_indices[16];
+		if(fitAlphaCodes(rgba, hi, lo, full_indices) < error) {
+			alpha0 = hi;
+			alpha1 = lo;
+			std::memcpy(indices, full_indices, sizeof(indices));
+		}
+	}
+
+	block[0] = u8(alpha0);
+	block[1] = u8(alpha1);
+	for(int half = 0; half < 2; half++) {
+		int packed = 0;
+		for(int j = 0; j < 8; j++) {
+			packed |= int(indices[8*half + j]) << 3*j;
+		}
+		u8* dest = block + 2 + 3*half;
+		dest[0] = u8(packed & 0xff);
+		dest[1] = u8((packed >> 8) & 0xff);
+		dest[2] = u8((packed >> 16) & 0xff);
+	}
+}
+
+int KTools::KTEX::FastDXT::compressImage(const u8* first_row, int width, int height, int pitch, void* blocks, int squish_flags) {
+	const bool is_dxt3 = (squish_flags & squish::kDxt3) != 0;
+	const bool is_dxt5 = !is_dxt3 && (squish_flags & squish::kDxt5) != 0;
+	const bool is_dxt1 = !is_dxt3 && !is_dxt5;
+
+	const int bytes_per_block = (is_dxt1 ? 8 : 16);
+	const int blocks_per_row = (width + 3)/4;
+	const int block_rows = (height + 3)/4;
+
+	int uniform_blocks = 0;
+
+#ifdef _OPENMP
+#	pragma omp parallel for schedule(static) reduction(+: uniform_blocks) if(size_t(width)*size_t(height) >= PARALLEL_MIN_PIXELS)
+#endif
+	for(int row = 0; row < block_rows; row++) {
+		u8* block = reinterpret_cast<u8*>(blocks) + size_t(row)*blocks_per_row*bytes_per_block;
+
+		for(int bx = 0; bx < blocks_per_row; bx++, block += bytes_per_block) {
+			u8 rgba[4*16];
+			loadBlock(first_row, width, height, pitch, 4*bx, 4*row, rgba);
+
+			if(isUniformBlock(rgba)) {
+				uniform_blocks++;
+			}
+
+			u8* colour_block = block;
+			if(is_dxt3) {
+				compressAlphaDxt3(rgba, block);
+				colour_block += 8;
+			}
+			else if(is_dxt5) {
+				compressAlphaDxt5(rgba, block);
+				colour_block += 8;
+			}
+
+			compressColours(rgba, is_dxt1, colour_block);
+		}
+	}
+
+	return uniform_blocks;
+}
@@ -0,0 +1,49 @@
+/*
+Copyright (C) 2013  simplex
+
+This program is free software; you can redistribute it and/or
+modify it under the terms of the GNU General Public License
+as published by the Free Software Foundation; either version 2
+of the License, or (at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+
+#ifndef KTOOLS_KTEX_FASTDXT_HPP
+#define KTOOLS_KTEX_FASTDXT_HPP
+
+#include <squish/squish.h>
+
+namespace KTools {
+	namespace KTEX {
+		/*
+		 * A single pass DXT encoder, in the style of real time ones, for when
+		 * turnaround matters more than quality.
+		 *
+		 * The colours of each block are fit to the corners of their bounding
+		 * box (inset by a sixteenth of its size), and each pixel takes the
+		 * nearest of the resulting palette. DXT5 alpha takes the smaller
+		 * error between the full range of the block and its range without
+		 * 0 and 255, which are then kept exact.
+		 */
+		namespace FastDXT {
+			/*
+			 * Compresses the image as squish::CompressImageParallel does,
+			 * with the same block layout. Only the DXT format of the squish
+			 * flags is used.
+			 *
+			 * Returns the number of blocks whose pixels are all equal.
+			 */
+			int compressImage(const squish::u8* first_row, int width, int height, int pitch, void* blocks, int squish_flags);
+		}
+	}
+}
+
+#endif
@@ -17,9 +17,18 @@ along with this program.  If not, see <http://www.gnu.org/licenses/>.
 
 
 #include "ktex/ktex.hpp"
+#include "ktex/fastdxt.hpp"
 #include "binary_io_utils.hpp"
 #include "ktools_bit_op.hpp"
 
+#include <sstream>
+#include <iomanip>
+#include <cstring>
+
+#ifdef IS_WINDOWS
+#	include <fcntl.h>
+#endif
+
 
 using namespace KTools;
 using namespace KTools::KTEX;
@@ -28,6 +37,9 @@ using std::cout;
 using std::cerr;
 using std::endl;
 
+// Mipmaps at least this large are compressed with all workers at once.
+static const size_t PARALLEL_MIPMAP_MIN_PIXELS = 256*256;
+
 bool KTools::KTEX::File::isKTEXFile(std::istream& in) {
 	try {
 		return BinIOHelper::getMagicNumber(in) == HeaderSpecs::MAGIC_NUMBER;
@@ -46,6 +58,20 @@ bool KTools::KTEX::File::isKTEXFile(const std::string& path) {
 	}
 }
 
+/*
+ * Checks the magic number at the start of a mapped file, so that files
+ * other than KTEX are told apart without being opened a second time.
+ */
+static void checkMappedMagic(const Compat::MappedFile& map, const std::string& path) {
+	uint32_t magic = 0;
+	if(map.size() >= sizeof(magic)) {
+		std::memcpy(&magic, map.data(), sizeof(magic));
+	}
+	if(magic != KTools::KTEX::HeaderSpecs::MAGIC_NUMBER) {
+		throw(KTools::KToolsError("Input file '" + path + "' does not match a KTEX file."));
+	}
+}
+
 void KTools::KTEX::File::dumpTo(const std::string& path, int verbosity) {
 	if(verbosity >= 0) {
 		std::cout << "Dumping KTEX to `" << path << "'..." << std::endl;	
@@ -59,17 +85,252 @@ void KTools::KTEX::File::dumpTo(const std::string& path, int verbosity) {
 	dump(out, verbosity);
 }
 
-void KTools::KTEX::File::loadFrom(const std::string& path, int verbosity, bool info_only) {
+void KTools::KTEX::File::loadFrom(const VirtualPath& path, int verbosity, bool info_only) {
 	if(verbosity >= 0) {
 		std::cout << "Loading KTEX from `" << path << "'..." << std::endl;
 	}
-	
-	std::ifstream in(path.c_str(), std::ifstream::in | std::ifstream::binary);
-	check_stream_validity(in, path);
 
-	in.imbue(std::locale::classic());
+	if(path.isRegular()) {
+		Compat::MappedFile map;
+		if(map.open(path)) {
+			checkMappedMagic(map, path);
+			loadMapped(map, verbosity, info_only);
+			return;
+		}
+	}
+
+	// Fall back to reading through a stream (zip entries, stdin, or
+	// whenever the mapping fails).
+	std::istream* in = path.open_in(std::ifstream::binary);
+	try {
+		in->imbue(std::locale::classic());
+		load(*in, verbosity, info_only);
+	}
+	catch(...) {
+		delete in;
+		throw;
+	}
+	delete in;
+}
+
+void KTools::KTEX::File::loadMapped(Compat::MappedFile& map, int verbosity, bool info_only) {
+	MemoryStreamBuffer buf(map.data(), map.size());
+	std::istream in(&buf);
+
+	load(in, verbosity, true);
+
+	if(info_only) return;
+
+	const size_t mipmap_count = header.getField("mipmap_count");
+
+	size_t offset = size_t(in.tellg());
+
+	for(size_t i = 0; i < mipmap_count; ++i) {
+		Mipmap& M = Mipmaps[i];
+
+		if(verbosity >= 1) {
+			std::cout << "Loading (post) mipmap #" << (i + 1) << "..." << std::endl;
+		}
+
+		if(M.datasz > map.size() - offset) {
+			throw(KToolsError("Failed to read KTEX mipmap."));
+		}
+
+		M.setDataView(reinterpret_cast<Mipmap::byte_t*>(map.data() + offset), M.datasz);
+		offset += M.datasz;
+	}
+
+	if(offset < map.size()) {
+		std::cerr << "Warning: There is leftover data in the input TEX file." << std::endl;
+	}
+
+	mapping.swap(map);
+}
+
+void KTools::KTEX::File::loadMipmapFrom(const VirtualPath& path, size_t n, int verbosity) {
+	if(verbosity >= 0) {
+		std::cout << "Loading mipmap #" << (n + 1) << " of KTEX from `" << path << "'..." << std::endl;
+	}
+
+	if(path.isRegular()) {
+		Compat::MappedFile map;
+		if(map.open(path)) {
+			checkMappedMagic(map, path);
+
+			MemoryStreamBuffer buf(map.data(), map.size());
+			std::istream in(&buf);
+
+			loadSingleMipmapPre(in, n, verbosity);
+
+			Mipmap& M = Mipmaps[0];
+
+			const size_t offset = size_t(in.tellg());
+			if(M.datasz > map.size() - offset) {
+				throw(KToolsError("Failed to read KTEX mipmap."));
+			}
+
+			M.setDataView(reinterpret_cast<Mipmap::byte_t*>(map.data() + offset), M.datasz);
+			mapping.swap(map);
+			return;
+		}
+	}
+
+	std::istream* in = path.open_in(std::ifstream::binary);
+	try {
+		in->imbue(std::locale::classic());
+		loadSingleMipmapPre(*in, n, verbosity);
+		if(!Mipmaps[0].loadPost(*in)) {
+			throw(KToolsError("Failed to read KTEX mipmap."));
+		}
+	}
+	catch(...) {
+		delete in;
+		throw;
+	}
+	delete in;
+}
+
+std::istream& KTools::KTEX::File::loadSingleMipmapPre(std::istream& in, size_t n, int verbosity) {
+	load(in, verbosity, true);
+
+	const size_t mipmap_count = header.getField("mipmap_count");
+	if(n >= mipmap_count) {
+		throw(KToolsError(strformat("KTEX file has no mipmap #%u (it has %u).", (unsigned int)(n + 1), (unsigned int)mipmap_count)));
+	}
+
+	std::streamoff offset = 0;
+	for(size_t i = 0; i < n; ++i) {
+		offset += Mipmaps[i].datasz;
+	}
+
+	Mipmap* M = new Mipmap[1];
+	M->parent = this;
+	M->width = Mipmaps[n].width;
+	M->height = Mipmaps[n].height;
+	M->pitch = Mipmaps[n].pitch;
+	M->datasz = Mipmaps[n].datasz;
+
+	delete[] Mipmaps;
+	Mipmaps = M;
+	header.setField("mipmap_count", 1);
+
+	if(offset > 0 && !in.seekg(offset, std::ios_base::cur)) {
+		throw(KToolsError("Failed to read KTEX mipmap."));
+	}
+
+	return in;
+}
+
+/*
+ * Creates an empty file next to path, under a fresh name, and returns that
+ * name. The file is created exclusively, so nothing already there is
+ * overwritten, and it gets the permissions of path (if it exists).
+ */
+static std::string createTemporarySibling(const VirtualPath& path) {
+	std::string name = path.dirnameWithSlash() + "." + path.basename() + ".XXXXXX";
+	std::vector<char> buf(name.begin(), name.end());
+	buf.push_back('\0');
+
+#ifdef IS_WINDOWS
+	if(_mktemp_s(&buf[0], buf.size()) != 0) {
+		throw(SysError("failed to create a temporary file for '" + path + "'"));
+	}
+	const int fd = _open(&buf[0], _O_CREAT | _O_EXCL | _O_WRONLY | _O_BINARY, _S_IREAD | _S_IWRITE);
+	if(fd < 0) {
+		throw(SysError("failed to create a temporary file for '" + path + "'"));
+	}
+	_close(fd);
+#else
+	const int fd = ::mkstemp(&buf[0]);
+	if(fd < 0) {
+		throw(SysError("failed to create a temporary file for '" + path + "'"));
+	}
+	struct stat st;
+	if(::stat(path.c_str(), &st) == 0) {
+		(void)::fchmod(fd, st.st_mode & 07777);
+	}
+	::close(fd);
+#endif
+
+	name.assign(&buf[0]);
+	return name;
+}
+
+void KTools::KTEX::File::rewriteHeader(const VirtualPath& in_path, const std::string& out_path, const HeaderEdits& edits, const Maybe<size_t>& max_mipmaps, int verbosity) {
+	if(verbosity >= 0) {
+		std::cout << "Rewriting KTEX header from `" << in_path << "' into `" << out_path << "'..." << std::endl;
+	}
+
+	const bool same_file = in_path.isRegular() && in_path.isSameFileAs(out_path);
+
+	File tex;
+	tex.loadFrom(in_path, verbosity - 1, true);
+
+	for(HeaderEdits::const_iterator it = edits.begin(); it != edits.end(); ++it) {
+		if(!HeaderSpecs::FieldSpecs[it->first].isValid()) {
+			throw(KToolsError("Invalid KTEX header field '" + it->first + "'."));
+		}
+		if(it->first == "compression" || it->first == "mipmap_count") {
+			throw(KToolsError("The KTEX header field '" + it->first + "' can't be rewritten without re-encoding."));
+		}
+		tex.header.setField(it->first, it->second);
+	}
+
+	const size_t mipmap_count = tex.header.getField("mipmap_count");
+	size_t new_mipmap_count = mipmap_count;
+	if(max_mipmaps != nil && max_mipmaps.value() < mipmap_count) {
+		if(max_mipmaps.value() == 0) {
+			throw(KToolsError("At least one mipmap must be kept."));
+		}
+		new_mipmap_count = max_mipmaps.value();
+	}
+
+	// The mipmap metadata shares the header's byte order, so the header
+	// alone may only be patched if it keeps it.
+	if(same_file && new_mipmap_count == mipmap_count && tex.io.hasSourceAsTarget()) {
+		if(verbosity >= 1) {
+			std::cout << "Patching KTEX header in place..." << std::endl;
+		}
+
+		std::ofstream out(out_path.c_str(), std::ofstream::in | std::ofstream::out | std::ofstream::binary);
+		check_stream_validity(out, out_path);
+
+		if(!tex.header.dump(out) || !out.flush()) {
+			throw(KToolsError("Failed to write KTEX header."));
+		}
+		return;
+	}
+
+	tex.loadFrom(in_path, verbosity - 1);
+	tex.header.setField("mipmap_count", new_mipmap_count);
+	for(HeaderEdits::const_iterator it = edits.begin(); it != edits.end(); ++it) {
+		tex.header.setField(it->first, it->second);
+	}
+
+	if(!same_file) {
+		tex.dumpTo(out_path, verbosity - 1);
+		return;
+	}
+
+	// Writing over the file being read would pull the data from under
+	// the mapping, so in that case we go through a temporary file.
+	const std::string dump_path = createTemporarySibling(out_path);
 
-	load(in, verbosity, info_only);
+	try {
+		tex.dumpTo(dump_path, verbosity - 1);
+
+		tex.deallocateMipmaps();
+#ifdef IS_WINDOWS
+		std::remove(out_path.c_str());
+#endif
+		if(std::rename(dump_path.c_str(), out_path.c_str()) != 0) {
+			throw(SysError("failed to replace '" + out_path + "'"));
+		}
+	}
+	catch(...) {
+		std::remove(dump_path.c_str());
+		throw;
+	}
 }
 
 void KTools::KTEX::File::Header::print(std::ostream& out, int verbosity, size_t indentation, const std::string& indent_string) const {
@@ -204,12 +465,12 @@ std::istream& KTools::KTEX::File::Mipmap::loadPre(std::istream& in) {
 	parent->io.read_integer(in, pitch);
 	parent->io.read_integer(in, datasz);
 
-	setDataSize( datasz );
-
 	return in;
 }
 
 std::istream& KTools::KTEX::File::Mipmap::loadPost(std::istream& in) {
+	setDataSize( datasz );
+
 	in.read( reinterpret_cast<char*>( data ), datasz );
 
 	return in;
@@ -242,7 +503,7 @@ void KTools::KTEX::File::print(std::ostream& out, int verbosity, size_t indentat
 	}
 }
 
-std::ostream& KTools::KTEX::File::dump(std::ostream& out, int verbosity) const {
+std::ostream& KTools::KTEX::File::dumpPre(std::ostream& out, int verbosity) const {
 	BinIOHelper::sanitizeStream(out);
 
 	size_t mipmap_count = header.getField("mipmap_count");
@@ -276,6 +537,14 @@ std::ostream& KTools::KTEX::File::dump(std::ostream& out, int verbosity) const {
 		}
 	}
 
+	return out;
+}
+
+std::ostream& KTools::KTEX::File::dump(std::ostream& out, int verbosity) const {
+	dumpPre(out, verbosity);
+
+	size_t mipmap_count = header.getField("mipmap_count");
+
 	for(size_t i = 0; i < mipmap_count; ++i) {
 		if(verbosity >= 1) {
 			std::cout << "Dumping (post) mipmap #" << (i + 1) << "..." << std::endl;
@@ -289,6 +558,18 @@ std::ostream& KTools::KTEX::File::dump(std::ostream& out, int verbosity) const {
 	return out;
 }
 
+size_t KTools::KTEX::File::getDumpSize() const {
+	const size_t mipmap_count = header.getField("mipmap_count");
+
+	// Magic number and header, then width, height, pitch and data size
+	// per mipmap.
+	size_t sz = 4 + 4 + mipmap_count*(2 + 2 + 2 + 4);
+	for(size_t i = 0; i < mipmap_count; ++i) {
+		sz += Mipmaps[i].datasz;
+	}
+	return sz;
+}
+
 std::istream& KTools::KTEX::File::load(std::istream& in, int verbosity, bool info_only) {
 	BinIOHelper::sanitizeStream(in);
 
@@ -362,6 +643,15 @@ static int getSquishCompressionFlag(File::Header header, bool& isnone) {
 	return -1;
 }
 
+static void flipRows(squish::u8* data, size_t pitch, size_t height) {
+	std::vector<squish::u8> row(pitch);
+	for(size_t top = 0, bottom = height - 1; top < bottom; top++, bottom--) {
+		memcpy(&row[0], data + top*pitch, pitch);
+		memcpy(data + top*pitch, data + bottom*pitch, pitch);
+		memcpy(data + bottom*pitch, &row[0], pitch);
+	}
+}
+
 static std::string getMagickString(File::Header header) {
 	const std::string& internal_flag = header.getFieldString("compression");
 
@@ -372,12 +662,76 @@ static std::string getMagickString(File::Header header) {
 	return internal_flag;
 }
 
+/*
+ * Decodes DXT blocks into the pixels of an image, a row of blocks at a time,
+ * splitting the rows among the workers. Each row goes through squish's row
+ * decoder into a 4 pixel high buffer of the worker. If flip is set, the image
+ * is filled bottom up.
+ */
+static void decompressBlocksInto(Magick::PixelPacket* RESTRICT pixels, int width, int height, const squish::u8* blocks, int squish_flags, bool flip) {
+	Magick::Quantum quanta[256];
+	for(int i = 0; i < 256; i++) {
+		quanta[i] = Magick::Quantum( (double(i)*QuantumRange)/255 );
+	}
+
+	const int bytes_per_block = (squish_flags & squish::kDxt1) ? 8 : 16;
+	const int blocks_per_row = (width + 3)/4;
+	const int block_rows = (height + 3)/4;
+
+#ifdef _OPENMP
+#	pragma omp parallel
+#endif
+	{
+		std::vector<squish::u8> rgba(16*size_t(width));
+
+#ifdef _OPENMP
+#		pragma omp for schedule(static)
+#endif
+		for(int row = 0; row < block_rows; row++) {
+			const squish::u8* block = blocks + size_t(row)*blocks_per_row*bytes_per_block;
+			const int rows = std::min(4, height - 4*row);
+
+			squish::DecompressImage(&rgba[0], width, rows, block, squish_flags);
+
+			for(int py = 0; py < rows; py++) {
+				const int y = (flip ? height - 1 - (4*row + py) : 4*row + py);
+				Magick::PixelPacket* RESTRICT p = pixels + size_t(y)*width;
+				const squish::u8* q = &rgba[4*size_t(width)*py];
+
+				for(int px = 0; px < width; px++, p++, q += 4) {
+					p->red = quanta[q[0]];
+					p->green = quanta[q[1]];
+					p->blue = quanta[q[2]];
+					p->opacity = QuantumRange - quanta[q[3]];
+				}
+			}
+		}
+	}
+}
+
 KTools::KTEX::File::CompressionFormat KTools::KTEX::File::getCompressionFormat() const {
 	KTools::KTEX::File::CompressionFormat fmt;
 	fmt.squish_flags = getSquishCompressionFlag(header, fmt.is_uncompressed);
+	fmt.engine = encoder_engine;
+	fmt.report_stats = false;
+	if(!fmt.is_uncompressed) {
+		fmt.squish_flags |= encoder_flags;
+		fmt.report_stats = report_stats;
+	}
 	return fmt;
 }
 
+int KTools::KTEX::File::getEncoderPresetFlags(KTools::KTEX::File::EncoderPreset preset) {
+	switch(preset) {
+		case FastEncoder:
+			return squish::kColourRangeFit;
+		case BalancedEncoder:
+			return squish::kColourClusterFit | squish::kColourAdaptiveFit | squish::AdaptiveFitThreshold(2);
+		default:
+			return squish::kColourIterativeClusterFit | squish::kWeightColourByAlpha;
+	}
+}
+
 Magick::Image KTools::KTEX::File::DecompressMipmap(const KTools::KTEX::File::Mipmap& M, const KTools::KTEX::File::CompressionFormat& fmt, int verbosity) const {
 	Magick::Image img;
 	Magick::Blob B;
@@ -394,10 +748,16 @@ Magick::Image KTools::KTEX::File::DecompressMipmap(const KTools::KTEX::File::Mip
 		if(verbosity >= 0) {
 				std::cout << "Decompressing " << width << "x" << height << " KTEX image into RGBA..." << std::endl;
 		}
-		squish::u8* RESTRICT rgba = new squish::u8[4*width*height];
-		squish::DecompressImage(rgba, width, height, M.getData(), fmt.squish_flags);
-		B.updateNoCopy(rgba, 4*width*height);
-		img.read(B, Magick::Geometry(width, height), 8, "RGBA");
+		if(size_t(squish::GetStorageRequirements(width, height, fmt.squish_flags)) > M.getDataSize()) {
+			throw(KToolsError("Mipmap data is smaller than its compressed size implies."));
+		}
+		img = Magick::Image(Magick::Geometry(width, height), Magick::Color("transparent"));
+		img.depth(8);
+		img.modifyImage();
+
+		Magick::Pixels view(img);
+		decompressBlocksInto(view.set(0, 0, width, height), width, height, M.getData(), fmt.squish_flags, flip_image);
+		view.sync();
 	}
 	else {
 		std::string magick_str = getMagickString(header);
@@ -414,7 +774,20 @@ Magick::Image KTools::KTEX::File::DecompressMipmap(const KTools::KTEX::File::Mip
 			std::cout << "..." << std::endl;
 		}
 
-		B.update(M.getData(), M.getDataSize());
+		if(flip_image) {
+			const size_t pitch = M.pitch;
+			if(pitch*height > M.getDataSize()) {
+				throw(KToolsError("Mipmap data is smaller than its pitch implies."));
+			}
+			squish::u8* flipped = new squish::u8[M.getDataSize()];
+			for(int y = 0; y < height; y++) {
+				memcpy(flipped + (height - 1 - y)*pitch, M.getData() + y*pitch, pitch);
+			}
+			B.updateNoCopy(flipped, M.getDataSize());
+		}
+		else {
+			B.update(M.getData(), M.getDataSize());
+		}
 		img.read(B, Magick::Geometry(width, height), 8, magick_str);
 	}
 
@@ -423,33 +796,69 @@ Magick::Image KTools::KTEX::File::DecompressMipmap(const KTools::KTEX::File::Mip
 		std::cout << "Decompressed." << std::endl;
 	}
 
+	return img;
+}
+
+KTools::RGBAImage KTools::KTEX::File::DecompressMipmapRGBA(const KTools::KTEX::File::Mipmap& M, const KTools::KTEX::File::CompressionFormat& fmt, int verbosity) const {
+	const size_t width = M.width;
+	const size_t height = M.height;
 
-	if(flip_image) {
-		img.flip();
+	RGBAImage img(width, height);
+	if(img.empty()) {
+		return img;
 	}
 
-	return img;
-}
+	// The rows are filled bottom up through a flipped view.
+	RGBAImage target = (flip_image ? img.flipped() : img);
 
-void KTools::KTEX::File::CompressMipmap(KTools::KTEX::File::Mipmap& M, const KTools::KTEX::File::CompressionFormat& fmt, Magick::Image img, int verbosity) const {
-	(void)verbosity;
+	if(!fmt.is_uncompressed) {
+		if(verbosity >= 0) {
+			std::cout << "Decompressing " << width << "x" << height << " KTEX image into RGBA..." << std::endl;
+		}
 
-	std::string magick_str = "RGBA";
-	size_t pixel_size = 4;
-	if(fmt.is_uncompressed) {
-		magick_str = getMagickString(header);
-		if(magick_str == "RGB") {
-			pixel_size = 3;
+		if(size_t(squish::GetStorageRequirements(int(width), int(height), fmt.squish_flags)) > M.getDataSize()) {
+			throw(KToolsError("Mipmap data is smaller than its compressed size implies."));
+		}
+
+		squish::DecompressImageParallel(target.row(0), int(width), int(height), int(target.pitch()), M.getData(), fmt.squish_flags);
+	}
+	else {
+		const bool has_alpha = (getMagickString(header) == "RGBA");
+
+		if(verbosity >= 0) {
+			std::cout << "Decompressing " << width << "x" << height << " KTEX image into " << (has_alpha ? "RGBA" : "RGB") << "..." << std::endl;
+		}
+
+		if(size_t(M.pitch)*height > M.getDataSize()) {
+			throw(KToolsError("Mipmap data is smaller than its pitch implies."));
+		}
+
+		for(size_t y = 0; y < height; y++) {
+			const Mipmap::byte_t* src = M.getData() + size_t(M.pitch)*y;
+			RGBAImage::byte_t* dst = target.row(y);
+
+			if(has_alpha) {
+				memcpy(dst, src, 4*width);
+			}
+			else {
+				for(size_t x = 0; x < width; x++, src += 3, dst += 4) {
+					dst[0] = src[0];
+					dst[1] = src[1];
+					dst[2] = src[2];
+					dst[3] = 255;
+				}
+			}
 		}
 	}
 
-	if(flip_image) {
-		img.flip();
+	if(verbosity >= 0) {
+		std::cout << "Decompressed." << std::endl;
 	}
 
-	const size_t width = img.columns();
-	const size_t height = img.rows();
+	return img;
+}
 
+void KTools::KTEX::File::layoutMipmap(KTools::KTEX::File::Mipmap& M, size_t width, size_t height, const KTools::KTEX::File::CompressionFormat& fmt) const {
 	if(width == 0 || height == 0) {
 		throw(KToolsError("Attempt to compress an image with zero size."));
 	}
@@ -458,27 +867,416 @@ void KTools::KTEX::File::CompressMipmap(KTools::KTEX::File::Mipmap& M, const KTo
 	cast_assign(M.height, height);
 
 	if(fmt.is_uncompressed) {
+		const size_t pixel_size = (getMagickString(header) == "RGB" ? 3 : 4);
 		cast_assign(M.pitch, pixel_size*width);
+		cast_assign(M.datasz, pixel_size*width*height);
 	}
 	else {
 		cast_assign(M.pitch, squish::GetStorageRequirements(int(width), 1, fmt.squish_flags));
+		cast_assign(M.datasz, squish::GetStorageRequirements(int(width), int(height), fmt.squish_flags));
 	}
+}
 
-	Magick::Blob B;
-	img.write(&B, magick_str, 8);
+KTools::KTEX::File::EncodingStats KTools::KTEX::File::CompressMipmap(KTools::KTEX::File::Mipmap& M, const KTools::KTEX::File::CompressionFormat& fmt, const KTools::RGBAImage& img, int verbosity) const {
+	layoutMipmap(M, img.columns(), img.rows(), fmt);
+	M.setDataSize( M.datasz );
+	return EncodeMipmap(M, fmt, img, verbosity);
+}
 
+/*
+ * Number of compressed blocks in the (laid out) mipmap.
+ */
+static size_t countBlocks(const KTools::KTEX::File::Mipmap& M, const KTools::KTEX::File::CompressionFormat& fmt) {
 	if(fmt.is_uncompressed) {
-		M.setDataSize( B.length() );
+		return 0;
+	}
+	return M.getDataSize()/((fmt.squish_flags & squish::kDxt1) ? 8 : 16);
+}
+
+/*
+ * Sum of the squared differences between the pixels and their decompressed
+ * blocks.
+ */
+static double measureSquaredError(const squish::u8* first_row, int width, int height, int pitch, const void* blocks, int squish_flags) {
+	std::vector<squish::u8> decoded(4*size_t(width)*size_t(height));
+	squish::DecompressImageParallel(&decoded[0], width, height, blocks, squish_flags);
+
+	double total = 0;
+#ifdef _OPENMP
+#	pragma omp parallel for reduction(+: total) if(size_t(width)*size_t(height) >= PARALLEL_MIPMAP_MIN_PIXELS)
+#endif
+	for(int y = 0; y < height; y++) {
+		const squish::u8* src = first_row + std::ptrdiff_t(pitch)*y;
+		const squish::u8* dst = &decoded[0] + 4*size_t(width)*size_t(y);
+
+		for(int i = 0; i < 4*width; i++) {
+			const int d = int(src[i]) - int(dst[i]);
+			total += double(d*d);
+		}
+	}
+
+	return total;
+}
+
+/*
+ * Reports how many of the blocks took the shortcut for constant blocks.
+ */
+static void reportConstantBlocks(size_t constant_blocks, size_t total_blocks) {
+	std::cout << constant_blocks << " of " << total_blocks << " blocks were uniform or fully transparent." << std::endl;
+}
+
+/*
+ * Reports the error of a compressed mipmap (or of all of them) and how
+ * fast it was compressed.
+ */
+static void reportQuality(const std::string& what, const KTools::KTEX::File::EncodingStats& stats) {
+	const double mse = stats.sample_count > 0 ? stats.squared_error/double(stats.sample_count) : 0;
+	const double megapixels = double(stats.sample_count/4)/1e6;
+
+	std::ostringstream line;
+	line << std::fixed << std::setprecision(3);
+	line << what << ": RMSE " << std::sqrt(mse) << ", PSNR ";
+	if(mse > 0) {
+		line << 10*std::log10(255*255/mse) << " dB";
 	}
 	else {
-		M.setDataSize( squish::GetStorageRequirements(int(width), int(height), fmt.squish_flags) );
+		line << "infinite";
+	}
+	if(stats.seconds > 0) {
+		line << ", " << std::setprecision(2) << megapixels/stats.seconds << " MP/s";
 	}
+	line << ".";
+
+	std::cout << line.str() << std::endl;
+}
+
+KTools::KTEX::File::EncodingStats KTools::KTEX::File::EncodeMipmap(KTools::KTEX::File::Mipmap& M, const KTools::KTEX::File::CompressionFormat& fmt, const KTools::RGBAImage& img, int verbosity) const {
+	(void)verbosity;
+
+	EncodingStats stats;
+
+	const size_t width = img.columns();
+	const size_t height = img.rows();
+
+	assert( width == M.width && height == M.height && M.data != NULL );
 
+	// The flip is done while the pixels are laid out, instead of on the image.
+	const RGBAImage src = (flip_image ? img.flipped() : img);
 
 	if(fmt.is_uncompressed) {
-		memcpy(M.data, B.data(), B.length());
+		const bool has_alpha = (getMagickString(header) == "RGBA");
+
+		for(size_t y = 0; y < height; y++) {
+			const RGBAImage::byte_t* p = src.row(y);
+			Mipmap::byte_t* q = M.data + size_t(M.pitch)*y;
+
+			if(has_alpha) {
+				memcpy(q, p, 4*width);
+			}
+			else {
+				for(size_t x = 0; x < width; x++, p += 4, q += 3) {
+					q[0] = p[0];
+					q[1] = p[1];
+					q[2] = p[2];
+				}
+			}
+		}
+	}
+	else {
+		const squish::u8* first_row = src.row(0);
+		const int pitch = int(src.pitch());
+
+		const double start = getWallTime();
+		if(fmt.engine == FastEngine) {
+			stats.constant_blocks = size_t(FastDXT::compressImage( first_row, int(width), int(height), pitch, M.data, fmt.squish_flags ));
+		}
+		else {
+			stats.constant_blocks = size_t(squish::CompressImageParallel( first_row, int(width), int(height), pitch, M.data, fmt.squish_flags ));
+		}
+		stats.seconds = getWallTime() - start;
+		stats.total_blocks = countBlocks(M, fmt);
+
+		if(fmt.report_stats) {
+			stats.squared_error = measureSquaredError(first_row, int(width), int(height), pitch, M.data, fmt.squish_flags);
+			stats.sample_count = 4*width*height;
+		}
+	}
+
+	return stats;
+}
+
+
+/*
+ * How much larger (in RGBA levels) the RMSE of DXT1 may be than that of
+ * DXT5 for an image with binary alpha before DXT5 is chosen instead.
+ */
+static const double AUTO_COMPRESSION_DXT1_TOLERANCE = 1.0;
+
+/*
+ * RMSE of compressing the pixels with the given format, taken with the
+ * range fit since only the relative error matters.
+ */
+static double measureCompressionError(const KTools::RGBAImage& img, int squish_format) {
+	const int flags = squish_format | squish::kColourRangeFit;
+	const int width = int(img.columns());
+	const int height = int(img.rows());
+	const int pitch = int(img.pitch());
+
+	std::vector<squish::u8> blocks(size_t(squish::GetStorageRequirements(width, height, flags)));
+	squish::CompressImageParallel(img.row(0), width, height, pitch, &blocks[0], flags);
+
+	const double squared_error = measureSquaredError(img.row(0), width, height, pitch, &blocks[0], flags);
+	return std::sqrt(squared_error/(4*double(width)*double(height)));
+}
+
+void KTools::KTEX::File::chooseCompression(const KTools::RGBAImage& img, int verbosity) {
+	const size_t width = img.columns();
+	const size_t height = img.rows();
+
+	if(width == 0 || height == 0) {
+		throw(KToolsError("Attempt to compress an image with zero size."));
+	}
+
+	bool opaque = true;
+	bool binary_alpha = true;
+	for(size_t y = 0; y < height && binary_alpha; y++) {
+		const RGBAImage::byte_t* p = img.row(y);
+		for(size_t x = 0; x < width; x++, p += 4) {
+			if(p[3] != 255) {
+				opaque = false;
+				if(p[3] != 0) {
+					binary_alpha = false;
+					break;
+				}
+			}
+		}
+	}
+
+	std::string compression;
+	std::ostringstream reason;
+	reason << std::fixed << std::setprecision(3);
+
+	if(opaque) {
+		compression = "DXT1";
+		reason << "opaque";
+	}
+	else {
+		const double dxt5_error = measureCompressionError(img, squish::kDxt5);
+
+		if(binary_alpha) {
+			const double dxt1_error = measureCompressionError(img, squish::kDxt1);
+			compression = (dxt1_error <= dxt5_error + AUTO_COMPRESSION_DXT1_TOLERANCE ? "DXT1" : "DXT5");
+			reason << "binary alpha, RMSE " << dxt1_error << " as DXT1 and " << dxt5_error << " as DXT5";
+		}
+		else {
+			const double dxt3_error = measureCompressionError(img, squish::kDxt3);
+			compression = (dxt3_error < dxt5_error ? "DXT3" : "DXT5");
+			reason << "RMSE " << dxt3_error << " as DXT3 and " << dxt5_error << " as DXT5";
+		}
+	}
+
+	header.setField("compression", compression);
+
+	if(verbosity >= 0) {
+		std::cout << "Picked " << compression << " compression (" << reason.str() << ")." << std::endl;
+	}
+}
+
+
+void KTools::KTEX::File::layoutMipmaps(const std::vector<KTools::RGBAImage>& imgs, const KTools::KTEX::File::CompressionFormat& fmt) {
+	reallocateMipmaps(imgs.size());
+
+	for(size_t i = 0; i < imgs.size(); i++) {
+		layoutMipmap(Mipmaps[i], imgs[i].columns(), imgs[i].rows(), fmt);
+	}
+}
+
+void KTools::KTEX::File::EncodeMipmaps(const std::vector<KTools::RGBAImage>& imgs, const KTools::KTEX::File::CompressionFormat& fmt, int verbosity) {
+	const int mipmap_count = int(imgs.size());
+
+	// Each mipmap keeps its own stats, so that they're reported in order.
+	std::vector<EncodingStats> stats(imgs.size());
+	const double start = getWallTime();
+
+	// Large mipmaps are split among the workers on their own (by rows of
+	// blocks), one after the other. The remaining small ones are then
+	// compressed concurrently, one per worker.
+	int first_small = 0;
+	while(first_small < mipmap_count && imgs[first_small].columns()*imgs[first_small].rows() >= PARALLEL_MIPMAP_MIN_PIXELS) {
+		stats[first_small] = EncodeMipmap(Mipmaps[first_small], fmt, imgs[first_small], verbosity);
+		first_small++;
+	}
+
+	ParallelErrorTrap trap;
+
+	// Each mipmap is compressed independently into its own buffer, so
+	// the result doesn't depend on the scheduling.
+#ifdef _OPENMP
+#	pragma omp parallel for schedule(dynamic, 1)
+#endif
+	for(int i = first_small; i < mipmap_count; i++) {
+		try {
+			stats[i] = EncodeMipmap(Mipmaps[i], fmt, imgs[i], verbosity);
+		}
+		catch(...) {
+			trap.capture();
+		}
+	}
+
+	trap.rethrow();
+
+	if(fmt.report_stats) {
+		EncodingStats total;
+		for(int i = 0; i < mipmap_count; i++) {
+			reportQuality(strformat("Mipmap #%d (%ux%u)", i + 1, (unsigned int)Mipmaps[i].width, (unsigned int)Mipmaps[i].height), stats[i]);
+			total += stats[i];
+		}
+
+		// The small mipmaps overlap in time.
+		total.seconds = getWallTime() - start;
+		if(mipmap_count > 1) {
+			reportQuality("All mipmaps", total);
+		}
+		reportConstantBlocks(total.constant_blocks, total.total_blocks);
+	}
+}
+
+void KTools::KTEX::File::CompressMipmaps(const std::vector<KTools::RGBAImage>& imgs, int verbosity) {
+	const CompressionFormat fmt = getCompressionFormat();
+
+	layoutMipmaps(imgs, fmt);
+	for(size_t i = 0; i < imgs.size(); i++) {
+		Mipmaps[i].setDataSize( Mipmaps[i].datasz );
+	}
+
+	EncodeMipmaps(imgs, fmt, verbosity);
+}
+
+void KTools::KTEX::File::CompressMipmapsTo(const std::string& path, const std::vector<KTools::RGBAImage>& imgs, int verbosity) {
+	const CompressionFormat fmt = getCompressionFormat();
+
+	layoutMipmaps(imgs, fmt);
+
+	Compat::MappedFile out;
+	if(!out.create(path, getDumpSize())) {
+		// Fall back to compressing in memory and writing it out.
+		CompressMipmaps(imgs, verbosity);
+		dumpTo(path, verbosity);
+		return;
+	}
+
+	MemoryStreamBuffer buf(out.data(), out.size());
+	std::ostream pre(&buf);
+	dumpPre(pre, verbosity);
+
+	size_t offset = size_t(pre.tellp());
+	for(size_t i = 0; i < imgs.size(); i++) {
+		viewMipmapData(Mipmaps[i], reinterpret_cast<Mipmap::byte_t*>(out.data() + offset));
+		offset += Mipmaps[i].datasz;
+	}
+	assert( offset == out.size() );
+
+	EncodeMipmaps(imgs, fmt, verbosity);
+
+	// The mipmap data lives in the output file from now on.
+	mapping.swap(out);
+}
+
+KTools::KTEX::File::StreamWriter::StreamWriter(KTools::KTEX::File& _tex, std::ostream& _out, size_t width, size_t height, size_t _mipmap_count, int _verbosity) :
+	tex(_tex), out(&_out), owned_out(NULL), map(), map_offset(0), fmt(_tex.getCompressionFormat()), mipmap_count(_mipmap_count), next(0), verbosity(_verbosity)
+{
+	layout(width, height);
+	tex.dumpPre(*out, verbosity);
+}
+
+KTools::KTEX::File::StreamWriter::StreamWriter(KTools::KTEX::File& _tex, const std::string& path, size_t width, size_t height, size_t _mipmap_count, int _verbosity) :
+	tex(_tex), out(NULL), owned_out(NULL), map(), map_offset(0), fmt(_tex.getCompressionFormat()), mipmap_count(_mipmap_count), next(0), verbosity(_verbosity)
+{
+	layout(width, height);
+
+	if(map.create(path, tex.getDumpSize())) {
+		MemoryStreamBuffer buf(map.data(), map.size());
+		std::ostream pre(&buf);
+		tex.dumpPre(pre, verbosity);
+		map_offset = size_t(pre.tellp());
 	}
 	else {
-		squish::CompressImage( (const squish::u8*)B.data(), int(width), int(height), M.data, fmt.squish_flags );
+		owned_out = new std::ofstream;
+		try {
+			BinIOHelper::openBinaryStream(*owned_out, path);
+		}
+		catch(...) {
+			delete owned_out;
+			throw;
+		}
+		out = owned_out;
+		tex.dumpPre(*out, verbosity);
 	}
 }
+
+KTools::KTEX::File::StreamWriter::~StreamWriter() {
+	delete owned_out;
+}
+
+void KTools::KTEX::File::StreamWriter::layout(size_t width, size_t height) {
+	tex.reallocateMipmaps(mipmap_count);
+
+	for(size_t i = 0; i < mipmap_count; i++) {
+		tex.layoutMipmap(tex.Mipmaps[i], getMipmapDimension(width, i), getMipmapDimension(height, i), fmt);
+	}
+}
+
+void KTools::KTEX::File::StreamWriter::write(const KTools::RGBAImage& img) {
+	if(done()) {
+		throw(KToolsError("Attempt to write more mipmaps than the KTEX file has room for."));
+	}
+
+	Mipmap& M = tex.Mipmaps[next];
+
+	if(img.columns() != M.width || img.rows() != M.height) {
+		throw(KToolsError(strformat("Mipmap #%u has size %ux%u, but %ux%u was expected.",
+			(unsigned int)(next + 1),
+			(unsigned int)img.columns(), (unsigned int)img.rows(),
+			(unsigned int)M.width, (unsigned int)M.height)));
+	}
+
+	if(verbosity >= 0) {
+		std::cout << "Compressing " << img.columns() << "x" << img.rows() << " image into KTEX..." << std::endl;
+	}
+
+	EncodingStats stats;
+	if(map.isOpen()) {
+		// Compressed straight into the output file.
+		viewMipmapData(M, reinterpret_cast<Mipmap::byte_t*>(map.data() + map_offset));
+		try {
+			stats = tex.EncodeMipmap(M, fmt, img, verbosity);
+		}
+		catch(...) {
+			viewMipmapData(M, NULL);
+			throw;
+		}
+		map_offset += M.getDataSize();
+		viewMipmapData(M, NULL);
+	}
+	else {
+		Mipmap tmp;
+		tmp.parent = &tex;
+
+		stats = tex.CompressMipmap(tmp, fmt, img, verbosity);
+
+		if(verbosity >= 1) {
+			std::cout << "Dumping (post) mipmap #" << (next + 1) << "..." << std::endl;
+		}
+
+		if(!tmp.dumpPost(*out)) {
+			throw(KToolsError("Failed to write KTEX mipmap."));
+		}
+	}
+
+	if(fmt.report_stats) {
+		reportQuality(strformat("Mipmap #%u (%ux%u)", (unsigned int)(next + 1), (unsigned int)M.width, (unsigned int)M.height), stats);
+		reportConstantBlocks(stats.constant_blocks, stats.total_blocks);
+	}
+
+	next++;
+}
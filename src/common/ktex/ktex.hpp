@@ -22,6 +22,9 @@ along with this program.  If not, see <http://www.gnu.org/licenses/>.
 #include "ktools_common.hpp"
 #include "ktex/specs.hpp"
 #include "binary_io_utils.hpp"
+#include "file_abstraction.hpp"
+#include "compat/mmap.hpp"
+#include "rgba_image.hpp"
 
 #include <squish/squish.h>
 
@@ -107,6 +110,18 @@ namespace KTools {
 				byte_t* data;
 				uint32_t datasz;
 
+				/*
+				 * Whether data was allocated by us, as opposed to
+				 * pointing into the parent's file mapping.
+				 */
+				bool owns_data;
+
+				void setDataView(byte_t* p, uint32_t sz) {
+					setDataSize(0);
+					data = p;
+					datasz = sz;
+				}
+
 			public:
 				uint16_t width;
 				uint16_t height;
@@ -121,16 +136,20 @@ namespace KTools {
 				}
 
 				void setDataSize(uint32_t sz) {
-					delete[] data;
+					if(owns_data) {
+						delete[] data;
+					}
 					if(sz != 0) {
 						data = new byte_t[sz];
+						owns_data = true;
 					} else {
 						data = NULL;
+						owns_data = false;
 					}
 					datasz = sz;
 				}
 
-				Mipmap() : parent(NULL), data(NULL), datasz(0), width(0), height(0), pitch(0) {}
+				Mipmap() : parent(NULL), data(NULL), datasz(0), owns_data(false), width(0), height(0), pitch(0) {}
 
 				~Mipmap() {
 					setDataSize(0);
@@ -147,9 +166,50 @@ namespace KTools {
 				std::istream& loadPost(std::istream& in);
 			};
 
+			/*
+			 * The DXT encoders: squish, tuned for quality, or a single
+			 * pass one (see FastDXT), tuned for speed.
+			 */
+			enum EncoderEngine {
+				SquishEngine,
+				FastEngine
+			};
+
 			struct CompressionFormat {
 				bool is_uncompressed;
 				int squish_flags;
+				EncoderEngine engine;
+
+				/*
+				 * Whether to print the error, speed and number of
+				 * constant blocks of each compressed mipmap. Measuring
+				 * the error takes a decompression per mipmap.
+				 */
+				bool report_stats;
+			};
+
+			/*
+			 * What compressing a mipmap took and gave, for reporting.
+			 */
+			struct EncodingStats {
+				size_t constant_blocks;
+				size_t total_blocks;
+				double seconds;
+
+				// Over all the RGBA samples.
+				double squared_error;
+				size_t sample_count;
+
+				EncodingStats() : constant_blocks(0), total_blocks(0), seconds(0), squared_error(0), sample_count(0) {}
+
+				EncodingStats& operator+=(const EncodingStats& s) {
+					constant_blocks += s.constant_blocks;
+					total_blocks += s.total_blocks;
+					seconds += s.seconds;
+					squared_error += s.squared_error;
+					sample_count += s.sample_count;
+					return *this;
+				}
 			};
 
 		public:
@@ -159,9 +219,16 @@ namespace KTools {
 		private:
 			Mipmap* Mipmaps;
 
+			/*
+			 * Backing storage of the mipmap data when loaded from a
+			 * memory mapped file.
+			 */
+			Compat::MappedFile mapping;
+
 			void deallocateMipmaps() {
 				delete[] Mipmaps;
 				Mipmaps = NULL;
+				mapping.close();
 			}
 
 			void reallocateMipmaps(size_t howmany) {
@@ -184,25 +251,212 @@ namespace KTools {
 
 			Magick::Image DecompressMipmap(const Mipmap& M, const CompressionFormat& fmt, int verbosity = -1) const;
 
-			void CompressMipmap(Mipmap& M, const CompressionFormat& fmt, Magick::Image img, int verbosity = -1) const;
+			RGBAImage DecompressMipmapRGBA(const Mipmap& M, const CompressionFormat& fmt, int verbosity = -1) const;
+
+			/*
+			 * Sets the dimensions, pitch and data size of M.
+			 */
+			void layoutMipmap(Mipmap& M, size_t width, size_t height, const CompressionFormat& fmt) const;
+
+			/*
+			 * Compresses img into the (already laid out) data of M.
+			 *
+			 * Returns the number of blocks which were uniform (or fully
+			 * transparent), and so skipped the colour fit, along with
+			 * the time taken and the error when reporting them.
+			 */
+			EncodingStats EncodeMipmap(Mipmap& M, const CompressionFormat& fmt, const RGBAImage& img, int verbosity = -1) const;
+
+			EncodingStats CompressMipmap(Mipmap& M, const CompressionFormat& fmt, const RGBAImage& img, int verbosity = -1) const;
+
+			/*
+			 * Lays out one mipmap per image, without allocating their data.
+			 */
+			void layoutMipmaps(const std::vector<RGBAImage>& imgs, const CompressionFormat& fmt);
+
+			/*
+			 * Compresses the images into the (already laid out) mipmaps
+			 * concurrently, over the worker pool.
+			 */
+			void EncodeMipmaps(const std::vector<RGBAImage>& imgs, const CompressionFormat& fmt, int verbosity = -1);
+
+			void CompressMipmaps(const std::vector<RGBAImage>& imgs, int verbosity = -1);
+
+			void CompressMipmapsTo(const std::string& path, const std::vector<RGBAImage>& imgs, int verbosity = -1);
+
+			/*
+			 * Points the data of M to p, which should have room for
+			 * the data size already laid out.
+			 */
+			static void viewMipmapData(Mipmap& M, Mipmap::byte_t* p) {
+				M.setDataView(p, M.datasz);
+			}
+
+			/*
+			 * Size of the file as laid out, including the header.
+			 */
+			size_t getDumpSize() const;
+
+			/*
+			 * Dumps the header and the mipmap metadata.
+			 */
+			std::ostream& dumpPre(std::ostream& out, int verbosity = -1) const;
+
+			/*
+			 * Loads from a mapped file, pointing the mipmap data into
+			 * the mapping instead of copying it. Takes over the mapping.
+			 */
+			void loadMapped(Compat::MappedFile& map, int verbosity = -1, bool info_only = false);
+
+			/*
+			 * Loads the header and the mipmap metadata, keeps only the
+			 * metadata of mipmap n and seeks to its data.
+			 */
+			std::istream& loadSingleMipmapPre(std::istream& in, size_t n, int verbosity = -1);
 
 			bool flip_image;
 
+			/*
+			 * Squish flags added when compressing, picking the colour fit
+			 * and error metric.
+			 */
+			int encoder_flags;
+
+			EncoderEngine encoder_engine;
+
+			bool report_stats;
+
 		public:
 			static bool isKTEXFile(std::istream& in);
 
 			static bool isKTEXFile(const std::string& path);
 
+			/*
+			 * Number of mipmaps in a full chain, halving each dimension
+			 * (clamped to 1) until both reach 1.
+			 */
+			static size_t getMipmapCount(size_t width, size_t height) {
+				size_t count = 1;
+				for(width /= 2, height /= 2; width > 0 || height > 0; width /= 2, height /= 2) {
+					count++;
+				}
+				return count;
+			}
+
+			static size_t getMipmapDimension(size_t dim, size_t level) {
+				dim >>= level;
+				return dim > 0 ? dim : 1;
+			}
+
 			void flipImage(bool b) {
 				flip_image = b;
 			}
 
+			void setEncoderFlags(int flags) {
+				encoder_flags = flags;
+			}
+
+			void setEncoderEngine(EncoderEngine e) {
+				encoder_engine = e;
+			}
+
+			void reportStats(bool b) {
+				report_stats = b;
+			}
+
+			/*
+			 * Sets the compression of the header from the alpha of img,
+			 * the (premultiplied) base mipmap: DXT1 if it's opaque, DXT1
+			 * or DXT5 if its alpha is binary and DXT3 or DXT5 otherwise.
+			 * Between two candidates, the choice is made by compressing
+			 * img both ways, keeping DXT1 unless it's noticeably worse.
+			 *
+			 * The choice is printed unless verbosity is negative.
+			 */
+			void chooseCompression(const RGBAImage& img, int verbosity = -1);
+
+			/*
+			 * Named squish settings for block compression, from the
+			 * fastest to the best quality.
+			 */
+			enum EncoderPreset {
+				FastEncoder,
+				BalancedEncoder,
+				BestEncoder
+			};
+
+			static int getEncoderPresetFlags(EncoderPreset preset);
+
 			void print(std::ostream& out, int verbosity = -1, size_t indentation = 0, const std::string& indent_string = "\t") const;
 			std::ostream& dump(std::ostream& out, int verbosity = -1) const;
 			std::istream& load(std::istream& in, int verbosity = -1, bool info_only = false);
 
 			void dumpTo(const std::string& path, int verbosity = 1);
-			void loadFrom(const std::string& path, int verbosity = -1, bool info_only = false);
+			/*
+			 * Regular files are memory mapped, with the mipmap data
+			 * being read straight from the mapping.
+			 */
+			void loadFrom(const VirtualPath& path, int verbosity = -1, bool info_only = false);
+
+			/*
+			 * Loads only mipmap n (counting from zero), seeking past the
+			 * data of the others. The resulting File has a single mipmap.
+			 */
+			void loadMipmapFrom(const VirtualPath& path, size_t n, int verbosity = -1);
+
+			static bool isDDSFile(std::istream& in);
+
+			/*
+			 * How an image would be converted if it were decoded and
+			 * compressed again, which copying DDS blocks through must
+			 * match.
+			 */
+			struct DDSConversion {
+				bool premultiply;
+				bool auto_compression;
+				bool mipmaps;
+
+				DDSConversion() : premultiply(true), auto_compression(false), mipmaps(true) {}
+			};
+
+			/*
+			 * Builds the KTEX from a DXT1, DXT3 or DXT5 compressed DDS
+			 * file, copying the block data of its mipmaps through instead
+			 * of recompressing it. The other header fields are kept.
+			 *
+			 * Returns false, leaving the KTEX untouched, if the DDS isn't
+			 * a block compressed 2D texture or if copying it wouldn't give
+			 * what conv does: a different compression (as set in the
+			 * header) or alpha premultiplication, or fewer mipmaps. The
+			 * image should then be decoded instead.
+			 */
+			bool loadDDSFrom(const VirtualPath& path, const DDSConversion& conv, int verbosity = -1);
+			bool loadDDS(std::istream& in, const DDSConversion& conv, int verbosity = -1);
+
+			/*
+			 * Header field values, by field id.
+			 */
+			typedef std::map<std::string, HeaderFieldSpec::value_t> HeaderEdits;
+
+			/*
+			 * Rewrites the KTEX file at in_path into out_path without
+			 * decoding it, setting the given header fields and keeping
+			 * only the first max_mipmaps mipmaps (if given).
+			 *
+			 * Pre-caves headers are converted along the way. If both
+			 * paths are the same file and no mipmaps are dropped, only
+			 * the header is patched, in place. Otherwise the mipmap data
+			 * is copied through untouched.
+			 */
+			static void rewriteHeader(const VirtualPath& in_path, const std::string& out_path, const HeaderEdits& edits, const Maybe<size_t>& max_mipmaps = nil, int verbosity = -1);
+
+			/*
+			 * Loads and decompresses only mipmap n (counting from zero).
+			 */
+			Magick::Image loadMipmap(const VirtualPath& path, size_t n, int verbosity = -1) {
+				loadMipmapFrom(path, n, verbosity);
+				return Decompress(verbosity);
+			}
 
 			Magick::Image Decompress(int verbosity = -1) const {
 				if(header.getField("mipmap_count") == 0) {
@@ -220,43 +474,116 @@ namespace KTools {
 				}
 			}
 
-			void CompressFrom(Magick::Image img, int verbosity = -1) {
-				std::list<Magick::Image> imglist;
-				imglist.push_back(img);
-				CompressFrom( imglist.begin(), imglist.end(), verbosity );
+			/*
+			 * The same as Decompress(), into native images.
+			 */
+			RGBAImage DecompressRGBA(int verbosity = -1) const {
+				if(header.getField("mipmap_count") == 0) {
+					return RGBAImage();
+				}
+				return DecompressMipmapRGBA(Mipmaps[0], getCompressionFormat(), verbosity);
+			}
+
+			template<typename OutputIterator>
+			void DecompressRGBA(OutputIterator it, int verbosity = -1) const {
+				const size_t num_mipmaps = header.getField("mipmap_count");
+				CompressionFormat fmt = getCompressionFormat();
+				for(size_t i = 0; i < num_mipmaps; i++) {
+					*it++ = DecompressMipmapRGBA(Mipmaps[i], fmt, verbosity);
+				}
+			}
+
+			/*
+			 * The images may be native or Magick ones, which are read into
+			 * native images first.
+			 */
+			void CompressFrom(const RGBAImage& img, int verbosity = -1) {
+				const std::vector<RGBAImage> imgs(1, img);
+				CompressFrom( imgs.begin(), imgs.end(), verbosity );
 			}
 
 			template<typename InputIterator>
 			void CompressFrom(InputIterator first, InputIterator last, int verbosity = -1) {
-				typedef typename InputIterator::value_type img_t;
 				if(first == last) return;
 
-				reallocateMipmaps( size_t(std::distance(first, last)) );
+				const std::vector<RGBAImage> imgs(first, last);
 
-				Mipmap* M = Mipmaps;
-				CompressionFormat fmt = getCompressionFormat();
-				img_t img = *first++;
+				if(verbosity >= 0) {
+					std::cout << "Compressing " << imgs.front().columns() << "x" << imgs.front().rows() << " image into KTEX..." << std::endl;
+				}
+
+				CompressMipmaps( imgs, verbosity );
 
 				if(verbosity >= 0) {
-					std::cout << "Compressing " << img.columns() << "x" << img.rows() << " image into KTEX..." << std::endl;
+					std::cout << "Compressed." << std::endl;
 				}
+			}
 
-				while(true) {
-					CompressMipmap( *M, fmt, img, verbosity );
+			/*
+			 * Compresses straight into a KTEX file at path. The file is
+			 * sized and memory mapped up front, and each mipmap is
+			 * compressed directly into its region of the mapping.
+			 */
+			template<typename InputIterator>
+			void CompressTo(const std::string& path, InputIterator first, InputIterator last, int verbosity = -1) {
+				if(first == last) return;
 
-					if(first == last)
-						break;
+				const std::vector<RGBAImage> imgs(first, last);
 
-					img = *first++;
-					M++;
+				if(verbosity >= 0) {
+					std::cout << "Compressing " << imgs.front().columns() << "x" << imgs.front().rows() << " image into KTEX `" << path << "'..." << std::endl;
 				}
 
+				CompressMipmapsTo( path, imgs, verbosity );
+
 				if(verbosity >= 0) {
 					std::cout << "Compressed." << std::endl;
 				}
 			}
 
-			File() : header(), io(header.io), Mipmaps(NULL), flip_image(true) {}
+			/*
+			 * Writes a KTEX file one mipmap at a time, so that only the
+			 * mipmap being written needs to be kept in memory.
+			 *
+			 * The header and all mipmap metadata are computed and written
+			 * on construction, from the base size and the mipmap count.
+			 * The mipmaps must then be passed to write() in order, with
+			 * the sizes given by getMipmapDimension().
+			 *
+			 * When given a path, the output file is sized and memory
+			 * mapped up front, with each mipmap being compressed directly
+			 * into its region.
+			 */
+			class StreamWriter : public NonCopyable {
+				File& tex;
+				std::ostream* out;
+				std::ofstream* owned_out;
+				Compat::MappedFile map;
+				size_t map_offset;
+				CompressionFormat fmt;
+				size_t mipmap_count;
+				size_t next;
+				int verbosity;
+
+				void layout(size_t width, size_t height);
+
+			public:
+				StreamWriter(File& _tex, std::ostream& _out, size_t width, size_t height, size_t _mipmap_count, int _verbosity = -1);
+				StreamWriter(File& _tex, const std::string& path, size_t width, size_t height, size_t _mipmap_count, int _verbosity = -1);
+				~StreamWriter();
+
+				size_t getMipmapCount() const {
+					return mipmap_count;
+				}
+
+				bool done() const {
+					return next >= mipmap_count;
+				}
+
+				void write(const RGBAImage& img);
+			};
+
+			File() : header(), io(header.io), Mipmaps(NULL), flip_image(true), encoder_flags(0), encoder_engine(SquishEngine), report_stats(false) {}
 			virtual ~File() { deallocateMipmaps(); }
 		};
 
@@ -1,6 +1,11 @@
 #include "ktools_common.hpp"
 
 #include <stdarg.h>
+#include <ctime>
+
+#ifdef _OPENMP
+#	include <omp.h>
+#endif
 
 #ifndef HAVE_SNPRINTF
 int vsnprintf(char *str, size_t n, const char *fmt, va_list ap) {
@@ -103,4 +108,96 @@ namespace KTools {
 
 		Magick::InitializeMagick(argv[0]);
 	}
+
+	void setWorkerCount(int n) {
+		if(n <= 0) {
+#ifdef _OPENMP
+			n = omp_get_num_procs();
+#else
+			return;
+#endif
+		}
+
+#ifdef _OPENMP
+		omp_set_num_threads(n);
+#endif
+		MagickCore::SetMagickResourceLimit(MagickCore::ThreadResource, MagickCore::MagickSizeType(n));
+	}
+
+	int getWorkerCount() {
+#ifdef _OPENMP
+		return omp_get_max_threads();
+#else
+		return 1;
+#endif
+	}
+
+	double getWallTime() {
+#ifdef _OPENMP
+		return omp_get_wtime();
+#else
+		return double(std::clock())/CLOCKS_PER_SEC;
+#endif
+	}
+
+	void ParallelErrorTrap::capture() {
+#ifdef _OPENMP
+#	pragma omp critical(ktools_parallel_error_trap)
+#endif
+		{
+			try {
+				throw;
+			}
+			catch(Magick::Warning& e) {
+				set(CAUGHT_MAGICK_WARNING, e.what());
+			}
+			catch(Magick::Exception& e) {
+				set(CAUGHT_MAGICK_ERROR, e.what());
+			}
+			catch(EncodingVersionError& e) {
+				set(CAUGHT_ENCODING_VERSION_ERROR, e.what());
+			}
+			catch(KToolsError& e) {
+				set(CAUGHT_KTOOLS_ERROR, e.what());
+			}
+			catch(std::bad_alloc& e) {
+				set(CAUGHT_BAD_ALLOC, e.what());
+			}
+			catch(std::runtime_error& e) {
+				set(CAUGHT_RUNTIME_ERROR, e.what());
+			}
+			catch(std::logic_error& e) {
+				set(CAUGHT_LOGIC_ERROR, e.what());
+			}
+			catch(std::exception& e) {
+				set(CAUGHT_GENERAL_ERROR, e.what());
+			}
+			catch(...) {
+				set(CAUGHT_GENERAL_ERROR, "Unknown error in parallel section.");
+			}
+		}
+	}
+
+	void ParallelErrorTrap::rethrow() const {
+		switch(kind) {
+			case CAUGHT_NOTHING:
+				return;
+			case CAUGHT_MAGICK_WARNING:
+				throw Magick::Warning(msg);
+			case CAUGHT_MAGICK_ERROR:
+				throw Magick::Error(msg);
+			case CAUGHT_ENCODING_VERSION_ERROR:
+				throw EncodingVersionError(msg);
+			case CAUGHT_KTOOLS_ERROR:
+				throw KToolsError(msg);
+			case CAUGHT_BAD_ALLOC:
+				throw std::bad_alloc();
+			case CAUGHT_RUNTIME_ERROR:
+				throw std::runtime_error(msg);
+			case CAUGHT_LOGIC_ERROR:
+				throw std::logic_error(msg);
+			default:
+				throw Error(msg);
+		}
+	}
 }
@@ -62,6 +62,7 @@ extern "C" {
 
 #include <exception>
 #include <stdexcept>
+#include <new>
 #include <cassert>
 #include <iostream>
 #include <fstream>
@@ -106,6 +107,21 @@ int snprintf(char *str, size_t n, const char *fmt, ...) PRINTFSTYLE(3, 4);
 namespace KTools {
 	void initialize_application(int& argc, char **& argv);
 
+	/*
+	 * Sets the size of the worker pool used for parallel processing,
+	 * which is shared with ImageMagick. A non-positive count means one
+	 * worker per processor.
+	 */
+	void setWorkerCount(int n);
+
+	int getWorkerCount();
+
+	/*
+	 * Seconds since an arbitrary point, for timing. Without OpenMP, this
+	 * is processor time instead of wall clock time.
+	 */
+	double getWallTime();
+
 
 	typedef double float_type;
 
@@ -360,6 +376,50 @@ namespace KTools {
 		const char * operator()(const char * fmt, ...) const;
 	};
 
+	/*
+	 * Exceptions may not propagate out of a parallel region. This keeps
+	 * a copy of the first one thrown within it (by calling capture() from
+	 * a catch(...) block), to be rethrown by rethrow() after the region.
+	 *
+	 * Without std::exception_ptr the copy is rebuilt from the message, so
+	 * the types callers handle specially are kept apart; anything else
+	 * becomes an Error carrying the original what().
+	 */
+	class ParallelErrorTrap : public NonCopyable {
+		enum Kind {
+			CAUGHT_NOTHING,
+			CAUGHT_MAGICK_WARNING,
+			CAUGHT_MAGICK_ERROR,
+			CAUGHT_ENCODING_VERSION_ERROR,
+			CAUGHT_KTOOLS_ERROR,
+			CAUGHT_BAD_ALLOC,
+			CAUGHT_RUNTIME_ERROR,
+			CAUGHT_LOGIC_ERROR,
+			CAUGHT_GENERAL_ERROR
+		};
+
+		Kind kind;
+		std::string msg;
+
+		void set(Kind k, const char* what) {
+			if(kind == CAUGHT_NOTHING) {
+				kind = k;
+				msg = what;
+			}
+		}
+
+	public:
+		ParallelErrorTrap() : kind(CAUGHT_NOTHING), msg() {}
+
+		bool failed() const {
+			return kind != CAUGHT_NOTHING;
+		}
+
+		void capture();
+
+		void rethrow() const;
+	};
+
 	template<typename charT, typename charTraits>
 	inline bool check_basic_stream_validity(std::basic_ios<charT, charTraits>& file, const std::string& prefix, bool _throw) {
 		if(file.fail()) {
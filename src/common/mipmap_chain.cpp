@@ -0,0 +1,347 @@
+/*
+Copyright (C) 2013  simplex
+
+This program is free software; you can redistribute it and/or
+modify it under the terms of the GNU General Public License
+as published by the Free Software Foundation; either version 2
+of the License, or (at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+
+
+
+#include "mipmap_chain.hpp"
+
+#ifdef __SSE2__
+#	include <emmintrin.h>
+#endif
+
+
+using namespace KTools;
+
+
+/*
+ * Smallest level (in pixels) split across threads.
+ */
+static const size_t PARALLEL_MIN_PIXELS = 128*128;
+
+static const double PI = 3.14159265358979323846;
+
+/*
+ * Whether passes are clamped, as a Magick without HDRI clamps them when
+ * storing each one back into quanta.
+ */
+#if MAGICKCORE_HDRI_ENABLE || defined(MAGICKCORE_HDRI_SUPPORT)
+static const bool CLAMP_PASSES = false;
+#else
+static const bool CLAMP_PASSES = true;
+#endif
+
+
+/*
+ * The kernels, as Magick defines them.
+ */
+
+static double boxWeight(double) {
+	return 1;
+}
+
+static double sinc(double x) {
+	if(x == 0) return 1;
+	x *= PI;
+	return std::sin(x)/x;
+}
+
+static double lanczosWeight(double x) {
+	return sinc(x)*sinc(x/3);
+}
+
+/*
+ * The Mitchell-Netravali family of cubics.
+ */
+template<int B_num, int C_num, int den>
+static double cubicWeight(double x) {
+	static const double B = double(B_num)/den, C = double(C_num)/den;
+
+	x = std::fabs(x);
+	if(x < 1) {
+		return ((12 - 9*B - 6*C)*x*x*x + (-18 + 12*B + 6*C)*x*x + (6 - 2*B))/6;
+	}
+	else if(x < 2) {
+		return ((-B - 6*C)*x*x*x + (6*B + 30*C)*x*x + (-12*B - 48*C)*x + (8*B + 24*C))/6;
+	}
+	return 0;
+}
+
+static bool getFilter(Magick::FilterTypes type, MipmapChain::Filter& filter) {
+	using namespace Magick;
+
+	switch(type) {
+		case BoxFilter:
+			filter.weight = boxWeight;
+			filter.support = 0.5;
+			return true;
+		case LanczosFilter:
+			filter.weight = lanczosWeight;
+			filter.support = 3;
+			return true;
+		case MitchellFilter:
+			filter.weight = cubicWeight<1, 1, 3>;
+			filter.support = 2;
+			return true;
+		case CatromFilter:
+			filter.weight = cubicWeight<0, 1, 2>;
+			filter.support = 2;
+			return true;
+		case CubicFilter:
+			filter.weight = cubicWeight<1, 0, 1>;
+			filter.support = 2;
+			return true;
+		default:
+			return false;
+	}
+}
+
+
+/*
+ * The source pixels (and their weights) making up each destination pixel
+ * along one dimension, placed as Magick's resize places them.
+ */
+class Contributions {
+public:
+	std::vector<int> start;
+	std::vector<int> count;
+
+	// Stride of taps per destination pixel.
+	size_t taps;
+	std::vector<float> weights;
+
+	Contributions(const MipmapChain::Filter& filter, size_t src_size, size_t dst_size) : start(dst_size), count(dst_size), taps(0), weights() {
+		const double factor = double(dst_size)/src_size;
+
+		double scale = std::max(1/factor, 1.0);
+		double support = scale*filter.support;
+		if(support < 0.5) {
+			support = 0.5;
+			scale = 1;
+		}
+		scale = 1/scale;
+
+		taps = size_t(2*support + 3);
+		weights.assign(taps*dst_size, 0.0f);
+
+		std::vector<double> w(taps);
+
+		for(size_t i = 0; i < dst_size; i++) {
+			const double center = (i + 0.5)/factor;
+			const int first = int(std::max(center - support + 0.5, 0.0));
+			const int last = int(std::min(center + support + 0.5, double(src_size)));
+			const int n = std::min(last - first, int(taps));
+
+			double density = 0;
+			for(int k = 0; k < n; k++) {
+				w[k] = filter.weight(scale*(first + k - center + 0.5));
+				density += w[k];
+			}
+			if(density == 0) {
+				density = 1;
+			}
+
+			start[i] = first;
+			count[i] = n;
+			for(int k = 0; k < n; k++) {
+				weights[taps*i + k] = float(w[k]/density);
+			}
+		}
+	}
+
+	const float* getWeights(size_t i) const {
+		return &weights[taps*i];
+	}
+};
+
+
+/*
+ * Reads an 8 bit row with straight alpha as premultiplied floats.
+ */
+static void premultiplyRow(const RGBAImage::byte_t* src, size_t width, float* dst) {
+	for(size_t j = 0; j < width; j++, src += 4, dst += 4) {
+		const float a = src[3];
+		const float inv = a/255;
+		dst[0] = src[0]*inv;
+		dst[1] = src[1]*inv;
+		dst[2] = src[2]*inv;
+		dst[3] = a;
+	}
+}
+
+static inline RGBAImage::byte_t roundChannel(float x) {
+	if(x <= 0) return 0;
+	if(x >= 255) return 255;
+	return RGBAImage::byte_t(x + 0.5f);
+}
+
+/*
+ * Writes premultiplied floats as an 8 bit row with straight alpha.
+ */
+static void demultiplyRow(const float* src, size_t width, RGBAImage::byte_t* dst) {
+	for(size_t j = 0; j < width; j++, src += 4, dst += 4) {
+		const float a = src[3];
+		if(a <= 0) {
+			dst[0] = dst[1] = dst[2] = dst[3] = 0;
+			continue;
+		}
+		const float inv = 255/a;
+		dst[0] = roundChannel(src[0]*inv);
+		dst[1] = roundChannel(src[1]*inv);
+		dst[2] = roundChannel(src[2]*inv);
+		dst[3] = roundChannel(a);
+	}
+}
+
+/*
+ * Clamps premultiplied floats as Magick clamps its quanta: alpha and the
+ * straight colour each to [0, 255].
+ */
+static void clampRow(float* row, size_t width) {
+	for(size_t j = 0; j < width; j++, row += 4) {
+		const float a = row[3];
+		if(a <= 0) {
+			row[0] = row[1] = row[2] = row[3] = 0;
+			continue;
+		}
+		const float clamped_a = std::min(a, 255.0f);
+		for(int c = 0; c < 3; c++) {
+			const float straight = std::min(std::max(row[c]*255/a, 0.0f), 255.0f);
+			row[c] = straight*clamped_a/255;
+		}
+		row[3] = clamped_a;
+	}
+}
+
+static void filterRow(const float* src, const Contributions& contribs, size_t dst_width, float* dst) {
+	for(size_t i = 0; i < dst_width; i++, dst += 4) {
+		const float* w = contribs.getWeights(i);
+		const float* s = src + 4*contribs.start[i];
+		const int n = contribs.count[i];
+
+#ifdef __SSE2__
+		__m128 acc = _mm_setzero_ps();
+		for(int k = 0; k < n; k++, s += 4) {
+			acc = _mm_add_ps( acc, _mm_mul_ps(_mm_set1_ps(w[k]), _mm_loadu_ps(s)) );
+		}
+		_mm_storeu_ps(dst, acc);
+#else
+		float acc[4] = {0, 0, 0, 0};
+		for(int k = 0; k < n; k++, s += 4) {
+			for(int c = 0; c < 4; c++) {
+				acc[c] += w[k]*s[c];
+			}
+		}
+		std::copy(acc, acc + 4, dst);
+#endif
+	}
+}
+
+/*
+ * dst = sum of weight*row over the source rows making up a destination
+ * row, of n floats each.
+ */
+static void filterColumns(const float* first_row, size_t row_stride, const float* w, int taps, size_t n, float* dst) {
+	std::fill(dst, dst + n, 0.0f);
+
+	for(int k = 0; k < taps; k++) {
+		const float* src = first_row + row_stride*k;
+		size_t j = 0;
+
+#ifdef __SSE2__
+		const __m128 wk = _mm_set1_ps(w[k]);
+		for(; j + 4 <= n; j += 4) {
+			_mm_storeu_ps( dst + j, _mm_add_ps(_mm_loadu_ps(dst + j), _mm_mul_ps(wk, _mm_loadu_ps(src + j))) );
+		}
+#endif
+
+		for(; j < n; j++) {
+			dst[j] += w[k]*src[j];
+		}
+	}
+}
+
+
+bool MipmapChain::isSupported(Magick::FilterTypes type) {
+	Filter f;
+	return getFilter(type, f);
+}
+
+MipmapChain::MipmapChain(const RGBAImage& _base, Magick::FilterTypes type) : base(_base), level(), width(_base.columns()), height(_base.rows()) {
+	if(!getFilter(type, filter)) {
+		throw KToolsError("Unsupported mipmap filter.");
+	}
+}
+
+RGBAImage MipmapChain::next(size_t w, size_t h) {
+	assert(w <= width && h <= height);
+
+	const Contributions hcontribs(filter, width, w);
+	const Contributions vcontribs(filter, height, h);
+
+	const bool parallel = width*height >= PARALLEL_MIN_PIXELS;
+
+	// Rows filtered horizontally, still height of them.
+	std::vector<float> filtered(4*w*height);
+
+#ifdef _OPENMP
+#	pragma omp parallel if(parallel)
+#endif
+	{
+		std::vector<float> scratch(base.empty() ? 0 : 4*width);
+
+#ifdef _OPENMP
+#		pragma omp for schedule(static)
+#endif
+		for(int y = 0; y < int(height); y++) {
+			const float* src;
+			if(!base.empty()) {
+				premultiplyRow(base.row(y), width, &scratch[0]);
+				src = &scratch[0];
+			}
+			else {
+				src = &level[4*width*size_t(y)];
+			}
+			filterRow(src, hcontribs, w, &filtered[4*w*size_t(y)]);
+			if(CLAMP_PASSES) {
+				clampRow(&filtered[4*w*size_t(y)], w);
+			}
+		}
+	}
+
+	std::vector<float> next_level(4*w*h);
+	RGBAImage img(w, h);
+
+#ifdef _OPENMP
+#	pragma omp parallel for schedule(static) if(parallel)
+#endif
+	for(int y = 0; y < int(h); y++) {
+		float* dst = &next_level[4*w*size_t(y)];
+		filterColumns(&filtered[4*w*size_t(vcontribs.start[y])], 4*w, vcontribs.getWeights(y), vcontribs.count[y], 4*w, dst);
+		if(CLAMP_PASSES) {
+			clampRow(dst, w);
+		}
+		demultiplyRow(dst, w, img.row(y));
+	}
+
+	base = RGBAImage();
+	level.swap(next_level);
+	width = w;
+	height = h;
+
+	return img;
+}
@@ -0,0 +1,97 @@
+/*
+Copyright (C) 2013  simplex
+
+This program is free software; you can redistribute it and/or
+modify it under the terms of the GNU General Public License
+as published by the Free Software Foundation; either version 2
+of the License, or (at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+
+
+#ifndef KTOOLS_MIPMAP_CHAIN_HPP
+#define KTOOLS_MIPMAP_CHAIN_HPP
+
+#include "ktools_common.hpp"
+#include "rgba_image.hpp"
+
+namespace KTools {
+	/*
+	 * Generates mipmaps natively, each level downsampled from the one
+	 * above with a separable filter, rows first.
+	 *
+	 * Filtering follows Magick's resize (the same kernels and supports,
+	 * with colour weighted by alpha). Levels are kept from one to the next
+	 * as premultiplied floats, clamped after each pass unless Magick was
+	 * built with HDRI (matching what it would store), and only the
+	 * returned images are 8 bit with straight alpha.
+	 *
+	 * Level sizes are whatever next() is given. ktech passes the sizes
+	 * KTEX::File::getMipmapDimension() gives, each dimension halved and
+	 * rounded down on its own. Resizing through an aspect preserving
+	 * Magick::Geometry, as ktech used to, could instead lose a further
+	 * pixel along one side of a non power of two image (11x3 went to 4x1
+	 * rather than 5x1), leaving mipmaps smaller than the header said.
+	 */
+	class MipmapChain : public NonCopyable {
+	public:
+		/*
+		 * A filter kernel, with the distance beyond which it vanishes.
+		 */
+		struct Filter {
+			double (*weight)(double x);
+			double support;
+		};
+
+		static bool isSupported(Magick::FilterTypes filter);
+
+		/*
+		 * Throws for filters without native kernels (box, Lanczos,
+		 * Mitchell, Catmull-Rom and cubic B-spline have them).
+		 */
+		MipmapChain(const RGBAImage& base, Magick::FilterTypes filter);
+
+		size_t columns() const {
+			return width;
+		}
+
+		size_t rows() const {
+			return height;
+		}
+
+		/*
+		 * Downsamples the last level to w x h (each no larger than it
+		 * was), which becomes the last level.
+		 */
+		RGBAImage next(size_t w, size_t h);
+
+		/*
+		 * The next level, at half the size (rounded down, but no less
+		 * than 1).
+		 */
+		RGBAImage next() {
+			return next(std::max(width/2, size_t(1)), std::max(height/2, size_t(1)));
+		}
+
+	private:
+		Filter filter;
+
+		// The first level, until the first next().
+		RGBAImage base;
+
+		// The last level, premultiplied, once base is gone.
+		std::vector<float> level;
+
+		size_t width, height;
+	};
+}
+
+#endif
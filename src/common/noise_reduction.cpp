@@ -0,0 +1,355 @@
+/*
+Copyright (C) 2013  simplex
+
+This program is free software; you can redistribute it and/or
+modify it under the terms of the GNU General Public License
+as published by the Free Software Foundation; either version 2
+of the License, or (at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+
+
+
+#include "noise_reduction.hpp"
+
+#ifdef __SSE2__
+#	include <emmintrin.h>
+#endif
+
+
+using namespace KTools;
+
+
+/*
+ * Smallest image (in pixels) split across threads.
+ */
+static const size_t PARALLEL_MIN_PIXELS = 128*128;
+
+/*
+ * Side of the alpha noise reduction window (Magick's optimal kernel width
+ * for a radius of 1.6).
+ */
+static const int NOISE_WINDOW = 5;
+
+
+/*
+ * Despeckling, as in Magick's despeckle.c.
+ *
+ * A channel is held in a buffer of 16 bit values with a border of one
+ * zero pixel around it, so that neighbours never fall outside. Each hull
+ * takes two passes over it. The first one raises (with negative polarity,
+ * lowers) each value by 1 if the neighbour at the offset is at least 2
+ * above it. The second one does so if the neighbour at the opposite
+ * offset is at least 2 above it and the one at the offset is above it.
+ * Both passes read a buffer and write the other one, so rows are
+ * independent.
+ */
+
+/*
+ * First pass over a row of n values, r being the neighbours at the offset.
+ */
+static void hullFirstPass(const int16_t* v, const int16_t* r, int16_t* out, int n, int polarity) {
+	int i = 0;
+
+#ifdef __SSE2__
+	const __m128i one = _mm_set1_epi16(1);
+	for(; i + 8 <= n; i += 8) {
+		const __m128i vv = _mm_loadu_si128( reinterpret_cast<const __m128i*>(v + i) );
+		const __m128i rr = _mm_loadu_si128( reinterpret_cast<const __m128i*>(r + i) );
+
+		// -1 where the value moves.
+		__m128i moved;
+		if(polarity > 0) {
+			moved = _mm_sub_epi16( vv, _mm_cmpgt_epi16(rr, _mm_add_epi16(vv, one)) );
+		}
+		else {
+			moved = _mm_add_epi16( vv, _mm_cmpgt_epi16(_mm_sub_epi16(vv, one), rr) );
+		}
+		_mm_storeu_si128( reinterpret_cast<__m128i*>(out + i), moved );
+	}
+#endif
+
+	for(; i < n; i++) {
+		int x = v[i];
+		if(polarity > 0) {
+			if(r[i] >= x + 2) x++;
+		}
+		else {
+			if(r[i] <= x - 2) x--;
+		}
+		out[i] = int16_t(x);
+	}
+}
+
+/*
+ * Second pass over a row of n values, r and s being the neighbours at the
+ * offset and at the opposite one.
+ */
+static void hullSecondPass(const int16_t* v, const int16_t* r, const int16_t* s, int16_t* out, int n, int polarity) {
+	int i = 0;
+
+#ifdef __SSE2__
+	const __m128i one = _mm_set1_epi16(1);
+	for(; i + 8 <= n; i += 8) {
+		const __m128i vv = _mm_loadu_si128( reinterpret_cast<const __m128i*>(v + i) );
+		const __m128i rr = _mm_loadu_si128( reinterpret_cast<const __m128i*>(r + i) );
+		const __m128i ss = _mm_loadu_si128( reinterpret_cast<const __m128i*>(s + i) );
+
+		__m128i moved;
+		if(polarity > 0) {
+			const __m128i step = _mm_and_si128( _mm_cmpgt_epi16(ss, _mm_add_epi16(vv, one)), _mm_cmpgt_epi16(rr, vv) );
+			moved = _mm_sub_epi16(vv, step);
+		}
+		else {
+			const __m128i step = _mm_and_si128( _mm_cmpgt_epi16(_mm_sub_epi16(vv, one), ss), _mm_cmpgt_epi16(vv, rr) );
+			moved = _mm_add_epi16(vv, step);
+		}
+		_mm_storeu_si128( reinterpret_cast<__m128i*>(out + i), moved );
+	}
+#endif
+
+	for(; i < n; i++) {
+		int x = v[i];
+		if(polarity > 0) {
+			if(s[i] >= x + 2 && r[i] > x) x++;
+		}
+		else {
+			if(s[i] <= x - 2 && r[i] < x) x--;
+		}
+		out[i] = int16_t(x);
+	}
+}
+
+/*
+ * A channel with its border, along with the buffer the hulls go through.
+ */
+class SpeckleBuffer {
+public:
+	const int columns, rows;
+
+	// Distance from one row to the next.
+	const int stride;
+
+	std::vector<int16_t> f, g;
+
+	SpeckleBuffer(int w, int h) : columns(w), rows(h), stride(w + 2), f(size_t(w + 2)*(h + 2), 0), g(f) {}
+
+	// First pixel of row y.
+	size_t rowStart(int y) const {
+		return size_t(y + 1)*stride + 1;
+	}
+
+	/*
+	 * Runs the hulls over f (in parallel within each pass if the caller is
+	 * in a parallel region).
+	 */
+	void despeckle() {
+		static const int X[4] = {0, 1, 1, -1};
+		static const int Y[4] = {1, 0, 1, 1};
+
+		for(int k = 0; k < 4; k++) {
+			hull(X[k], Y[k], 1);
+			hull(-X[k], -Y[k], 1);
+			hull(-X[k], -Y[k], -1);
+			hull(X[k], Y[k], -1);
+		}
+	}
+
+private:
+	void hull(int dx, int dy, int polarity) {
+		const ptrdiff_t offset = ptrdiff_t(dy)*stride + dx;
+
+#ifdef _OPENMP
+#		pragma omp for schedule(static)
+#endif
+		for(int y = 0; y < rows; y++) {
+			const size_t i = rowStart(y);
+			hullFirstPass(&f[i], &f[i + offset], &g[i], columns, polarity);
+		}
+
+#ifdef _OPENMP
+#		pragma omp for schedule(static)
+#endif
+		for(int y = 0; y < rows; y++) {
+			const size_t i = rowStart(y);
+			hullSecondPass(&g[i], &g[i + offset], &g[i - offset], &f[i], columns, polarity);
+		}
+	}
+};
+
+
+/*
+ * The alpha noise reduction, as Magick's nonpeak statistic: the median of
+ * the window, unless it's its smallest (largest) value, in which case the
+ * next (previous) value in it is taken instead, if there's one.
+ *
+ * Each thread slides a histogram of the window along its rows, with a
+ * coarse one on top to find the median fast.
+ */
+class AlphaWindow {
+	unsigned int fine[256];
+	unsigned int coarse[16];
+
+public:
+	AlphaWindow() {
+		clear();
+	}
+
+	void clear() {
+		std::fill(fine, fine + 256, 0u);
+		std::fill(coarse, coarse + 16, 0u);
+	}
+
+	void add(int a) {
+		fine[a]++;
+		coarse[a >> 4]++;
+	}
+
+	void remove(int a) {
+		fine[a]--;
+		coarse[a >> 4]--;
+	}
+
+	int nonpeak() const {
+		static const unsigned int half = (NOISE_WINDOW*NOISE_WINDOW)/2;
+		static const unsigned int total = NOISE_WINDOW*NOISE_WINDOW;
+
+		unsigned int below = 0;
+		int b = 0;
+		while(below + coarse[b] <= half) {
+			below += coarse[b++];
+		}
+		int v = 16*b;
+		while(below + fine[v] <= half) {
+			below += fine[v++];
+		}
+
+		const bool has_lower = below > 0;
+		const bool has_higher = below + fine[v] < total;
+
+		if(!has_lower && has_higher) {
+			return nextValue(v);
+		}
+		else if(has_lower && !has_higher) {
+			return previousValue(v);
+		}
+		return v;
+	}
+
+private:
+	int nextValue(int v) const {
+		for(v++; v < 256 && (v & 15) != 0; v++) {
+			if(fine[v] > 0) return v;
+		}
+		int b = v >> 4;
+		while(coarse[b] == 0) b++;
+		for(v = 16*b; fine[v] == 0; v++);
+		return v;
+	}
+
+	int previousValue(int v) const {
+		for(v--; v >= 0 && (v & 15) != 15; v--) {
+			if(fine[v] > 0) return v;
+		}
+		int b = v >> 4;
+		while(coarse[b] == 0) b--;
+		for(v = 16*b + 15; fine[v] == 0; v--);
+		return v;
+	}
+};
+
+static inline int clampIndex(int i, int n) {
+	return i < 0 ? 0 : (i >= n ? n - 1 : i);
+}
+
+/*
+ * Writes the reduced alpha of row y, from the despeckled opacity.
+ */
+static void reduceAlphaNoise(const SpeckleBuffer& opacity, int y, AlphaWindow& window, RGBAImage::byte_t* dst) {
+	const int radius = NOISE_WINDOW/2;
+	const int w = opacity.columns;
+
+	const int16_t* rows[NOISE_WINDOW];
+	for(int k = 0; k < NOISE_WINDOW; k++) {
+		rows[k] = &opacity.f[opacity.rowStart( clampIndex(y - radius + k, opacity.rows) )];
+	}
+
+	window.clear();
+	for(int dx = -radius; dx <= radius; dx++) {
+		const int x = clampIndex(dx, w);
+		for(int k = 0; k < NOISE_WINDOW; k++) {
+			window.add(255 - rows[k][x]);
+		}
+	}
+
+	for(int x = 0; x < w; x++, dst += 4) {
+		if(x > 0) {
+			const int out = clampIndex(x - radius - 1, w);
+			const int in = clampIndex(x + radius, w);
+			for(int k = 0; k < NOISE_WINDOW; k++) {
+				window.remove(255 - rows[k][out]);
+				window.add(255 - rows[k][in]);
+			}
+		}
+		dst[3] = RGBAImage::byte_t( window.nonpeak() );
+	}
+}
+
+
+void KTools::ImOp::cleanImageNoise(RGBAImage& img) {
+	const int w = int(img.columns()), h = int(img.rows());
+	if(w == 0 || h == 0) return;
+
+	SpeckleBuffer buffer(w, h);
+
+#ifdef _OPENMP
+#	pragma omp parallel if(size_t(w)*size_t(h) >= PARALLEL_MIN_PIXELS)
+#endif
+	{
+		// The alpha goes last, as opacity, and is left in the buffer.
+		for(int c = 0; c < 4; c++) {
+#ifdef _OPENMP
+#			pragma omp for schedule(static)
+#endif
+			for(int y = 0; y < h; y++) {
+				const RGBAImage::byte_t* src = img.row(y) + c;
+				int16_t* dst = &buffer.f[buffer.rowStart(y)];
+				for(int x = 0; x < w; x++, src += 4) {
+					dst[x] = int16_t(c < 3 ? *src : 255 - *src);
+				}
+			}
+
+			buffer.despeckle();
+
+			if(c == 3) break;
+
+#ifdef _OPENMP
+#			pragma omp for schedule(static)
+#endif
+			for(int y = 0; y < h; y++) {
+				const int16_t* src = &buffer.f[buffer.rowStart(y)];
+				RGBAImage::byte_t* dst = img.row(y) + c;
+				for(int x = 0; x < w; x++, dst += 4) {
+					*dst = RGBAImage::byte_t(src[x]);
+				}
+			}
+		}
+
+		AlphaWindow window;
+
+#ifdef _OPENMP
+#		pragma omp for schedule(static)
+#endif
+		for(int y = 0; y < h; y++) {
+			reduceAlphaNoise(buffer, y, window, img.row(y));
+		}
+	}
+}
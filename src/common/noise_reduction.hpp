@@ -0,0 +1,40 @@
+/*
+Copyright (C) 2013  simplex
+
+This program is free software; you can redistribute it and/or
+modify it under the terms of the GNU General Public License
+as published by the Free Software Foundation; either version 2
+of the License, or (at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+
+
+#ifndef KTOOLS_NOISE_REDUCTION_HPP
+#define KTOOLS_NOISE_REDUCTION_HPP
+
+#include "ktools_common.hpp"
+#include "rgba_image.hpp"
+
+namespace KTools {
+namespace ImOp {
+	/*
+	 * Native version of cleanNoise: Magick's despeckle (Crimmins' speckle
+	 * reduction on each channel, with alpha taken as opacity) followed by
+	 * its noise reduction of radius 1.6 over the alpha (the "nonpeak"
+	 * median of a 5x5 window, edges replicated), in place.
+	 *
+	 * The alpha noise reduction reads the despeckled alpha straight from
+	 * the despeckling buffer and writes the image in a single pass.
+	 */
+	void cleanImageNoise(RGBAImage& img);
+}}
+
+#endif
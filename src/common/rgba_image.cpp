@@ -0,0 +1,216 @@
+/*
+Copyright (C) 2013  simplex
+
+This program is free software; you can redistribute it and/or
+modify it under the terms of the GNU General Public License
+as published by the Free Software Foundation; either version 2
+of the License, or (at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+
+
+#include "rgba_image.hpp"
+
+
+using namespace KTools;
+
+
+/*
+ * Largest size (in bytes) of the released pixel storage kept for reuse.
+ */
+static const size_t PIXEL_POOL_MAX_BYTES = size_t(256) << 20;
+
+/*
+ * Released pixel storage, by capacity. Only touched within the
+ * ktools_pixel_pool critical section.
+ */
+static std::multimap<size_t, RGBAImage::byte_t*> pixel_pool;
+static size_t pixel_pool_bytes = 0;
+
+/*
+ * Takes storage for at least size bytes from the pool (if there's some no
+ * larger than twice that) or allocates it, setting capacity to its size.
+ */
+static RGBAImage::byte_t* acquirePixels(size_t size, size_t& capacity) {
+	RGBAImage::byte_t* data = NULL;
+
+#ifdef _OPENMP
+#	pragma omp critical(ktools_pixel_pool)
+#endif
+	{
+		std::multimap<size_t, RGBAImage::byte_t*>::iterator it = pixel_pool.lower_bound(size);
+		if(it != pixel_pool.end() && it->first/2 <= size) {
+			capacity = it->first;
+			data = it->second;
+			pixel_pool_bytes -= capacity;
+			pixel_pool.erase(it);
+		}
+	}
+
+	if(data == NULL) {
+		capacity = size;
+		data = new RGBAImage::byte_t[capacity];
+	}
+
+	return data;
+}
+
+static void releasePixels(RGBAImage::byte_t* data, size_t capacity) {
+	bool kept = false;
+
+#ifdef _OPENMP
+#	pragma omp critical(ktools_pixel_pool)
+#endif
+	{
+		if(pixel_pool_bytes + capacity <= PIXEL_POOL_MAX_BYTES) {
+			pixel_pool.insert( std::make_pair(capacity, data) );
+			pixel_pool_bytes += capacity;
+			kept = true;
+		}
+	}
+
+	if(!kept) {
+		delete[] data;
+	}
+}
+
+void RGBAImage::trimPool() {
+	std::multimap<size_t, byte_t*> dropped;
+
+#ifdef _OPENMP
+#	pragma omp critical(ktools_pixel_pool)
+#endif
+	{
+		dropped.swap(pixel_pool);
+		pixel_pool_bytes = 0;
+	}
+
+	for(std::multimap<size_t, byte_t*>::iterator it = dropped.begin(); it != dropped.end(); ++it) {
+		delete[] it->second;
+	}
+}
+
+void RGBAImage::acquire(Buffer* b) {
+	release();
+	if(b != NULL) {
+#ifdef _OPENMP
+#		pragma omp critical(ktools_rgba_image_refs)
+#endif
+		{
+			b->refs++;
+		}
+	}
+	buffer = b;
+}
+
+void RGBAImage::release() {
+	if(buffer == NULL) return;
+
+	size_t refs;
+#ifdef _OPENMP
+#	pragma omp critical(ktools_rgba_image_refs)
+#endif
+	{
+		refs = --buffer->refs;
+	}
+
+	if(refs == 0) {
+		releasePixels(buffer->data, buffer->capacity);
+		delete buffer;
+	}
+	buffer = NULL;
+}
+
+RGBAImage::RGBAImage(size_t width, size_t height) : buffer(NULL), origin(NULL), w(width), h(height), row_pitch(ptrdiff_t(4*width)) {
+	if(empty()) {
+		w = h = 0;
+		row_pitch = 0;
+		return;
+	}
+
+	buffer = new Buffer;
+	buffer->refs = 1;
+	try {
+		buffer->data = acquirePixels(4*w*h, buffer->capacity);
+	}
+	catch(...) {
+		delete buffer;
+		buffer = NULL;
+		throw;
+	}
+	origin = buffer->data;
+}
+
+RGBAImage::RGBAImage(const Magick::Image& img) : buffer(NULL), origin(NULL), w(0), h(0), row_pitch(0) {
+	RGBAImage tmp(img.columns(), img.rows());
+	if(!tmp.empty()) {
+		// Image::write() isn't const, but doesn't change the image.
+		Magick::Image src = img;
+		src.write(0, 0, tmp.w, tmp.h, "RGBA", Magick::CharPixel, tmp.origin);
+	}
+	*this = tmp;
+}
+
+RGBAImage& RGBAImage::operator=(const RGBAImage& img) {
+	if(this != &img) {
+		acquire(img.buffer);
+		origin = img.origin;
+		w = img.w;
+		h = img.h;
+		row_pitch = img.row_pitch;
+	}
+	return *this;
+}
+
+RGBAImage RGBAImage::view(size_t x, size_t y, size_t width, size_t height) const {
+	if(x + width > w || y + height > h) {
+		throw(KToolsError("Attempt to view pixels outside of an image."));
+	}
+
+	if(width == 0 || height == 0) {
+		return RGBAImage();
+	}
+
+	RGBAImage v(*this);
+	v.origin = const_cast<byte_t*>(pixel(x, y));
+	v.w = width;
+	v.h = height;
+	return v;
+}
+
+RGBAImage RGBAImage::flipped() const {
+	RGBAImage v(*this);
+	if(!empty()) {
+		v.origin = const_cast<byte_t*>(row(h - 1));
+		v.row_pitch = -row_pitch;
+	}
+	return v;
+}
+
+RGBAImage RGBAImage::clone() const {
+	RGBAImage copy(w, h);
+	for(size_t y = 0; y < h; y++) {
+		memcpy(copy.row(y), row(y), 4*w);
+	}
+	return copy;
+}
+
+Magick::Image RGBAImage::toMagick() const {
+	if(empty()) {
+		return Magick::Image();
+	}
+
+	const RGBAImage packed = (isPacked() ? *this : clone());
+
+	Magick::Image img;
+	img.read(w, h, "RGBA", Magick::CharPixel, packed.origin);
+	return img;
+}
@@ -0,0 +1,155 @@
+/*
+Copyright (C) 2013  simplex
+
+This program is free software; you can redistribute it and/or
+modify it under the terms of the GNU General Public License
+as published by the Free Software Foundation; either version 2
+of the License, or (at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+
+
+#ifndef KTOOLS_RGBA_IMAGE_HPP
+#define KTOOLS_RGBA_IMAGE_HPP
+
+#include "ktools_common.hpp"
+
+namespace KTools {
+	/*
+	 * A plain 8 bit RGBA image, top row first, used between the ImOp
+	 * operations and KTEX compression instead of Magick::Image, which is
+	 * left for reading and writing other formats.
+	 *
+	 * Copies share the pixels (as Magick::Image does, but without copy on
+	 * write), and a view() shares a rectangle of them. The pixel storage
+	 * comes from a pool, since consecutive images (and the images of
+	 * consecutive files) tend to have the same sizes.
+	 */
+	class RGBAImage {
+	public:
+		typedef uint8_t byte_t;
+
+	private:
+		/*
+		 * Reference counted pixel storage.
+		 */
+		struct Buffer {
+			byte_t* data;
+			size_t capacity;
+			size_t refs;
+		};
+
+		Buffer* buffer;
+
+		// First pixel of the top row.
+		byte_t* origin;
+
+		size_t w, h;
+
+		// Distance in bytes from one row to the next.
+		ptrdiff_t row_pitch;
+
+		void acquire(Buffer* b);
+		void release();
+
+	public:
+		RGBAImage() : buffer(NULL), origin(NULL), w(0), h(0), row_pitch(0) {}
+
+		/*
+		 * Allocates an image with rows packed together, with undefined
+		 * pixels.
+		 */
+		RGBAImage(size_t width, size_t height);
+
+		/*
+		 * Reads the pixels of a Magick image.
+		 */
+		explicit RGBAImage(const Magick::Image& img);
+
+		RGBAImage(const RGBAImage& img) : buffer(NULL), origin(img.origin), w(img.w), h(img.h), row_pitch(img.row_pitch) {
+			acquire(img.buffer);
+		}
+
+		~RGBAImage() {
+			release();
+		}
+
+		RGBAImage& operator=(const RGBAImage& img);
+
+		size_t columns() const {
+			return w;
+		}
+
+		size_t rows() const {
+			return h;
+		}
+
+		ptrdiff_t pitch() const {
+			return row_pitch;
+		}
+
+		bool empty() const {
+			return w == 0 || h == 0;
+		}
+
+		/*
+		 * Whether the rows are packed together, with no gap between them.
+		 */
+		bool isPacked() const {
+			return row_pitch == ptrdiff_t(4*w);
+		}
+
+		byte_t* row(size_t y) {
+			return origin + row_pitch*ptrdiff_t(y);
+		}
+
+		const byte_t* row(size_t y) const {
+			return origin + row_pitch*ptrdiff_t(y);
+		}
+
+		byte_t* pixel(size_t x, size_t y) {
+			return row(y) + 4*x;
+		}
+
+		const byte_t* pixel(size_t x, size_t y) const {
+			return row(y) + 4*x;
+		}
+
+		/*
+		 * An image sharing the pixels of the given rectangle.
+		 */
+		RGBAImage view(size_t x, size_t y, size_t width, size_t height) const;
+
+		/*
+		 * An image sharing the pixels, with the rows in reverse order.
+		 */
+		RGBAImage flipped() const;
+
+		/*
+		 * A packed copy of the pixels, not sharing them.
+		 */
+		RGBAImage clone() const;
+
+		/*
+		 * Copies the pixels into a Magick image.
+		 */
+		Magick::Image toMagick() const;
+
+		/*
+		 * Drops the cached pixel storage of released images. Called
+		 * once a file is done with, so that the pool only carries over
+		 * between the images of a single conversion.
+		 */
+		static void trimPool();
+	};
+}
+
+#endif
@@ -49,20 +49,11 @@ static Magick::Image load_image(const path_t& path) {
 		if(options::verbosity >= 0) {
 			cout << "Loading atlas from `" << path << "'..." << endl;
 		}
-		std::istream* in = path.open_in(std::ifstream::binary);
-		try {
-			ktex.load(*in, 0);
-		}
-		catch(...) {
-			delete in;
-			in = NULL;
-			throw;
-		}
-		delete in;
+		ktex.loadFrom(path, -1);
 
-		Magick::Image img = ktex.Decompress();
+		RGBAImage img = ktex.DecompressRGBA();
 		ImOp::demultiplyAlpha()(img);
-		return img;
+		return img.toMagick();
 	}
 	else {
 		return load_vanilla_image(path);
@@ -145,6 +136,9 @@ static KBuild* load_build(std::istream& in, const pathlist_t::value_type& inputd
 
 	for(atlasiter_t it = bild->atlases.begin(); it != bild->atlases.end(); ++it) {
 		it->second = load_image( inputdir/it->first );
+
+		// The native pixels were only needed for the decoding.
+		RGBAImage::trimPool();
 	}
 
 	bildfile.softClear();
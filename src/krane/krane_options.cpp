@@ -125,6 +125,9 @@ void Krane::parse_commandline_options(int& argc, char**& argv, std::list<KTools:
 		args.push_back(&check_anim_fidelity_opt);
 		myOutput.setArgCategory(check_anim_fidelity_opt, TO_SCML);
 
+		MyValueArg<int> jobs_opt("j", "jobs", "Number of worker threads. Defaults to one per processor.", false, 0, "count");
+		args.push_back(&jobs_opt);
+
 		MultiSwitchArg verbosity_flag("v", "verbose", "Increases output verbosity.");
 		args.push_back(&verbosity_flag);
 
@@ -167,6 +170,10 @@ void Krane::parse_commandline_options(int& argc, char**& argv, std::list<KTools:
 		}
 		options::check_animation_fidelity = check_anim_fidelity_opt.getValue();
 
+		if(jobs_opt.isSet()) {
+			setWorkerCount(jobs_opt.getValue());
+		}
+
 		if(quiet_flag.getValue()) {
 			options::verbosity = -1;
 		}
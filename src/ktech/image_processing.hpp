@@ -20,6 +20,7 @@ along with this program.  If not, see <http://www.gnu.org/licenses/>.
 #include "image_operations.hpp"
 #include "file_abstraction.hpp"
 #include "ktex/ktex.hpp"
+#include "mipmap_chain.hpp"
 
 namespace KTech {
 	static inline bool should_resize() {
@@ -106,31 +107,20 @@ namespace ImOp {
 	};
 
 
-	template<typename ImageContainer>
-	static inline void generate_mipmaps(ImageContainer& imgs) {
-		typedef typename ImageContainer::value_type img_t;
-
-		img_t img = imgs.front();
-
-		size_t width = img.columns();
-		size_t height = img.rows();
+	/*
+	 * Appends the mipmaps below the (single) image in mipmaps, down to
+	 * 1x1.
+	 */
+	static inline void generate_mipmaps(std::vector<RGBAImage>& mipmaps) {
+		MipmapChain chain(mipmaps.front(), options::filter);
 
 		if(options::verbosity >= 1) {
-			const size_t mipmap_count = BitOp::countBinaryDigits( std::min(width, height) );
+			const size_t mipmap_count = KTEX::File::getMipmapCount(chain.columns(), chain.rows());
 			std::cout << "Generating " << mipmap_count << " mipmaps..." << std::endl;
 		}
 
-		width /= 2;
-		height /= 2;
-
-		while(width > 0 || height > 0) {
-			img.filterType( options::filter );
-			img.resize( Magick::Geometry(std::max(width, size_t(1)), std::max(height, size_t(1))) );
-			//img.despeckle();
-			imgs.push_back( img );
-
-			width /= 2;
-			height /= 2;
+		while(chain.columns() > 1 || chain.rows() > 1) {
+			mipmaps.push_back( chain.next() );
 		}
 	}
 
@@ -138,43 +128,174 @@ namespace ImOp {
 		ktexHeaderSetter setheader;
 		const int verbosity;
 
-	public:
-		ktexCompressor(KTEX::File::Header h, int _v = -1) : setheader(h), verbosity(_v) {}
+		// Taken from the full verbosity, which compressTo() lowers.
+		const bool report_stats;
 
+		/*
+		 * Resizes, reads the images into native ones, then generates the
+		 * mipmaps, filters and premultiplies them for compression.
+		 */
 		template<typename image_container_t>
-		void compress(KTEX::File& tex, image_container_t& imgs) const {
-			typedef typename image_container_t::iterator image_iterator_t;
-
+		void prepare(image_container_t& imgs, std::vector<RGBAImage>& mipmaps) const {
 			if(should_resize()) {
 				imageResizer()( imgs.front() );
 			}
 
+			// Reading each Magick image copies its pixels out.
+			mipmaps.clear();
+			mipmaps.reserve( imgs.size() );
+			for(typename image_container_t::const_iterator it = imgs.begin(); it != imgs.end(); ++it) {
+				mipmaps.push_back( RGBAImage(*it) );
+			}
+
 			if(options::no_mipmaps || imgs.size() > 1) {
 				if(options::verbosity >= 1) {
 					std::cout << "Skipping mipmap generation..." << std::endl;
 				}
 			} else {
-				generate_mipmaps( imgs );
+				generate_mipmaps( mipmaps );
 			}
 
-			{
-				image_iterator_t first_secondary_mipmap = imgs.begin();
-				std::advance(first_secondary_mipmap, 1);
-				std::for_each( first_secondary_mipmap, imgs.end(), ImOp::cleanNoise() );
+			std::for_each( mipmaps.begin() + 1, mipmaps.end(), ImOp::cleanNoise() );
+
+			if(verbosity >= 1) {
+				if(!options::no_premultiply) {
+					std::cout << "Premultiplying alpha..." << std::endl;
+				}
+				else {
+					std::cout << "Skipping alpha premultiplication..." << std::endl;
+				}
 			}
 
+			rgba_image_operation_chain pixel_ops;
+			getPixelOperations(pixel_ops);
+			std::for_each( mipmaps.begin(), mipmaps.end(), pixel_ops );
+		}
+
+		/*
+		 * The per pixel stages run over the native mipmaps, which the
+		 * chain fuses into a single pass.
+		 */
+		void getPixelOperations(rgba_image_operation_chain& pixel_ops) const {
 			if(!options::no_premultiply) {
-				if(verbosity >= 1) {
+				pixel_ops.push_back( premultiplyAlphaRows() );
+			}
+		}
+
+		void configure(KTEX::File& tex) const {
+			setheader(tex);
+			tex.setEncoderFlags(options::encoder_flags);
+			tex.setEncoderEngine(options::encoder_engine);
+			tex.reportStats(report_stats);
+		}
+
+		/*
+		 * With automatic compression, picks it from the (prepared) base
+		 * mipmap. Must follow configure(), which resets the header.
+		 */
+		void chooseCompression(KTEX::File& tex, const RGBAImage& img) const {
+			if(options::auto_compression) {
+				tex.chooseCompression(img, verbosity);
+			}
+		}
+
+	public:
+		ktexCompressor(KTEX::File::Header h, int _v = -1) : setheader(h), verbosity(_v), report_stats(options::verbosity >= 1) {}
+
+		template<typename image_container_t>
+		void compress(KTEX::File& tex, image_container_t& imgs) const {
+			std::vector<RGBAImage> mipmaps;
+			prepare(imgs, mipmaps);
+			configure(tex);
+			chooseCompression(tex, mipmaps.front());
+			tex.CompressFrom(mipmaps.begin(), mipmaps.end(), verbosity);
+		}
+
+		/*
+		 * Compresses straight into the KTEX file at path.
+		 */
+		template<typename image_container_t>
+		void compressTo(const std::string& path, image_container_t& imgs) const {
+			KTEX::File tex;
+			std::vector<RGBAImage> mipmaps;
+			prepare(imgs, mipmaps);
+			configure(tex);
+			chooseCompression(tex, mipmaps.front());
+			tex.CompressTo(path, mipmaps.begin(), mipmaps.end(), verbosity);
+		}
+
+		/*
+		 * Generates, filters, compresses and writes out the mipmaps one at
+		 * a time, so that besides the source image only the mipmap being
+		 * processed is kept in memory.
+		 */
+		void compressTo(const std::string& path, Magick::Image img) const {
+			const int verbosity0 = options::verbosity;
+			options::verbosity = std::min(verbosity0, verbosity);
+
+			if(should_resize()) {
+				imageResizer()( img );
+			}
+
+			const size_t width = img.columns();
+			const size_t height = img.rows();
+
+			size_t mipmap_count = 1;
+			if(options::no_mipmaps) {
+				if(options::verbosity >= 1) {
+					std::cout << "Skipping mipmap generation..." << std::endl;
+				}
+			}
+			else {
+				mipmap_count = KTEX::File::getMipmapCount(width, height);
+				if(options::verbosity >= 1) {
+					std::cout << "Generating " << mipmap_count << " mipmaps..." << std::endl;
+				}
+			}
+
+			if(verbosity >= 1) {
+				if(!options::no_premultiply) {
 					std::cout << "Premultiplying alpha..." << std::endl;
 				}
-				std::for_each( imgs.begin(), imgs.end(), ImOp::premultiplyAlpha() );
+				else {
+					std::cout << "Skipping alpha premultiplication..." << std::endl;
+				}
 			}
-			else if(verbosity >= 1) {
-				std::cout << "Skipping alpha premultiplication..." << std::endl;
+
+			rgba_image_operation_chain pixel_ops;
+			getPixelOperations(pixel_ops);
+
+			RGBAImage mipmap(img);
+			img = Magick::Image();
+
+			// The chain reads the base, so premultiplication changes a copy.
+			MipmapChain chain(mipmap, options::filter);
+			if(mipmap_count > 1) {
+				mipmap = mipmap.clone();
 			}
+			pixel_ops( mipmap );
 
-			setheader(tex);
-			tex.CompressFrom(imgs.begin(), imgs.end(), verbosity);
+			KTEX::File tex;
+			configure(tex);
+			chooseCompression(tex, mipmap);
+
+			KTEX::File::StreamWriter writer(tex, path, width, height, mipmap_count, verbosity);
+
+			for(size_t i = 0;;) {
+				writer.write( mipmap );
+
+				if(++i >= mipmap_count) break;
+
+				mipmap = chain.next( KTEX::File::getMipmapDimension(width, i), KTEX::File::getMipmapDimension(height, i) );
+				ImOp::cleanNoise()( mipmap );
+				pixel_ops( mipmap );
+			}
+
+			if(verbosity >= 0) {
+				std::cout << "Compressed." << std::endl;
+			}
+
+			options::verbosity = verbosity0;
 		}
 
 		void compress(KTEX::File& tex, Magick::Image img) const {
@@ -201,23 +322,30 @@ namespace ImOp {
 			const int verbosity0 = options::verbosity;
 			options::verbosity = std::min(verbosity0, verbosity);
 
+			std::vector<RGBAImage> mipmaps;
 			if(_mult_mipmaps) {
-				tex.Decompress( std::back_inserter(imgs), verbosity );
+				tex.DecompressRGBA( std::back_inserter(mipmaps), verbosity );
 			}
 			else {
 				imgs.clear();
-				imgs.push_back( tex.Decompress(verbosity) );
+				mipmaps.push_back( tex.DecompressRGBA(verbosity) );
 			}
 
+			rgba_image_operation_chain pixel_ops;
 			if(!options::no_premultiply) {
 				if(verbosity >= 1) {
 					std::cout << "Demultiplying alpha..." << std::endl;
 				}
-				std::for_each( imgs.begin(), imgs.end(), ImOp::demultiplyAlpha() );
+				pixel_ops.push_back( demultiplyAlphaRows() );
 			}
 			else if(verbosity >= 1) {
 				std::cout << "Skipping alpha demultiplication..." << std::endl;
 			}
+			std::for_each( mipmaps.begin(), mipmaps.end(), pixel_ops );
+
+			for(std::vector<RGBAImage>::const_iterator it = mipmaps.begin(); it != mipmaps.end(); ++it) {
+				imgs.push_back( it->toMagick() );
+			}
 
 			if(should_resize()) {
 				if(imgs.size() > 1) {
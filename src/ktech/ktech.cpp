@@ -69,6 +69,13 @@ static void read_images(const PathContainer& paths, ImageContainer& imgs) {
 }
 
 
+static bool is_DDS_file(const VirtualPath& path) {
+	std::istream* in = path.open_in(std::ifstream::binary);
+	const bool is_dds = KTech::KTEX::File::isDDSFile(*in);
+	delete in;
+	return is_dds;
+}
+
 template<typename PathContainer>
 static void convert_to_KTEX(const PathContainer& input_paths, const string& output_path, const KTEX::File::Header& h) {
 	typedef typename PathContainer::const_iterator pc_iter;
@@ -83,6 +90,22 @@ static void convert_to_KTEX(const PathContainer& input_paths, const string& outp
 
 	assert( !input_paths.empty() );
 
+	// Block compressed DDS files are copied through as is, when that
+	// gives what decoding and compressing them again would.
+	if(input_paths.size() == 1 && !should_resize() && is_DDS_file(input_paths.front())) {
+		KTEX::File::DDSConversion conv;
+		conv.premultiply = !options::no_premultiply;
+		conv.auto_compression = options::auto_compression;
+		conv.mipmaps = !options::no_mipmaps;
+
+		KTEX::File tex;
+		tex.header = h;
+		if(tex.loadDDSFrom(input_paths.front(), conv, verbosity)) {
+			tex.dumpTo(output_path, verbosity);
+			return;
+		}
+	}
+
 	if(verbosity >= 0) {
 		cout << "Loading non-TEX from `" << input_paths.front() << "'";
 
@@ -103,23 +126,44 @@ static void convert_to_KTEX(const PathContainer& input_paths, const string& outp
 	read_images( input_paths, imgs );
 	assert( input_paths.size() == imgs.size() );
 
-	KTEX::File tex;
-	ImOp::ktexCompressor(h, std::min(options::verbosity, 0)).compress( tex, imgs );
-	tex.dumpTo(output_path, verbosity);
+	if(verbosity >= 0) {
+		std::cout << "Dumping KTEX to `" << output_path << "'..." << std::endl;
+	}
+
+	if(imgs.size() == 1) {
+		// Stream the mipmaps straight into the output as they're generated.
+		Magick::Image img = imgs.front();
+		imgs.clear();
+
+		ImOp::ktexCompressor(h, std::min(options::verbosity, 0)).compressTo( output_path, img );
+	}
+	else {
+		ImOp::ktexCompressor(h, std::min(options::verbosity, 0)).compressTo( output_path, imgs );
+	}
+	RGBAImage::trimPool();
+}
+
+static void report_block_cache() {
+	const squish::BlockCacheStats stats = squish::GetBlockCacheStats();
+	if(options::verbosity >= 1 && stats.hits + stats.misses > 0) {
+		std::cout << "Block cache: " << stats.hits << " hits, " << stats.misses << " misses." << std::endl;
+	}
 }
 
-static void convert_from_KTEX(std::istream& in, const string& input_path, const string& output_path) {
+static void convert_from_KTEX(const VirtualPath& input_path, const string& output_path) {
 	const int verbosity = options::verbosity;
 	int load_verbosity = verbosity;
 	if(options::info) {
 		load_verbosity = -1;
 	}
 
-	if(load_verbosity >= 0) {
-		std::cout << "Loading KTEX from `" << input_path << "'..." << std::endl;
-	}
 	KTech::KTEX::File tex;
-	tex.load(in, load_verbosity, options::info);
+	if(options::mipmap != nil && !options::info) {
+		tex.loadMipmapFrom(input_path, options::mipmap, load_verbosity);
+	}
+	else {
+		tex.loadFrom(input_path, load_verbosity, options::info);
+	}
 
 	if(options::info) {
 		std::cout << "File: " << input_path << endl;
@@ -133,6 +177,7 @@ static void convert_from_KTEX(std::istream& in, const string& input_path, const
 		std::deque<Magick::Image> imgs;
 
 		ImOp::ktexDecompressor(std::min(options::verbosity, 0), multiple_mipmaps).decompress( tex, imgs );
+		RGBAImage::trimPool();
 
 		if(verbosity >= 0) {
 			if(multiple_mipmaps) {
@@ -214,6 +259,7 @@ static void synthesize_atlas(const VirtualPath& atlas_path, Container input_path
 	}
 
 	A.dump(atlas_path, verbosity);
+	RGBAImage::trimPool();
 }
 
 template<typename Container>
@@ -312,22 +358,21 @@ int main(int argc, char* argv[]) {
 
 		if(is_tex_input) {
 			if(options::atlas_path == nil) {
-				std::istream* in = input_paths.front().open_in(std::ifstream::binary);
-
-				if(!KTech::KTEX::File::isKTEXFile(*in)) {
-					throw KToolsError(std::string("Input file '") + input_paths.front() + "' has '.tex' extension, but its binary contents do not match a KTEX file.");
-				}
-
+				// Loading checks that the input is a KTEX file.
 				if(input_paths.size() > 1) {
 					throw KToolsError("Multiple input files should only be given on TEX output.");
 				}
-				if(!output_has_extension) {
-					output_path.ref() += ".";
-					output_path.ref() += DEFAULT_OUTPUT_EXTENSION;
+				if(!options::info && output_has_extension && output_path.ref().hasExtension("tex")) {
+					KTEX::File::rewriteHeader(input_paths.front(), output_path.ref(), options::header_edits, options::max_mipmaps, options::verbosity);
 				}
+				else {
+					if(!output_has_extension) {
+						output_path.ref() += ".";
+						output_path.ref() += DEFAULT_OUTPUT_EXTENSION;
+					}
 
-				convert_from_KTEX(*in, input_paths.front(), output_path.ref());
-				delete in;
+					convert_from_KTEX(input_paths.front(), output_path.ref());
+				}
 			}
 			else {
 				if(!output_path.ref().mkdir()) {
@@ -351,6 +396,7 @@ int main(int argc, char* argv[]) {
 			else {
 				synthesize_atlas(options::atlas_path.ref(), input_paths, configured_header);
 			}
+			report_block_cache();
 		}
 	}
 	catch(std::exception& e) {
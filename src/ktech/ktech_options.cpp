@@ -41,7 +41,17 @@ automated processing). This should only be used for TEX output.\n\
 \n\
 If output-path contains the string '%02d', then for TEX input all its\n\
 mipmaps will be exported in a sequence of images by replacing '%02d' with\n\
-the number of the mipmap (counting from zero).";
+the number of the mipmap (counting from zero).\n\
+\n\
+If both input-file and output-path are TEX files, the mipmaps are copied\n\
+through without being decoded, only setting the header fields explicitly\n\
+given (platform, type and flags) and dropping the mipmaps beyond\n\
+`max-mipmaps'. If output-path is input-file, its header is patched in place.\n\
+\n\
+DXT1, DXT3 and DXT5 compressed DDS files are copied into TEX as they are,\n\
+keeping their mipmaps, when that matches the conversion asked for: same\n\
+compression and alpha premultiplication, enough mipmaps and no resizing.\n\
+Otherwise they are decoded and compressed again.";
 
 
 
@@ -59,6 +69,12 @@ namespace KTech {
 
 		bool no_mipmaps = false;
 
+		int encoder_flags = 0;
+
+		KTEX::File::EncoderEngine encoder_engine = KTEX::File::SquishEngine;
+
+		bool auto_compression = false;
+
 		Maybe<size_t> width;
 		Maybe<size_t> height;
 		bool pow2 = false;
@@ -68,6 +84,11 @@ namespace KTech {
 		bool extend_left = false;
 
 		Maybe<VirtualPath> atlas_path;
+
+		Maybe<size_t> mipmap;
+
+		std::map<std::string, KTEX::HeaderFieldSpec::value_t> header_edits;
+		Maybe<size_t> max_mipmaps;
 	}
 }
 
@@ -99,6 +120,33 @@ std::string normalize_string(const std::string& s) {
 }
 
 
+/*
+ * Squish flags picking the colour fit, as opposed to the error metric.
+ */
+static const int SQUISH_FIT_FLAGS = squish::kColourIterativeClusterFit | squish::kColourClusterFit | squish::kColourRangeFit | squish::kColourAdaptiveFit | squish::kAdaptiveFitThresholdMask;
+
+/*
+ * Maps a speed level to the squish colour fit. The adaptive levels range
+ * fit every block, and cluster fit only those off by more than the given
+ * number of steps per channel.
+ */
+static int speed_to_squish_flags(int speed) {
+	if(speed <= 0) {
+		return squish::kColourIterativeClusterFit;
+	}
+	switch(speed) {
+		case 1:
+			return squish::kColourClusterFit;
+		case 2:
+			return squish::kColourClusterFit | squish::kColourAdaptiveFit | squish::AdaptiveFitThreshold(2);
+		case 3:
+			return squish::kColourClusterFit | squish::kColourAdaptiveFit | squish::AdaptiveFitThreshold(6);
+		default:
+			return squish::kColourRangeFit;
+	}
+}
+
+
 namespace KTech {
 	namespace options_custom {
 		using namespace KTools::options_custom;
@@ -143,6 +191,25 @@ namespace KTech {
 				default_opt = inverseTranslate(options::filter);
 			}
 		};
+
+		class EncoderPresetTranslator : public StrOptTranslator<KTEX::File::EncoderPreset> {
+		public:
+			EncoderPresetTranslator() {
+				push_opt("fast", KTEX::File::FastEncoder);
+				push_opt("balanced", KTEX::File::BalancedEncoder);
+				push_opt("best", KTEX::File::BestEncoder);
+			}
+		};
+
+		class EncoderEngineTranslator : public StrOptTranslator<KTEX::File::EncoderEngine> {
+		public:
+			EncoderEngineTranslator() {
+				push_opt("squish", KTEX::File::SquishEngine);
+				push_opt("fast", KTEX::File::FastEngine);
+
+				default_opt = inverseTranslate(options::encoder_engine);
+			}
+		};
 	}
 }
 
@@ -183,8 +250,10 @@ KTEX::File::Header KTech::parse_commandline_options(int& argc, char**& argv, std
 		myOutput.setArgCategory(atlas_path_opt, TO_TEX);
 
 		str_trans comp_trans("compression");
-		ValuesConstraint<string> allowed_comps(comp_trans.opts);
-		MyValueArg<string> compression_opt("c", "compression", "Compression type for TEX creation. Defaults to " + comp_trans.default_opt + ".", false, comp_trans.default_opt, &allowed_comps);
+		vector<string> comp_opts = comp_trans.opts;
+		comp_opts.push_back("auto");
+		ValuesConstraint<string> allowed_comps(comp_opts);
+		MyValueArg<string> compression_opt("c", "compression", "Compression type for TEX creation. With auto, it's picked from the alpha of each image: dxt1 if it's opaque, dxt1 or dxt5 if its alpha is all or nothing and dxt3 or dxt5 otherwise, by error. Defaults to " + comp_trans.default_opt + ".", false, comp_trans.default_opt, &allowed_comps);
 		args.push_back(&compression_opt);
 		myOutput.setArgCategory(compression_opt, TO_TEX);
 
@@ -192,6 +261,22 @@ KTEX::File::Header KTech::parse_commandline_options(int& argc, char**& argv, std
 		args.push_back(&quality_opt);
 		myOutput.setArgCategory(quality_opt, FROM_TEX);
 
+		EncoderPresetTranslator preset_trans;
+		ValuesConstraint<string> allowed_presets(preset_trans.opts);
+		MyValueArg<string> preset_opt("", "preset", "Encoder settings for TEX creation: fast for iterating on assets, best for releases and balanced in between. With `verbose', the error and speed of each mipmap are printed.", false, "", &allowed_presets);
+		args.push_back(&preset_opt);
+		myOutput.setArgCategory(preset_opt, TO_TEX);
+
+		EncoderEngineTranslator engine_trans;
+		ValuesConstraint<string> allowed_engines(engine_trans.opts);
+		MyValueArg<string> engine_opt("", "encoder", "DXT encoder for TEX creation. squish is tuned for quality and fast, a single pass encoder ignoring `preset' and `speed', for turnaround. Defaults to " + engine_trans.default_opt + ".", false, engine_trans.default_opt, &allowed_engines);
+		args.push_back(&engine_opt);
+		myOutput.setArgCategory(engine_opt, TO_TEX);
+
+		MyValueArg<int> speed_opt("", "speed", "Trades quality for compression speed. 0 cluster fits every block iteratively, 1 cluster fits every block, 2 and 3 range fit every block first and cluster fit only those with a poor fit, 4 only range fits. Overrides the colour fit of `preset'. Defaults to 1.", false, 1, "0-4");
+		args.push_back(&speed_opt);
+		myOutput.setArgCategory(speed_opt, TO_TEX);
+
 		FilterTypeTranslator filter_trans;
 		ValuesConstraint<string> allowed_filters(filter_trans.opts);
 		MyValueArg<string> filter_opt("f", "filter", "Resizing filter used for mipmap generation. Defaults to " + filter_trans.default_opt + ".", false, filter_trans.default_opt, &allowed_filters);
@@ -232,20 +317,37 @@ KTEX::File::Header KTech::parse_commandline_options(int& argc, char**& argv, std
 
 
 
-		/*
 		str_trans plat_trans("platform");
 		ValuesConstraint<string> allowed_plats(plat_trans.opts);
 		MyValueArg<string> platform_opt("p", "platform", "Target platform. Defaults to " + plat_trans.default_opt + ".", false, plat_trans.default_opt, &allowed_plats);
 		args.push_back(&platform_opt);
 		myOutput.setArgCategory(platform_opt, TO_TEX);
-		*/
+
+		MyValueArg<unsigned int> flags_opt("", "flags", "Header flags of the TEX file. Defaults to 3.", false, 3, "0-3");
+		args.push_back(&flags_opt);
+		myOutput.setArgCategory(flags_opt, TO_TEX);
+
+		MyValueArg<size_t> max_mipmaps_opt("", "max-mipmaps", "Maximum number of mipmaps kept when rewriting a TEX file into another TEX file, dropping the smallest ones.", false, 0, "count");
+		args.push_back(&max_mipmaps_opt);
+		myOutput.setArgCategory(max_mipmaps_opt, FROM_TEX);
 
 
+		MyValueArg<size_t> mipmap_opt("", "mipmap", "Converts only the given mipmap of a TEX file (counting from zero), without reading the others.", false, 0, "index");
+		args.push_back(&mipmap_opt);
+		myOutput.setArgCategory(mipmap_opt, FROM_TEX);
+
 		SwitchArg info_flag("i", "info", "Prints information for a given TEX file instead of converting it.");
 		args.push_back(&info_flag);
 		myOutput.setArgCategory(info_flag, FROM_TEX);
 
 
+		MyValueArg<size_t> block_cache_opt("", "block-cache", "Megabytes of memory used to remember compressed blocks, so that blocks repeated across mipmaps, atlas sheets and input images are compressed only once. Disabled by default.", false, 0, "MB");
+		args.push_back(&block_cache_opt);
+		myOutput.setArgCategory(block_cache_opt, TO_TEX);
+
+		MyValueArg<int> jobs_opt("j", "jobs", "Number of worker threads. Defaults to one per processor.", false, 0, "count");
+		args.push_back(&jobs_opt);
+
 		MultiSwitchArg verbosity_flag("v", "verbose", "Increases output verbosity.");
 		args.push_back(&verbosity_flag);
 
@@ -277,9 +379,29 @@ KTEX::File::Header KTech::parse_commandline_options(int& argc, char**& argv, std
 			options::atlas_path = Just( VirtualPath(atlas_path_opt.getValue()) );
 		}
 
-		configured_header.setField("compression", comp_trans.translate(compression_opt));
+		if(compression_opt.getValue() == "auto") {
+			options::auto_compression = true;
+		}
+		else {
+			configured_header.setField("compression", comp_trans.translate(compression_opt));
+		}
 		configured_header.setField("texture_type", type_trans.translate(type_opt));
-		//configured_header.setField("platform", plat_trans.translate(platform_opt));
+		configured_header.setField("platform", plat_trans.translate(platform_opt));
+		configured_header.setField("flags", flags_opt.getValue());
+
+		if(type_opt.isSet()) {
+			options::header_edits["texture_type"] = configured_header.getField("texture_type");
+		}
+		if(platform_opt.isSet()) {
+			options::header_edits["platform"] = configured_header.getField("platform");
+		}
+		if(flags_opt.isSet()) {
+			options::header_edits["flags"] = configured_header.getField("flags");
+		}
+
+		if(max_mipmaps_opt.isSet()) {
+			options::max_mipmaps = Just((size_t)max_mipmaps_opt.getValue());
+		}
 
 		options::image_quality = quality_opt.getValue();
 		if(options::image_quality < 0) {
@@ -291,12 +413,29 @@ KTEX::File::Header KTech::parse_commandline_options(int& argc, char**& argv, std
 
 		options::filter = filter_trans.translate(filter_opt.getValue());
 
+		options::encoder_engine = engine_trans.translate(engine_opt);
+
+		options::encoder_flags = speed_to_squish_flags(speed_opt.getValue());
+		if(preset_opt.isSet()) {
+			const int preset_flags = KTEX::File::getEncoderPresetFlags(preset_trans.translate(preset_opt));
+			if(speed_opt.isSet()) {
+				options::encoder_flags |= preset_flags & ~SQUISH_FIT_FLAGS;
+			}
+			else {
+				options::encoder_flags = preset_flags;
+			}
+		}
+
 		/*
 		options::no_premultiply = no_premultiply_flag.getValue();
 		*/
 
 		options::no_mipmaps = no_mipmaps_flag.getValue();
 
+		if(mipmap_opt.isSet()) {
+			options::mipmap = Just((size_t)mipmap_opt.getValue());
+		}
+
 		if(width_opt.isSet()) {
 			options::width = Just((size_t)width_opt.getValue());
 		}
@@ -316,6 +455,14 @@ KTEX::File::Header KTech::parse_commandline_options(int& argc, char**& argv, std
 			options::extend = true;
 		}
 
+		if(jobs_opt.isSet()) {
+			setWorkerCount(jobs_opt.getValue());
+		}
+
+		if(block_cache_opt.isSet()) {
+			squish::SetBlockCacheSize(block_cache_opt.getValue() << 20);
+		}
+
 		if(quiet_flag.getValue()) {
 			options::verbosity = -1;
 		}
@@ -21,6 +21,7 @@ along with this program.  If not, see <http://www.gnu.org/licenses/>.
 
 #include "ktech_common.hpp"
 #include "file_abstraction.hpp"
+#include "ktex/ktex.hpp"
 
 namespace KTech {
 	namespace options {
@@ -36,6 +37,18 @@ namespace KTech {
 
 		extern bool no_mipmaps;
 
+		/*
+		 * Squish flags picking the colour fit, from the speed level.
+		 */
+		extern int encoder_flags;
+
+		extern KTEX::File::EncoderEngine encoder_engine;
+
+		/*
+		 * Whether the compression is picked per image, from its alpha.
+		 */
+		extern bool auto_compression;
+
 		extern Maybe<size_t> width;
 		extern Maybe<size_t> height;
 		extern bool pow2;
@@ -45,6 +58,14 @@ namespace KTech {
 		extern bool extend_left;
 
 		extern Maybe<VirtualPath> atlas_path;
+
+		extern Maybe<size_t> mipmap;
+
+		/*
+		 * Header fields explicitly given, for TEX to TEX rewrites.
+		 */
+		extern std::map<std::string, KTEX::HeaderFieldSpec::value_t> header_edits;
+		extern Maybe<size_t> max_mipmaps;
 	}
 }
 
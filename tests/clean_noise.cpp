@@ -0,0 +1,150 @@
+/*
+Copyright (C) 2013  simplex
+
+This program is free software; you can redistribute it and/or
+modify it under the terms of the GNU General Public License
+as published by the Free Software Foundation; either version 2
+of the License, or (at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+
+
+/*
+ * Checks that ImOp::cleanNoise gives the same pixels on a native image as
+ * on a Magick image (where it runs Magick's own despeckle and noise
+ * reduction). The native version is meant to be exact, so any difference
+ * is a failure.
+ *
+ * Exactness was only worked out for Magick with 16 bit integer quanta
+ * (despeckling steps by one quantum), so other builds skip the test.
+ */
+
+#include "ktools_common.hpp"
+#include "rgba_image.hpp"
+#include "image_operations.hpp"
+
+#include <cstdio>
+
+using namespace KTools;
+
+
+/*
+ * Exit status when skipped (see SKIP_RETURN_CODE in CMakeLists.txt).
+ */
+static const int SKIPPED = 77;
+
+/*
+ * Noise over a few flat areas, with alpha either noisy too or made of
+ * blocks (the cutout edges mipmaps have), from a fixed seed.
+ */
+static RGBAImage makeImage(size_t width, size_t height, bool block_alpha) {
+	RGBAImage img(width, height);
+
+	unsigned int state = 7;
+	for(size_t y = 0; y < height; y++) {
+		RGBAImage::byte_t* p = img.row(y);
+		for(size_t x = 0; x < width; x++, p += 4) {
+			for(int c = 0; c < 4; c++) {
+				state = state*1103515245u + 12345u;
+				const unsigned int noise = (state >> 16) & 0xff;
+
+				if(c < 3 && (x/8 + y/8) % 2 == 0) {
+					// Flat, with the odd speckle.
+					p[c] = RGBAImage::byte_t( noise < 16 ? noise : 96 + 32*c );
+				}
+				else {
+					p[c] = RGBAImage::byte_t( noise );
+				}
+			}
+			if(block_alpha) {
+				p[3] = ((x/5 + y/3) % 3 == 0) ? 0 : 255;
+			}
+		}
+	}
+
+	return img;
+}
+
+/*
+ * Returns the number of bytes differing between the images.
+ */
+static size_t countDifferences(const RGBAImage& a, const RGBAImage& b) {
+	if(a.columns() != b.columns() || a.rows() != b.rows()) {
+		return 4*a.columns()*a.rows() + 1;
+	}
+
+	size_t count = 0;
+	for(size_t y = 0; y < a.rows(); y++) {
+		const RGBAImage::byte_t* p = a.row(y);
+		const RGBAImage::byte_t* q = b.row(y);
+		for(size_t i = 0; i < 4*a.columns(); i++) {
+			if(p[i] != q[i]) {
+				count++;
+			}
+		}
+	}
+
+	return count;
+}
+
+static bool testImage(size_t width, size_t height, bool block_alpha) {
+	const RGBAImage base = makeImage(width, height, block_alpha);
+
+	Magick::Image img = base.toMagick();
+	ImOp::cleanNoise()(img);
+
+	RGBAImage native = base.clone();
+	ImOp::cleanNoise()(native);
+
+	const size_t diff = countDifferences(native, RGBAImage(img));
+	if(diff > 0) {
+		std::printf("%lux%lu%s: %lu bytes differ\n", (unsigned long)width, (unsigned long)height, block_alpha ? " (block alpha)" : "", (unsigned long)diff);
+		return false;
+	}
+
+	return true;
+}
+
+
+int main(int argc, char* argv[]) {
+	(void)argc;
+
+#if MAGICKCORE_QUANTUM_DEPTH != 16 || MAGICKCORE_HDRI_ENABLE || defined(MAGICKCORE_HDRI_SUPPORT)
+	(void)argv;
+	std::printf("Skipped: only checked for Magick with 16 bit quanta, without HDRI.\n");
+	return SKIPPED;
+#else
+	Magick::InitializeMagick(argv[0]);
+
+	static const size_t sizes[][2] = {
+		{1, 1},
+		{3, 2},
+		{7, 5},
+		{64, 64},
+		{200, 150},
+	};
+
+	bool ok = true;
+	for(size_t i = 0; i < sizeof(sizes)/sizeof(sizes[0]); i++) {
+		for(int block_alpha = 0; block_alpha < 2; block_alpha++) {
+			if(!testImage(sizes[i][0], sizes[i][1], block_alpha != 0)) {
+				ok = false;
+			}
+		}
+	}
+
+	if(ok) {
+		std::printf("Native and Magick noise cleaning agree.\n");
+	}
+
+	return ok ? 0 : 1;
+#endif
+}
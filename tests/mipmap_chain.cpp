@@ -0,0 +1,185 @@
+/*
+Copyright (C) 2013  simplex
+
+This program is free software; you can redistribute it and/or
+modify it under the terms of the GNU General Public License
+as published by the Free Software Foundation; either version 2
+of the License, or (at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+
+
+/*
+ * Checks the native mipmaps against those of Magick::Image::resize, each
+ * level resized from the one above (as ktech used to generate them), with
+ * every filter MipmapChain has a kernel for.
+ *
+ * Both sides get the same level sizes, so the sizes themselves are not
+ * under test here (see mipmap_chain.hpp).
+ */
+
+#include "ktools_common.hpp"
+#include "rgba_image.hpp"
+#include "mipmap_chain.hpp"
+
+#include <cstdio>
+#include <cstdlib>
+
+using namespace KTools;
+
+
+/*
+ * Largest difference allowed in any channel of a level, in 8 bit steps.
+ * Magick filters in double precision and, without HDRI, stores each pass
+ * as 16 bit quanta, while the chain filters in single precision floats.
+ */
+static const int TOLERANCE = 2;
+
+/*
+ * Colour is only compared where both alphas are at least this, since
+ * demultiplying scales any difference up by 255/alpha.
+ */
+static const int MIN_COMPARED_ALPHA = 64;
+
+/*
+ * Exit status when skipped, for Magick builds the tolerance was not worked
+ * out for (see SKIP_RETURN_CODE in CMakeLists.txt).
+ */
+static const int SKIPPED = 77;
+
+
+/*
+ * Gradients, noise and a transparent corner, from a fixed seed.
+ */
+static RGBAImage makeImage(size_t width, size_t height) {
+	RGBAImage img(width, height);
+
+	unsigned int state = 1;
+	for(size_t y = 0; y < height; y++) {
+		RGBAImage::byte_t* p = img.row(y);
+		for(size_t x = 0; x < width; x++, p += 4) {
+			state = state*1103515245u + 12345u;
+			const unsigned int noise = (state >> 16) & 0x3f;
+
+			p[0] = RGBAImage::byte_t( (255*x)/width );
+			p[1] = RGBAImage::byte_t( (255*y)/height );
+			p[2] = RGBAImage::byte_t( 128 + noise );
+			if(x < width/4 && y < height/4) {
+				p[3] = 0;
+			}
+			else {
+				p[3] = RGBAImage::byte_t( 255 - 2*noise );
+			}
+		}
+	}
+
+	return img;
+}
+
+/*
+ * Returns the largest difference between the levels, as described above.
+ */
+static int compareLevels(const RGBAImage& a, const RGBAImage& b) {
+	if(a.columns() != b.columns() || a.rows() != b.rows()) {
+		return 256;
+	}
+
+	int max_diff = 0;
+	for(size_t y = 0; y < a.rows(); y++) {
+		const RGBAImage::byte_t* p = a.row(y);
+		const RGBAImage::byte_t* q = b.row(y);
+		for(size_t x = 0; x < a.columns(); x++, p += 4, q += 4) {
+			max_diff = std::max(max_diff, std::abs(int(p[3]) - int(q[3])));
+			if(p[3] < MIN_COMPARED_ALPHA || q[3] < MIN_COMPARED_ALPHA) {
+				continue;
+			}
+			for(int c = 0; c < 3; c++) {
+				max_diff = std::max(max_diff, std::abs(int(p[c]) - int(q[c])));
+			}
+		}
+	}
+
+	return max_diff;
+}
+
+/*
+ * Returns the largest difference over the levels of an image.
+ */
+static int testFilter(const char* name, Magick::FilterTypes filter, size_t width, size_t height) {
+	const RGBAImage base = makeImage(width, height);
+
+	MipmapChain chain(base, filter);
+	Magick::Image img = base.toMagick();
+
+	int max_diff = 0;
+	for(size_t level = 1; chain.columns() > 1 || chain.rows() > 1; level++) {
+		const size_t w = std::max(chain.columns()/2, size_t(1));
+		const size_t h = std::max(chain.rows()/2, size_t(1));
+
+		Magick::Geometry size(w, h);
+		size.aspect(true);
+		img.filterType(filter);
+		img.resize(size);
+
+		const int diff = compareLevels(chain.next(w, h), RGBAImage(img));
+		if(diff > TOLERANCE) {
+			std::printf("%s, %lux%lu, level %lu (%lux%lu): off by %d\n", name, (unsigned long)width, (unsigned long)height, (unsigned long)level, (unsigned long)w, (unsigned long)h, diff);
+		}
+		max_diff = std::max(max_diff, diff);
+	}
+
+	return max_diff;
+}
+
+
+int main(int argc, char* argv[]) {
+	(void)argc;
+
+#if MAGICKCORE_QUANTUM_DEPTH != 16
+	(void)argv;
+	std::printf("Skipped: the tolerance only holds for Magick with 16 bit quanta.\n");
+	return SKIPPED;
+#else
+	Magick::InitializeMagick(argv[0]);
+
+	static const struct {
+		const char* name;
+		Magick::FilterTypes filter;
+	} filters[] = {
+		{"box", Magick::BoxFilter},
+		{"lanczos", Magick::LanczosFilter},
+		{"mitchell", Magick::MitchellFilter},
+		{"catrom", Magick::CatromFilter},
+		{"cubic", Magick::CubicFilter},
+	};
+
+	static const size_t sizes[][2] = {
+		{64, 64},
+		{300, 200},
+		{37, 5},
+	};
+
+	bool ok = true;
+	for(size_t i = 0; i < sizeof(filters)/sizeof(filters[0]); i++) {
+		int max_diff = 0;
+		for(size_t j = 0; j < sizeof(sizes)/sizeof(sizes[0]); j++) {
+			max_diff = std::max(max_diff, testFilter(filters[i].name, filters[i].filter, sizes[j][0], sizes[j][1]));
+		}
+
+		std::printf("%s: worst difference %d (tolerance %d)\n", filters[i].name, max_diff, TOLERANCE);
+		if(max_diff > TOLERANCE) {
+			ok = false;
+		}
+	}
+
+	return ok ? 0 : 1;
+#endif
+}